@@ -141,6 +141,9 @@ static void fm_config_init(FmConfig *self)
     self->deferred_mime_type_loading = TRUE;
     self->exo_icon_view_pixbuf_hack = TRUE;
     self->exo_icon_draw_rectangle_around_selected_item = TRUE;
+    self->folder_snapshots = FM_CONFIG_DEFAULT_FOLDER_SNAPSHOTS;
+    self->monitor_flush_interval = FM_CONFIG_DEFAULT_MONITOR_FLUSH_INTERVAL;
+    self->monitor_max_batch = FM_CONFIG_DEFAULT_MONITOR_MAX_BATCH;
 }
 
 /**
@@ -207,6 +210,9 @@ void fm_config_load_from_key_file(FmConfig* cfg, GKeyFile* kf)
     fm_key_file_get_bool(kf, "config", "only_user_templates", &cfg->only_user_templates);
     fm_key_file_get_bool(kf, "config", "template_run_app", &cfg->template_run_app);
     fm_key_file_get_bool(kf, "config", "template_type_once", &cfg->template_type_once);
+    fm_key_file_get_bool(kf, "config", "folder_snapshots", &cfg->folder_snapshots);
+    fm_key_file_get_int(kf, "config", "monitor_flush_interval", &cfg->monitor_flush_interval);
+    fm_key_file_get_int(kf, "config", "monitor_max_batch", &cfg->monitor_max_batch);
 
 #ifdef USE_UDISKS
     fm_key_file_get_bool(kf, "config", "show_internal_volumes", &cfg->show_internal_volumes);
@@ -329,6 +335,9 @@ void fm_config_save(FmConfig* cfg, const char* name)
             fprintf(f, "only_user_templates=%d\n", cfg->only_user_templates);
             fprintf(f, "template_run_app=%d\n", cfg->template_run_app);
             fprintf(f, "template_type_once=%d\n", cfg->template_type_once);
+            fprintf(f, "folder_snapshots=%d\n", cfg->folder_snapshots);
+            fprintf(f, "monitor_flush_interval=%d\n", cfg->monitor_flush_interval);
+            fprintf(f, "monitor_max_batch=%d\n", cfg->monitor_max_batch);
             fprintf(f, "auto_selection_delay=%d\n", cfg->auto_selection_delay);
             fprintf(f, "drop_default_action=%d\n", cfg->drop_default_action);
 #ifdef USE_UDISKS
@@ -63,6 +63,9 @@ typedef struct _FmConfigClass       FmConfigClass;
 #define     FM_CONFIG_DEFAULT_TEMPLATE_RUN_APP  FALSE
 #define     FM_CONFIG_DEFAULT_TEMPL_TYPE_ONCE   FALSE
 #define     FM_CONFIG_DEFAULT_SHADOW_HIDDEN     FALSE
+#define     FM_CONFIG_DEFAULT_FOLDER_SNAPSHOTS  FALSE
+#define     FM_CONFIG_DEFAULT_MONITOR_FLUSH_INTERVAL 200
+#define     FM_CONFIG_DEFAULT_MONITOR_MAX_BATCH 1000
 
 #define     FM_CONFIG_DEFAULT_PLACES_HOME       TRUE
 #define     FM_CONFIG_DEFAULT_PLACES_DESKTOP    TRUE
@@ -112,6 +115,9 @@ typedef struct _FmConfigClass       FmConfigClass;
  * @only_user_templates: show only user defined templates in 'Create...' menu
  * @template_run_app: run default application after creation from template
  * @template_type_once: use only one template of each MIME type
+ * @folder_snapshots: keep listings of big folders on disk to show them at once (since 1.2.0)
+ * @monitor_flush_interval: milliseconds changes of files in a folder are collected for (since 1.2.0)
+ * @monitor_max_batch: max number of changed files handled at once (since 1.2.0)
  */
 struct _FmConfig
 {
@@ -166,11 +172,13 @@ struct _FmConfig
 
     gboolean exo_icon_draw_rectangle_around_selected_item;
 
+    /* the fields below take place of the reserved ones */
+    gboolean folder_snapshots; /* was _reserved1 */
+    gint monitor_flush_interval; /* was _reserved2 */
+    gint monitor_max_batch; /* was _reserved3 */
+
     /*< private >*/
-    gpointer _reserved1; /* reserved space for updates until next ABI */
-    gpointer _reserved2;
-    gpointer _reserved3;
-    gpointer _reserved4;
+    gpointer _reserved4; /* reserved space for updates until next ABI */
     gpointer _reserved5;
     gpointer _reserved6;
     gpointer _reserved7;
@@ -0,0 +1,395 @@
+/*
+ *      fm-content-type-cache.c
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* Content types of files guessed by reading them, stored on disk.
+ *
+ * A file whose type can't be guessed by name is read to guess it by
+ * content. The result is stored under the device, inode, size and
+ * modification time of the file, so as long as they are the same, the
+ * file isn't read again, by this process or by another one.
+ *
+ * The cache is a file in the user cache directory mapped into memory by
+ * all processes using it. It has a fixed size: the header, a table of
+ * type names, and a hash table of slots in buckets of CACHE_WAYS. A new
+ * entry replaces an old one in its bucket when the bucket is full, so
+ * the cache never grows.
+ *
+ * Slots are read without locking. Each slot has a sequence number which
+ * is odd while the slot is written, and a reader retries if it changed
+ * while reading. Writers, in this process and in others, are serialized
+ * with a mutex and flock(). Type names are only appended, so an index
+ * read from a slot always refers to the same name.
+ *
+ * The file is never shrunk, which would make the processes that have it
+ * mapped crash on access. A layout change gets a new file name.
+ *
+ * What a file is sniffed as depends on the shared-mime-info database, so
+ * the header keeps a stamp of its files. It's checked every
+ * DB_CHECK_INTERVAL, and the slots are cleared if the database changed.
+ *
+ * Files modified in the last seconds are not stored: they may be written
+ * again within the resolution of the file system timestamps, without
+ * changing the modification time.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#include "fm-content-type-cache.h"
+
+#define CACHE_FILE_NAME "content-types-2.cache"
+#define CACHE_MAGIC "smfmctc"
+#define CACHE_N_SLOTS 32768  /* power of 2 */
+#define CACHE_WAYS 4         /* slots in a bucket */
+#define CACHE_MAX_TYPES 1024
+#define CACHE_TYPE_SIZE 96   /* longer names are not stored */
+#define RACY_INTERVAL 2      /* seconds */
+#define MAX_READ_TRIES 100
+#define DB_CHECK_INTERVAL (5 * G_USEC_PER_SEC) /* the same as for name guesses */
+
+typedef struct
+{
+    char magic[8];
+    guint32 n_slots;
+    guint32 max_types;
+    guint32 type_size;
+    volatile gint n_types;
+    guint64 db_stamp; /* of the mime database the slots were filled with */
+} CacheHeader;
+
+typedef struct
+{
+    volatile gint seq; /* odd while the slot is written */
+    guint32 type;      /* index of the name + 1, 0 if the slot is empty */
+    guint64 dev;
+    guint64 ino;
+    gint64 size;
+    gint64 mtime_sec;
+    gint64 mtime_nsec;
+} CacheSlot;
+
+#define CACHE_TYPES_OFFSET sizeof(CacheHeader)
+#define CACHE_SLOTS_OFFSET (CACHE_TYPES_OFFSET + CACHE_MAX_TYPES * CACHE_TYPE_SIZE)
+#define CACHE_SIZE (CACHE_SLOTS_OFFSET + CACHE_N_SLOTS * sizeof(CacheSlot))
+
+static GMutex cache_mutex;
+static int cache_fd = -1;
+static char * cache_data = NULL;
+static gboolean cache_tried = FALSE;
+static GHashTable * type_indexes = NULL; /* name -> index + 1 of known names */
+static gint n_indexed_types = 0;
+static gint64 db_checked = 0;
+
+#define HEADER ((CacheHeader *) cache_data)
+#define TYPE_NAME(index) (cache_data + CACHE_TYPES_OFFSET + (gsize) (index) * CACHE_TYPE_SIZE)
+#define SLOTS ((CacheSlot *) (cache_data + CACHE_SLOTS_OFFSET))
+
+static gboolean header_is_valid(void)
+{
+    return memcmp(HEADER->magic, CACHE_MAGIC, sizeof(HEADER->magic)) == 0 &&
+           HEADER->n_slots == CACHE_N_SLOTS &&
+           HEADER->max_types == CACHE_MAX_TYPES &&
+           HEADER->type_size == CACHE_TYPE_SIZE &&
+           (guint) HEADER->n_types <= CACHE_MAX_TYPES;
+}
+
+/* should be called with cache_mutex locked */
+static gboolean cache_open(void)
+{
+    char * dir, * file;
+    struct stat st;
+
+    if (cache_tried)
+        return cache_data != NULL;
+    cache_tried = TRUE;
+
+    dir = g_build_filename(g_get_user_cache_dir(), "libsmfm", NULL);
+    file = g_build_filename(dir, CACHE_FILE_NAME, NULL);
+    if (g_mkdir_with_parents(dir, 0700) == 0)
+        cache_fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    g_free(file);
+    g_free(dir);
+    if (cache_fd < 0)
+        return FALSE;
+
+    flock(cache_fd, LOCK_EX);
+    if (fstat(cache_fd, &st) == 0 &&
+        (st.st_size >= (off_t) CACHE_SIZE || ftruncate(cache_fd, CACHE_SIZE) == 0))
+    {
+        cache_data = mmap(NULL, CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, cache_fd, 0);
+        if (cache_data == MAP_FAILED)
+            cache_data = NULL;
+    }
+    if (cache_data && !header_is_valid())
+    {
+        /* a new or a damaged file; others can't use it either, so it's
+         * cleared in place */
+        memset(cache_data, 0, CACHE_SIZE);
+        memcpy(HEADER->magic, CACHE_MAGIC, sizeof(HEADER->magic));
+        HEADER->n_slots = CACHE_N_SLOTS;
+        HEADER->max_types = CACHE_MAX_TYPES;
+        HEADER->type_size = CACHE_TYPE_SIZE;
+    }
+    flock(cache_fd, LOCK_UN);
+
+    if (!cache_data)
+    {
+        close(cache_fd);
+        cache_fd = -1;
+        return FALSE;
+    }
+    type_indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    return TRUE;
+}
+
+static void db_stamp_add_file(guint64 * stamp, const char * data_dir, const char * name)
+{
+    char * file = g_build_filename(data_dir, "mime", name, NULL);
+    struct stat st;
+    guint64 values[3];
+    int i;
+
+    if (stat(file, &st) != 0)
+        memset(&st, 0, sizeof(st));
+    g_free(file);
+    values[0] = st.st_mtim.tv_sec;
+    values[1] = st.st_mtim.tv_nsec;
+    values[2] = st.st_size;
+    /* FNV-1a over the values */
+    for (i = 0; i < 3; i++)
+        *stamp = (*stamp ^ values[i]) * G_GUINT64_CONSTANT(0x100000001b3);
+}
+
+/* mtimes and sizes of the files GIO sniffs the content with */
+static guint64 make_db_stamp(void)
+{
+    const char * const * dirs = g_get_system_data_dirs();
+    guint64 stamp = G_GUINT64_CONSTANT(0xcbf29ce484222325);
+
+    db_stamp_add_file(&stamp, g_get_user_data_dir(), "mime.cache");
+    db_stamp_add_file(&stamp, g_get_user_data_dir(), "magic");
+    for (; *dirs; dirs++)
+    {
+        db_stamp_add_file(&stamp, *dirs, "mime.cache");
+        db_stamp_add_file(&stamp, *dirs, "magic");
+    }
+    return stamp;
+}
+
+/* Clears the slots if the mime database changed; should be called with
+ * cache_mutex locked and the cache open. */
+static void cache_check_db(void)
+{
+    gint64 now = g_get_monotonic_time();
+    guint64 stamp;
+    guint i;
+
+    if (db_checked && now - db_checked < DB_CHECK_INTERVAL)
+        return;
+    db_checked = now;
+    stamp = make_db_stamp();
+    if (stamp == HEADER->db_stamp)
+        return;
+
+    flock(cache_fd, LOCK_EX);
+    if (stamp != HEADER->db_stamp)
+    {
+        /* readers may be reading the slots, so they're cleared as written */
+        for (i = 0; i < CACHE_N_SLOTS; i++)
+        {
+            CacheSlot * slot = &SLOTS[i];
+            if (slot->type == 0)
+                continue;
+            g_atomic_int_inc(&slot->seq);
+            slot->type = 0;
+            g_atomic_int_inc(&slot->seq);
+        }
+        HEADER->db_stamp = stamp;
+    }
+    flock(cache_fd, LOCK_UN);
+}
+
+static gboolean cache_get(void)
+{
+    gboolean ok;
+
+    g_mutex_lock(&cache_mutex);
+    ok = cache_open();
+    if (ok)
+        cache_check_db();
+    g_mutex_unlock(&cache_mutex);
+    return ok;
+}
+
+static inline guint bucket_of(const struct stat * st)
+{
+    guint64 h = ((guint64) st->st_ino * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)) ^ (guint64) st->st_dev;
+    h *= G_GUINT64_CONSTANT(0x9E3779B97F4A7C15);
+    return (guint) (h >> 32) & (CACHE_N_SLOTS - 1) & ~(guint) (CACHE_WAYS - 1);
+}
+
+static inline gboolean slot_matches(const CacheSlot * slot, const struct stat * st)
+{
+    return slot->type != 0 &&
+           slot->dev == (guint64) st->st_dev &&
+           slot->ino == (guint64) st->st_ino;
+}
+
+void _fm_content_type_cache_finalize(void)
+{
+    g_mutex_lock(&cache_mutex);
+    if (cache_data)
+    {
+        munmap(cache_data, CACHE_SIZE);
+        cache_data = NULL;
+    }
+    if (cache_fd >= 0)
+    {
+        close(cache_fd);
+        cache_fd = -1;
+    }
+    if (type_indexes)
+    {
+        g_hash_table_destroy(type_indexes);
+        type_indexes = NULL;
+    }
+    n_indexed_types = 0;
+    db_checked = 0;
+    cache_tried = FALSE;
+    g_mutex_unlock(&cache_mutex);
+}
+
+/* Returns the content type stored for the file or NULL. */
+gchar * _fm_content_type_cache_lookup(const struct stat * st)
+{
+    guint bucket, i;
+
+    /* not a complete stat() */
+    if (st->st_ino == 0 || !cache_get())
+        return NULL;
+
+    bucket = bucket_of(st);
+    for (i = 0; i < CACHE_WAYS; i++)
+    {
+        CacheSlot * slot = &SLOTS[bucket + i];
+        CacheSlot copy;
+        gint seq, tries = 0;
+
+        do
+        {
+            seq = g_atomic_int_get(&slot->seq);
+            memcpy(&copy, slot, sizeof(copy));
+        }
+        while (((seq & 1) || g_atomic_int_get(&slot->seq) != seq) && ++tries < MAX_READ_TRIES);
+
+        /* a writer which crashed leaves the slot odd */
+        if (tries == MAX_READ_TRIES || !slot_matches(&copy, st))
+            continue;
+        if (copy.size != st->st_size ||
+            copy.mtime_sec != st->st_mtim.tv_sec || copy.mtime_nsec != st->st_mtim.tv_nsec)
+            return NULL; /* the file is changed */
+        if (copy.type > (guint) g_atomic_int_get(&HEADER->n_types))
+            return NULL;
+        return g_strndup(TYPE_NAME(copy.type - 1), CACHE_TYPE_SIZE - 1);
+    }
+    return NULL;
+}
+
+/* returns index + 1 of the type name, adds it if needed; should be called
+ * with both locks held */
+static guint type_index(const char * type)
+{
+    gint n_types = g_atomic_int_get(&HEADER->n_types);
+    gsize len = strlen(type);
+    guint index;
+
+    /* names added since the last time, maybe by other processes */
+    for (; n_indexed_types < n_types; n_indexed_types++)
+    {
+        g_hash_table_insert(type_indexes, g_strndup(TYPE_NAME(n_indexed_types), CACHE_TYPE_SIZE - 1),
+                            GUINT_TO_POINTER(n_indexed_types + 1));
+    }
+    index = GPOINTER_TO_UINT(g_hash_table_lookup(type_indexes, type));
+    if (index || len >= CACHE_TYPE_SIZE || n_types >= CACHE_MAX_TYPES)
+        return index;
+
+    memcpy(TYPE_NAME(n_types), type, len + 1);
+    /* this is a full barrier, the name is written before it's counted */
+    g_atomic_int_inc(&HEADER->n_types);
+    return (guint) n_types + 1;
+}
+
+/* Stores the content type guessed by reading the file. */
+void _fm_content_type_cache_insert(const struct stat * st, const char * type)
+{
+    guint bucket, index, i, victim;
+    CacheSlot * slot = NULL;
+
+    if (st->st_ino == 0 || st->st_mtime >= time(NULL) - RACY_INTERVAL)
+        return;
+
+    g_mutex_lock(&cache_mutex);
+    if (!cache_open())
+    {
+        g_mutex_unlock(&cache_mutex);
+        return;
+    }
+    cache_check_db();
+    flock(cache_fd, LOCK_EX);
+
+    index = type_index(type);
+    if (index)
+    {
+        bucket = bucket_of(st);
+        /* the same file, or a free slot, or any */
+        for (i = 0; i < CACHE_WAYS && !slot; i++)
+            if (slot_matches(&SLOTS[bucket + i], st))
+                slot = &SLOTS[bucket + i];
+        for (i = 0; i < CACHE_WAYS && !slot; i++)
+            if (SLOTS[bucket + i].type == 0)
+                slot = &SLOTS[bucket + i];
+        if (!slot)
+        {
+            victim = ((guint) st->st_ino ^ (guint) st->st_mtime) % CACHE_WAYS;
+            slot = &SLOTS[bucket + victim];
+        }
+
+        g_atomic_int_inc(&slot->seq);
+        slot->type = index;
+        slot->dev = st->st_dev;
+        slot->ino = st->st_ino;
+        slot->size = st->st_size;
+        slot->mtime_sec = st->st_mtim.tv_sec;
+        slot->mtime_nsec = st->st_mtim.tv_nsec;
+        g_atomic_int_inc(&slot->seq);
+    }
+
+    flock(cache_fd, LOCK_UN);
+    g_mutex_unlock(&cache_mutex);
+}
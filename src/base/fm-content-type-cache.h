@@ -0,0 +1,39 @@
+/*
+ *      fm-content-type-cache.h
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef _FM_CONTENT_TYPE_CACHE_H_
+#define _FM_CONTENT_TYPE_CACHE_H_
+
+#include <glib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+G_BEGIN_DECLS
+
+void    _fm_content_type_cache_finalize(void);
+
+/* @st should be a complete stat() of the file */
+gchar * _fm_content_type_cache_lookup(const struct stat * st);
+void    _fm_content_type_cache_insert(const struct stat * st, const char * type);
+
+G_END_DECLS
+
+#endif /*_FM_CONTENT_TYPE_CACHE_H_*/
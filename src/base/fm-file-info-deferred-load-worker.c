@@ -19,12 +19,42 @@
  *      MA 02110-1301, USA.
  */
 
+/*
+Workers resolve MIME types and icons of files in the background.
+
+Files are added by the threads listing folders, so adding must be cheap:
+each queue has a lock-free intake stack which any thread pushes to.
+Workers move the intake to their FIFO queues under worker_mutex. Files
+which the UI needs now, e.g. the visible ones, are added to the urgent
+queue, which is always handled first.
+
+There is a worker per CPU except the one the UI needs, but not more
+than MAX_WORKERS. Rotating disks get slower when read from several
+places at once, so files on them are handled by one worker at a time.
+
+Applications can register other attributes to be computed per file;
+requests for them go through the same queues, with the same priorities,
+and their reads of rotating disks are serialized the same way.
+
+Files of the same device are taken in batches. The contents of those
+whose type can't be guessed by name are read at once by a pool of
+readers, which hides the latency of network mounts. Files of rotating
+disks are read one after another in the order they were listed.
+
+Workers shouldn't take the CPU and the disk the UI waits for, but a
+fixed pause wastes time when nothing else is going on. The main loop
+updates a heartbeat while the workers are busy. If it's late, the main
+loop is starving, and workers pause for as long as it's late.
+*/
+
 #include <glib.h>
 #include <gio/gio.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
+#include <stdio.h>
 
 #include "fm-config.h"
 #include "fm-file-info-deferred-load-worker.h"
@@ -33,131 +63,512 @@
 gboolean fm_file_info_only_one_ref(FmFileInfo* fi);
 gboolean fm_file_info_icon_loaded(FmFileInfo* fi);
 
-static GMutex incomming_list_mutex;
-static GSList * incomming_list = NULL;
-static GSList * working_list = NULL;
+#define MAX_WORKERS 4
+#define TIME_SLICE (G_USEC_PER_SEC / 20)  /* work between checks of the main loop */
+#define HEARTBEAT_INTERVAL 50             /* ms */
+#define MAX_PAUSE (G_USEC_PER_SEC / 5)
+#define BATCH_SIZE 32                     /* files whose MIME types are loaded at once */
 
-G_LOCK_DEFINE_STATIC(worker_control);
-static GThread * worker_thread = NULL;
-static gint worker_stop = 0;
+enum
+{
+    QUEUE_URGENT,
+    QUEUE_NORMAL,
+    N_QUEUES
+};
+
+typedef struct _DeferredItem DeferredItem;
+struct _DeferredItem
+{
+    DeferredItem * next;
+    FmFileInfo * fi;
+    guint32 attributes; /* bit N-1 for attribute N, 0 for MIME type and icon */
+};
+
+/* pushed by any thread without locking, newest first */
+static DeferredItem * volatile intake[N_QUEUES];
+
+/* taken from the intake, oldest first; guarded by worker_mutex */
+static GMutex worker_mutex;
 static GCond worker_wake_up_condition;
+static GQueue working[N_QUEUES] = { G_QUEUE_INIT, G_QUEUE_INIT };
 
-static gpointer worker_thread_func(gpointer data)
+G_LOCK_DEFINE_STATIC(worker_control);
+static GThread * workers[MAX_WORKERS];
+static volatile gint n_workers = 0;
+static gint max_workers = 0;
+static volatile gint n_idle_workers = 0;
+static volatile gint worker_stop = 0;
+
+static guint heartbeat_handler = 0; /* guarded by worker_control */
+static volatile gint heartbeat_active = 0;
+static volatile gint heartbeat_seen = 0; /* there is a main loop running */
+static volatile gint last_heartbeat = 0; /* ms of monotonic time */
+
+/* devices with a rotating disk are read by one worker at a time */
+static GMutex rotational_mutex;
+static GMutex rotational_devices_mutex;
+static GHashTable * rotational_devices = NULL; /* dev_t -> 1 + rotational */
+
+/*****************************************************************************/
+
+static inline gint now_ms(void)
 {
-    const gint64 max_time_slice = G_USEC_PER_SEC * 0.2;
-    gint64 time_slice_begin = g_get_monotonic_time();
+    return (gint) (g_get_monotonic_time() / 1000);
+}
 
-    long n_items_handled_from_cond_wake_up = 0;
-    long n_items_handled_from_timed_wake_up = 0;
+static void intake_push(int queue, FmFileInfo * fi, guint32 attributes)
+{
+    DeferredItem * item = g_slice_new(DeferredItem);
+    item->fi = fm_file_info_ref(fi);
+    item->attributes = attributes;
+    do
+        item->next = g_atomic_pointer_get(&intake[queue]);
+    while (!g_atomic_pointer_compare_and_exchange(&intake[queue], item->next, item));
+}
 
-    gint stop = g_atomic_int_get(&worker_stop);
-    while (!stop)
+static gboolean intake_is_empty(void)
+{
+    int queue;
+    for (queue = 0; queue < N_QUEUES; queue++)
     {
+        if (g_atomic_pointer_get(&intake[queue]))
+            return FALSE;
+    }
+    return TRUE;
+}
 
-        g_mutex_lock(&incomming_list_mutex);
+/* moves the intake to the working queue; called with worker_mutex locked */
+static void intake_take(int queue)
+{
+    DeferredItem * items;
+    DeferredItem * reversed = NULL;
 
-        if (!incomming_list && !working_list)
-        {
-            g_debug("deferred_load_worker: %4ld items handled and incomming list is empty; going to sleep...",
-                n_items_handled_from_cond_wake_up);
+    do
+        items = g_atomic_pointer_get(&intake[queue]);
+    while (items && !g_atomic_pointer_compare_and_exchange(&intake[queue], items, NULL));
 
-            fm_log_memory_usage();
+    /* the stack is newest first */
+    while (items)
+    {
+        DeferredItem * next = items->next;
+        items->next = reversed;
+        reversed = items;
+        items = next;
+    }
+    while (reversed)
+    {
+        DeferredItem * next = reversed->next;
+        g_queue_push_tail(&working[queue], reversed);
+        reversed = next;
+    }
+}
 
-            g_cond_wait(&worker_wake_up_condition, &incomming_list_mutex);
+static void free_item(DeferredItem * item)
+{
+    fm_file_info_unref(item->fi);
+    g_slice_free(DeferredItem, item);
+}
 
-            time_slice_begin = g_get_monotonic_time();
-            n_items_handled_from_cond_wake_up = 0;
-            n_items_handled_from_timed_wake_up = 0;
+/* returns the next file to handle or NULL; called with worker_mutex locked */
+static DeferredItem * next_item(gboolean * urgent)
+{
+    int queue;
+
+    for (queue = 0; queue < N_QUEUES; queue++)
+        intake_take(queue);
+    for (queue = 0; queue < N_QUEUES; queue++)
+    {
+        if (!g_queue_is_empty(&working[queue]))
+        {
+            *urgent = queue == QUEUE_URGENT;
+            return g_queue_pop_head(&working[queue]);
         }
+    }
+    return NULL;
+}
+
+/* takes following files of the same device to load them together;
+ * called with worker_mutex locked */
+static guint next_items_of_device(DeferredItem ** batch, guint n, dev_t dev)
+{
+    GQueue * queue = &working[QUEUE_NORMAL];
 
-        if (incomming_list)
+    while (n < BATCH_SIZE && !g_queue_is_empty(queue) &&
+           fm_file_info_get_dev(((DeferredItem *) g_queue_peek_head(queue))->fi) == dev)
+        batch[n++] = g_queue_pop_head(queue);
+    return n;
+}
+
+/*****************************************************************************/
+
+static gboolean read_rotational(const char * path, gboolean * rotational)
+{
+    FILE * f = fopen(path, "r");
+    int c;
+
+    if (!f)
+        return FALSE;
+    c = fgetc(f);
+    fclose(f);
+    *rotational = c == '1';
+    return c == '0' || c == '1';
+}
+
+static gboolean is_rotational(dev_t dev)
+{
+    gint64 key = dev;
+    gpointer value;
+    gboolean rotational = FALSE;
+
+    /* network and virtual file systems have no block device */
+    if (major(dev) == 0)
+        return FALSE;
+
+    g_mutex_lock(&rotational_devices_mutex);
+    if (!rotational_devices)
+        rotational_devices = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    value = g_hash_table_lookup(rotational_devices, &key);
+    g_mutex_unlock(&rotational_devices_mutex);
+    if (value)
+        return GPOINTER_TO_INT(value) - 1;
+
+    {
+        char path[128];
+        g_snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/rotational", major(dev), minor(dev));
+        /* a partition has no queue, its disk has */
+        if (!read_rotational(path, &rotational))
         {
-            working_list = g_slist_concat(working_list, g_slist_reverse(incomming_list));
-            incomming_list = NULL;
+            g_snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/rotational", major(dev), minor(dev));
+            read_rotational(path, &rotational);
         }
+    }
+
+    g_mutex_lock(&rotational_devices_mutex);
+    g_hash_table_insert(rotational_devices, g_memdup(&key, sizeof(key)), GINT_TO_POINTER(rotational + 1));
+    g_mutex_unlock(&rotational_devices_mutex);
+    return rotational;
+}
 
-        g_mutex_unlock(&incomming_list_mutex);
+/*****************************************************************************/
+
+static gboolean on_heartbeat(gpointer user_data)
+{
+    g_atomic_int_set(&last_heartbeat, now_ms());
+    g_atomic_int_set(&heartbeat_seen, 1);
 
-        while (working_list)
+    G_LOCK(worker_control);
+    /* the workers have nothing to do, don't wake up the main loop */
+    if (g_atomic_int_get(&n_idle_workers) == g_atomic_int_get(&n_workers) && intake_is_empty())
+    {
+        g_mutex_lock(&worker_mutex);
+        if (g_queue_is_empty(&working[QUEUE_URGENT]) && g_queue_is_empty(&working[QUEUE_NORMAL]))
         {
-            stop |= g_atomic_int_get(&worker_stop);
+            heartbeat_handler = 0;
+            g_atomic_int_set(&heartbeat_active, 0);
+        }
+        g_mutex_unlock(&worker_mutex);
+    }
+    G_UNLOCK(worker_control);
+    return g_atomic_int_get(&heartbeat_active);
+}
+
+/* pauses the worker if the main loop doesn't get enough time */
+static void throttle(gint64 * time_slice_begin)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 lag;
+
+    if (now - *time_slice_begin < TIME_SLICE)
+        return;
+    /* without a main loop there is nobody to wait for */
+    if (!g_atomic_int_get(&heartbeat_active) || !g_atomic_int_get(&heartbeat_seen))
+    {
+        *time_slice_begin = now;
+        return;
+    }
+    lag = (gint64) (guint) (now_ms() - g_atomic_int_get(&last_heartbeat)) * 1000;
+    if (lag > HEARTBEAT_INTERVAL * 2 * 1000)
+    {
+        g_debug("deferred_load_worker: main loop is late by %lld µs, pausing", (long long) lag);
+        g_usleep(MIN(lag, MAX_PAUSE));
+    }
+    *time_slice_begin = g_get_monotonic_time();
+}
+
+/* checks if anything is left to do for the item */
+static gboolean item_is_needed(DeferredItem * item)
+{
+    guint attribute;
+
+    /* nobody else uses the file, or the library is finalized */
+    if (fm_file_info_only_one_ref(item->fi) || g_atomic_int_get(&worker_stop))
+        return FALSE;
+    if (!item->attributes)
+        return !fm_file_info_icon_loaded(item->fi);
+    for (attribute = 1; attribute <= FM_FILE_INFO_MAX_ATTRIBUTES; attribute++)
+    {
+        if ((item->attributes & (1U << (attribute - 1))) &&
+            !fm_file_info_attribute_loaded(item->fi, attribute))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void load_attributes(DeferredItem * item, gboolean rotational)
+{
+    guint attribute;
 
-            GSList * list_item = working_list;
-            working_list = working_list->next;
-            FmFileInfo * fi = list_item->data;
-            g_slist_free_1(list_item);
+    for (attribute = 1; attribute <= FM_FILE_INFO_MAX_ATTRIBUTES; attribute++)
+    {
+        /* only those reading the disk are serialized */
+        gboolean lock;
+
+        if (!(item->attributes & (1U << (attribute - 1))))
+            continue;
+        lock = rotational && _fm_file_info_get_attribute_cost(attribute) == FM_FILE_INFO_ATTRIBUTE_COST_IO;
+        if (lock)
+            g_mutex_lock(&rotational_mutex);
+        _fm_file_info_load_attribute(item->fi, attribute);
+        if (lock)
+            g_mutex_unlock(&rotational_mutex);
+    }
+}
 
-            if (fi && !fm_file_info_only_one_ref(fi) && !fm_file_info_icon_loaded(fi) && !stop)
+static gpointer worker_thread_func(gpointer data)
+{
+    gint64 time_slice_begin = g_get_monotonic_time();
+    long n_items_handled = 0;
+
+    while (!g_atomic_int_get(&worker_stop))
+    {
+        DeferredItem * batch[BATCH_SIZE];
+        FmFileInfo * files[BATCH_SIZE];
+        DeferredItem * item;
+        gboolean urgent = FALSE;
+        guint i, n_batch = 0, n_loaded = 0, n_files = 0;
+        dev_t dev;
+
+        g_mutex_lock(&worker_mutex);
+        item = next_item(&urgent);
+        if (!item)
+        {
+            /* A file added after the intake was checked is seen below,
+             * or the thread adding it sees this worker idle and wakes it. */
+            g_atomic_int_inc(&n_idle_workers);
+            if (intake_is_empty() && !g_atomic_int_get(&worker_stop))
             {
-                fm_file_info_get_mime_type(fi);
-                fm_file_info_get_icon(fi);
-                fm_file_info_unref(fi);
+                g_debug("deferred_load_worker: %4ld items handled and incomming list is empty; going to sleep...",
+                    n_items_handled);
+                n_items_handled = 0;
+                fm_log_memory_usage();
+                g_cond_wait_until(&worker_wake_up_condition, &worker_mutex,
+                                  g_get_monotonic_time() + G_USEC_PER_SEC);
+            }
+            g_atomic_int_add(&n_idle_workers, -1);
+            g_mutex_unlock(&worker_mutex);
+            time_slice_begin = g_get_monotonic_time();
+            continue;
+        }
+        dev = fm_file_info_get_dev(item->fi);
+        batch[n_batch++] = item;
+        /* what the user is waiting for isn't delayed by other files */
+        if (!urgent)
+            n_batch = next_items_of_device(batch, n_batch, dev);
+        g_mutex_unlock(&worker_mutex);
+
+        for (i = 0; i < n_batch; i++)
+        {
+            if (item_is_needed(batch[i]))
+            {
+                batch[n_loaded++] = batch[i];
+                if (!batch[i]->attributes)
+                    files[n_files++] = batch[i]->fi;
+            }
+            else
+                free_item(batch[i]);
+        }
 
-                n_items_handled_from_cond_wake_up++;
-                n_items_handled_from_timed_wake_up++;
+        if (n_loaded > 0)
+        {
+            gboolean rotational = is_rotational(dev);
+            guint section = fm_file_info_read_begin();
 
-                long long time_slice = g_get_monotonic_time() - time_slice_begin;
-                if (time_slice > max_time_slice)
+            if (n_files > 0)
+            {
+                if (rotational)
+                    g_mutex_lock(&rotational_mutex);
+                /* contents of files not recognized by name are read together */
+                _fm_file_info_load_mime_types(files, n_files, rotational);
+                for (i = 0; i < n_files; i++)
                 {
-                    g_debug("deferred_load_worker: %4ld items handled in %lld µs",
-                        n_items_handled_from_timed_wake_up,
-                        time_slice);
-                    g_usleep(G_USEC_PER_SEC * 0.2);
-                    time_slice_begin = g_get_monotonic_time();
-                    n_items_handled_from_timed_wake_up = 0;
+                    fm_file_info_get_mime_type(files[i]);
+                    fm_file_info_get_icon(files[i]);
                 }
+                if (rotational)
+                    g_mutex_unlock(&rotational_mutex);
             }
-            else
+            for (i = 0; i < n_loaded; i++)
             {
-                fm_file_info_unref(fi);
+                if (batch[i]->attributes)
+                    load_attributes(batch[i], rotational);
             }
+            fm_file_info_read_end(section);
+            /* values replaced by updates can be released only after the
+             * readers are gone, out of a section is a good time to try */
+            _fm_file_info_reclaim_retired();
+            n_items_handled += n_loaded;
+
+            if (!urgent)
+                throttle(&time_slice_begin);
         }
-
-        stop |= g_atomic_int_get(&worker_stop);
+        for (i = 0; i < n_loaded; i++)
+            free_item(batch[i]);
     }
 
-    //g_print("deferred_load_worker: exit\n");
-
     return NULL;
 }
 
+static void wake_up_worker(void)
+{
+    g_mutex_lock(&worker_mutex);
+    g_cond_signal(&worker_wake_up_condition);
+    g_mutex_unlock(&worker_mutex);
+}
+
+/*****************************************************************************/
+
 void fm_file_info_deferred_load_add(FmFileInfo * fi)
 {
-    //g_print("fm_file_info_deferred_load_add: %s\n", fm_file_info_get_disp_name(fi));
-    g_mutex_lock(&incomming_list_mutex);
-    incomming_list = g_slist_prepend (incomming_list, fm_file_info_ref(fi));
-    g_mutex_unlock(&incomming_list_mutex);
+    intake_push(QUEUE_NORMAL, fi, 0);
 }
 
-void fm_file_info_deferred_load_start(void)
+/**
+ * fm_file_info_deferred_load_raise_priority
+ * @fi: a file info
+ *
+ * Makes the deferred loading of MIME type and icon of @fi, e.g. a file
+ * visible in the view, to be done before that of files added without it.
+ * Nothing is done twice if @fi is already loaded.
+ *
+ * Since: 1.2.0
+ */
+void fm_file_info_deferred_load_raise_priority(FmFileInfo * fi)
 {
-    G_LOCK(worker_control);
+    if (fm_file_info_icon_loaded(fi))
+        return;
+    intake_push(QUEUE_URGENT, fi, 0);
+    fm_file_info_deferred_load_start();
+}
+
+/**
+ * fm_file_info_deferred_load_attribute
+ * @fi: a file info
+ * @attribute: id returned by fm_file_info_register_attribute()
+ * @urgent: %TRUE to compute it before files without priority
+ *
+ * Schedules computing of @attribute of @fi by the workers loading MIME
+ * types and icons, so all per-file work shares the same scheduling:
+ * files of a rotating disk are read by one worker at a time, and the
+ * work is dropped if nobody else holds a reference to @fi by then.
+ * The result is available with fm_file_info_get_attribute().
+ *
+ * Since: 1.2.0
+ */
+void fm_file_info_deferred_load_attribute(FmFileInfo * fi, guint attribute, gboolean urgent)
+{
+    if (attribute == 0 || attribute > FM_FILE_INFO_MAX_ATTRIBUTES ||
+        fm_file_info_attribute_loaded(fi, attribute))
+        return;
+    intake_push(urgent ? QUEUE_URGENT : QUEUE_NORMAL, fi, 1U << (attribute - 1));
+    fm_file_info_deferred_load_start();
+}
 
-    g_atomic_int_set(&worker_stop, 0);
+void fm_file_info_deferred_load_start(void)
+{
+    gboolean wake_up;
 
-    if (!worker_thread)
+    /* called for each file added, so it doesn't lock when all is running */
+    if (G_UNLIKELY(g_atomic_int_get(&n_workers) < max_workers || max_workers == 0 ||
+                   !g_atomic_int_get(&heartbeat_active)))
     {
-        worker_thread = g_thread_try_new("fm-file-info-deferred-load-worker", worker_thread_func, NULL, NULL);
-    }
+        G_LOCK(worker_control);
 
-    g_cond_broadcast(&worker_wake_up_condition);
+        g_atomic_int_set(&worker_stop, 0);
 
-    G_UNLOCK(worker_control);
+        if (max_workers == 0)
+        {
+#if GLIB_CHECK_VERSION(2, 36, 0)
+            gint n_cpus = g_get_num_processors();
+#else
+            gint n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+            /* one CPU is left for the UI */
+            max_workers = CLAMP(n_cpus - 1, 1, MAX_WORKERS);
+        }
+
+        while (g_atomic_int_get(&n_workers) < max_workers)
+        {
+            GThread * thread = g_thread_try_new("fm-file-info-deferred-load-worker",
+                                                worker_thread_func, NULL, NULL);
+            if (!thread)
+                break;
+            workers[g_atomic_int_get(&n_workers)] = thread;
+            g_atomic_int_inc(&n_workers);
+        }
+
+        if (!heartbeat_handler)
+        {
+            g_atomic_int_set(&last_heartbeat, now_ms());
+            g_atomic_int_set(&heartbeat_seen, 0);
+            g_atomic_int_set(&heartbeat_active, 1);
+            heartbeat_handler = g_timeout_add(HEARTBEAT_INTERVAL, on_heartbeat, NULL);
+        }
+
+        G_UNLOCK(worker_control);
+        wake_up = TRUE;
+    }
+    else
+        wake_up = g_atomic_int_get(&n_idle_workers) > 0;
+
+    if (wake_up)
+        wake_up_worker();
 }
 
 void fm_file_info_deferred_load_stop(void)
 {
+    int i, queue;
+
     G_LOCK(worker_control);
     g_atomic_int_set(&worker_stop, 1);
 
+    g_mutex_lock(&worker_mutex);
     g_cond_broadcast(&worker_wake_up_condition);
+    g_mutex_unlock(&worker_mutex);
+
+    for (i = 0; i < g_atomic_int_get(&n_workers); i++)
+    {
+        g_thread_join(workers[i]);
+        workers[i] = NULL;
+    }
+    g_atomic_int_set(&n_workers, 0);
 
-    if (worker_thread)
+    if (heartbeat_handler)
     {
-        g_thread_join(worker_thread);
-        worker_thread = NULL;
+        g_source_remove(heartbeat_handler);
+        heartbeat_handler = 0;
     }
+    g_atomic_int_set(&heartbeat_active, 0);
+
+    /* what is left isn't needed anymore */
+    g_mutex_lock(&worker_mutex);
+    for (queue = 0; queue < N_QUEUES; queue++)
+    {
+        DeferredItem * item;
+        intake_take(queue);
+        while ((item = g_queue_pop_head(&working[queue])))
+            free_item(item);
+    }
+    g_mutex_unlock(&worker_mutex);
 
     G_UNLOCK(worker_control);
 }
-
@@ -27,6 +27,8 @@
 G_BEGIN_DECLS
 
 void fm_file_info_deferred_load_add(FmFileInfo * fi);
+void fm_file_info_deferred_load_raise_priority(FmFileInfo * fi);
+void fm_file_info_deferred_load_attribute(FmFileInfo * fi, guint attribute, gboolean urgent);
 void fm_file_info_deferred_load_start(void);
 void fm_file_info_deferred_load_stop(void);
 
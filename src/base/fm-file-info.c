@@ -29,6 +29,10 @@
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* statx() */
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
@@ -37,11 +41,16 @@
 #include <glib/gi18n-lib.h>
 #include <grp.h> /* Query group name */
 #include <pwd.h> /* Query user name */
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <locale.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef HAVE_STATX
+#include <sys/sysmacros.h>
+#endif
 #include <unistd.h>
 #include <fcntl.h>
 
@@ -51,11 +60,15 @@
 #include "fm-config.h"
 #include "fm-utils.h"
 #include "fm-highlighter.h"
+#include "fm-format-cache.h"
+#include "fm-folder-snapshot.h"
 
 /*****************************************************************************/
 
-static gboolean _fm_file_info_fill_from_native_file(FmFileInfo* fi, const char* path, GError** err);
+static gboolean _fm_file_info_fill_from_native_file(FmFileInfo* fi, int dirfd, const char* name,
+                                                    const char* path, GError** err);
 static void _fm_file_info_fill_from_gfileinfo(FmFileInfo* fi, GFileInfo* inf);
+static void _fm_file_info_init_credentials(void);
 
 /*****************************************************************************/
 
@@ -73,25 +86,41 @@ deferred_icon_load - lock for icon loading
 deferred_mime_type_load - lock for mime type loading
 deferred_fast_update - lock for any other evaluations that are "fast" by nature (i.e. not doing IO)
 
-These locks are global, not per-object. That limits concurency level, but is much easier in implementation.
+These locks are striped: each kind of lock is an array of mutexes and a FmFileInfo uses
+the one selected by hash of its address. So evaluations for different files run in parallel,
+while the struct doesn't grow by a mutex per kind. Two files can share a stripe, so code
+holding a lock should never evaluate fields of another file.
 
 Locking order: icon-> mime_type -> fast
 
 */
 
-G_LOCK_DEFINE_STATIC(deferred_icon_load);
-G_LOCK_DEFINE_STATIC(deferred_mime_type_load);
-G_LOCK_DEFINE_STATIC(deferred_fast_update);
+#define FILE_INFO_LOCK_BITS 6
+#define FILE_INFO_N_LOCKS (1 << FILE_INFO_LOCK_BITS)
+
+static GMutex deferred_icon_load_locks[FILE_INFO_N_LOCKS];
+static GMutex deferred_mime_type_load_locks[FILE_INFO_N_LOCKS];
+static GMutex deferred_fast_update_locks[FILE_INFO_N_LOCKS];
+
+static inline guint _fm_file_info_lock_index(gconstpointer fi)
+{
+    /* low bits of allocated addresses are always the same, use the upper
+     * bits of the multiplicative hash instead */
+    return ((guint)((gsize)fi >> 4) * 0x9E3779B1U) >> (32 - FILE_INFO_LOCK_BITS);
+}
+
+#define FI_LOCK(name, fi) g_mutex_lock(&name##_locks[_fm_file_info_lock_index(fi)])
+#define FI_UNLOCK(name, fi) g_mutex_unlock(&name##_locks[_fm_file_info_lock_index(fi)])
 
 #define FAST_UPDATE(check, code)\
 if (G_UNLIKELY(check))\
 {\
-    G_LOCK(deferred_fast_update);\
+    FI_LOCK(deferred_fast_update, fi);\
     if (G_LIKELY(check))\
     {\
         code\
     }\
-    G_UNLOCK(deferred_fast_update);\
+    FI_UNLOCK(deferred_fast_update, fi);\
 }
 
 /*****************************************************************************/
@@ -105,112 +134,474 @@ Implementation of FmFolder uses that API to update its items when underlying fil
 The problem is that any pointer returned by fm_file_info_get_*() can become invalid at any moment,
 if fm_file_info_update() is called in another thread.
 
-The easiest way to address this is to place all the pointers into bucket and do not free them until FmFileInfo remains alive.
-So as far as a caller folds a reference to FmFileInfo, it can be sure any pointer returned from fm_file_info_get_*() is valid.
+Earlier all the values ever set were kept in per-object buckets until FmFileInfo is freed,
+so memory of a file which is updated often grew without limit. Now each field owns its
+current value only, and a replaced value is retired instead of being released at once.
+Retired values are released after a grace period (epoch-based reclamation). Values retired
+in an epoch are released when the epoch after it ends, and an epoch ends once
+ - the main thread has passed a quiescent state since it began: a low priority source of
+   the default main context was dispatched by the outermost main loop, so no handler is
+   in the middle of using values (a nested main loop doesn't count); if no main loop is
+   running at all, the main thread is like any other thread;
+ - every read section entered with fm_file_info_read_begin() in the previous epoch has
+   been left.
+The source of the main loop, the deferred load workers after each batch, and every
+RECLAIM_RETIRE_STEP retired values try to end the epoch, so values are released also
+when no main loop runs.
+So as far as a caller holds a reference to FmFileInfo, it can be sure any pointer returned
+from fm_file_info_get_*() is valid until it returns to the main loop, or, in other threads
+and without a main loop, until it calls fm_file_info_read_end(). Memory per object stays
+constant: what is retired waits for two epochs at most.
 
 */
 
-/*****************************************************************************/
+typedef struct _FmFileInfoRetired FmFileInfoRetired;
+struct _FmFileInfoRetired
+{
+    FmFileInfoRetired * next;
+    gpointer value;
+    void (*unref)(gpointer);
+};
 
-struct _FmFileInfo
+#define RECLAIM_INTERVAL 200 /* ms */
+#define RECLAIM_RETIRE_STEP 256 /* retired values between attempts out of the main loop */
+
+static gint reclaim_epoch = 0;
+static gint reclaim_readers[2] = {0, 0}; /* read sections by parity of the epoch */
+static GMutex reclaim_mutex;
+static FmFileInfoRetired * retired_current = NULL; /* retired in this epoch */
+static FmFileInfoRetired * retired_pending = NULL; /* retired in the previous one */
+static guint n_retired_since_attempt = 0;
+static gint main_quiescent_epoch = -1; /* the last epoch the main thread was quiescent in */
+static guint reclaim_handler = 0;
+
+/**
+ * fm_file_info_read_begin:
+ *
+ * Starts a section where pointers returned by fm_file_info_get_*() stay
+ * valid even if the #FmFileInfo is updated concurrently. It's not needed
+ * in the main thread while a main loop runs, it's for threads which use
+ * values of a #FmFileInfo which can be updated by #FmFolder. Sections
+ * can be nested.
+ *
+ * Returns: a value to pass to fm_file_info_read_end().
+ */
+guint fm_file_info_read_begin(void)
 {
-    FmPath * volatile path; /* path of the file */
+    guint index = g_atomic_int_get(&reclaim_epoch) & 1;
+    /* this is a full barrier so values are loaded after the increment */
+    g_atomic_int_inc(&reclaim_readers[index]);
+    return index;
+}
 
-    volatile mode_t mode;
-    volatile gboolean native_directory; /* set when it is a native directory or a symlink to a directory */
-    volatile gboolean native_regular_file; /* set when it is a native regular file or a symlink to a native regular file */
+/**
+ * fm_file_info_read_end:
+ * @section: the value returned by fm_file_info_read_begin()
+ *
+ * Ends the section started with fm_file_info_read_begin().
+ */
+void fm_file_info_read_end(guint section)
+{
+    g_atomic_int_add(&reclaim_readers[section & 1], -1);
+}
 
-    const char * volatile fs_id;
-    volatile dev_t dev;
+static void _fm_file_info_free_retired(FmFileInfoRetired * retired)
+{
+    FmFileInfoRetired * next;
+    for (; retired; retired = next)
+    {
+        next = retired->next;
+        retired->unref(retired->value);
+        g_slice_free(FmFileInfoRetired, retired);
+    }
+}
 
-    volatile uid_t uid;
-    volatile gid_t gid;
-    volatile goffset size;
-    time_t mtime;
-    time_t atime;
+/* TRUE if no main loop dispatches sources of the default context now, so
+ * the main thread is not in a handler. The thread which owns the context
+ * can acquire it again, so it's checked first. */
+static gboolean _fm_file_info_main_loop_is_idle(void)
+{
+    GMainContext * context = g_main_context_default();
 
-    volatile gulong blksize;
-    volatile goffset blocks;
+    if (g_main_context_is_owner(context) || !g_main_context_acquire(context))
+        return FALSE;
+    g_main_context_release(context);
+    return TRUE;
+}
+
+/* Ends the epoch if it can be ended; should be called with reclaim_mutex
+ * locked. Returns values to free out of the lock. */
+static FmFileInfoRetired * _fm_file_info_try_advance_epoch(gboolean main_quiescent)
+{
+    FmFileInfoRetired * to_free;
+
+    if (main_quiescent)
+        main_quiescent_epoch = reclaim_epoch;
+    if (!retired_pending && !retired_current)
+        return NULL;
+    if (main_quiescent_epoch != reclaim_epoch && !_fm_file_info_main_loop_is_idle())
+        return NULL;
+    /* readers which came in this epoch could only load values which were
+     * current at that time, readers of the previous one may have more */
+    if (g_atomic_int_get(&reclaim_readers[(reclaim_epoch & 1) ^ 1]) != 0)
+        return NULL;
+    to_free = retired_pending;
+    retired_pending = retired_current;
+    retired_current = NULL;
+    g_atomic_int_inc(&reclaim_epoch);
+    n_retired_since_attempt = 0;
+    return to_free;
+}
+
+/* runs in the default main context */
+static gboolean _fm_file_info_reclaim(gpointer unused)
+{
+    FmFileInfoRetired * to_free;
+    gboolean again;
+
+    g_mutex_lock(&reclaim_mutex);
+    /* a nested main loop may run inside of a handler which uses values */
+    to_free = _fm_file_info_try_advance_epoch(g_main_depth() == 1);
+    again = (retired_pending != NULL || retired_current != NULL);
+    if (!again)
+        reclaim_handler = 0;
+    g_mutex_unlock(&reclaim_mutex);
+
+    _fm_file_info_free_retired(to_free);
+    return again;
+}
+
+/* To use from fm-file-info-deferred-load-worker.c: a worker calls it
+ * between batches, out of any read section. */
+void _fm_file_info_reclaim_retired(void)
+{
+    FmFileInfoRetired * to_free;
+
+    g_mutex_lock(&reclaim_mutex);
+    to_free = _fm_file_info_try_advance_epoch(FALSE);
+    g_mutex_unlock(&reclaim_mutex);
+    _fm_file_info_free_retired(to_free);
+}
+
+static void _fm_file_info_retire(gpointer value, void (*unref)(gpointer))
+{
+    FmFileInfoRetired * retired = g_slice_new(FmFileInfoRetired);
+    FmFileInfoRetired * to_free = NULL;
+    retired->value = value;
+    retired->unref = unref;
+
+    g_mutex_lock(&reclaim_mutex);
+    retired->next = retired_current;
+    retired_current = retired;
+    if (++n_retired_since_attempt >= RECLAIM_RETIRE_STEP)
+    {
+        to_free = _fm_file_info_try_advance_epoch(FALSE);
+        n_retired_since_attempt = 0;
+    }
+    if (!reclaim_handler)
+        reclaim_handler = g_timeout_add_full(G_PRIORITY_LOW, RECLAIM_INTERVAL,
+                                             _fm_file_info_reclaim, NULL, NULL);
+    g_mutex_unlock(&reclaim_mutex);
 
+    _fm_file_info_free_retired(to_free);
+}
+
+/*****************************************************************************/
+
+/* boolean properties of FmFileInfo packed into FmFileInfo::flags */
+enum
+{
+    FI_FLAG_NATIVE_DIRECTORY    = 1 << 0, /* set when it is a native directory or a symlink to a directory */
+    FI_FLAG_NATIVE_REGULAR_FILE = 1 << 1, /* set when it is a native regular file or a symlink to a native regular file */
+    FI_FLAG_ACCESSIBLE          = 1 << 2, /* TRUE if can be read by user */
+    FI_FLAG_HIDDEN              = 1 << 3, /* TRUE if file is hidden */
+    FI_FLAG_BACKUP              = 1 << 4, /* TRUE if file is backup */
+    FI_FLAG_COLOR_LOADED        = 1 << 5,
+    FI_FLAG_FROM_NATIVE_FILE    = 1 << 6,
+    FI_FLAG_MIME_TYPE_LOAD_DONE = 1 << 7,
+    FI_FLAG_FILLED              = 1 << 8,
+    FI_FLAG_HAS_ATTRIBUTES      = 1 << 9, /* has values of registered attributes */
+    FI_FLAG_COLLATE_KEY_STALE   = 1 << 10, /* collate_key_casefold was built from another name */
+    FI_FLAG_COLLATE_KEY_NOCASEFOLD_STALE = 1 << 11 /* the same for collate_key_nocasefold */
+};
+
+/* flags which fm_file_info_update() copies from the source */
+#define FI_FLAGS_UPDATED (FI_FLAG_FILLED | FI_FLAG_NATIVE_DIRECTORY | FI_FLAG_NATIVE_REGULAR_FILE | \
+                          FI_FLAG_FROM_NATIVE_FILE | FI_FLAG_MIME_TYPE_LOAD_DONE)
+
+/* Fields are grouped by how often they are used. Objects are allocated from
+ * a pool in slots aligned to FILE_INFO_ALIGN bytes, so the first group, used
+ * to sort and filter by name, always lies in one cache line, and everything
+ * used to sort by other columns is in the first 64 bytes. */
+struct _FmFileInfo
+{
+    /* sorting by name, filtering */
+    FmSymbol * volatile collate_key_casefold; /* used to sort files by name */
     FmSymbol * volatile disp_name;  /* displayed name (in UTF-8) */
+    volatile goffset size;
+    volatile mode_t mode;
+    volatile guint flags;
 
+    /* sorting by other columns */
+    FmPath * volatile path; /* path of the file */
+    time_t mtime;
+    FmMimeType * volatile mime_type;
     /* FIXME: caching the collate key can greatly speed up sorting.
      *        However, memory usage is greatly increased!.
      *        Is there a better alternative solution?
      */
-    FmSymbol * volatile collate_key_casefold; /* used to sort files by name */
     FmSymbol * volatile collate_key_nocasefold; /* the same but case-sensitive */
+
+    /*<private>*/
+    volatile int n_ref;
+
+    /* displaying */
+    volatile guint32 color; /* 0xRRGGBB, see fm_file_info_set_color() */
+    FmIcon * volatile icon;
     FmSymbol * volatile disp_size;  /* displayed human-readable file size */
     FmSymbol * volatile disp_mtime; /* displayed last modification time */
-    FmMimeType * volatile mime_type;
-    FmIcon * volatile icon;
-
     FmSymbol * volatile target; /* target of shortcut or mountable. */
+    FmSymbol * volatile native_path;
 
-    volatile unsigned long color;
+    /* the rest of stat() data */
+    const char * volatile fs_id;
+    volatile dev_t dev;
+    time_t atime;
+    volatile goffset blocks;
+    volatile uid_t uid;
+    volatile gid_t gid;
 
-    volatile gboolean accessible; /* TRUE if can be read by user */
-    volatile gboolean hidden; /* TRUE if file is hidden */
-    volatile gboolean backup; /* TRUE if file is backup */
+    /* serials of the formatting disp_size and disp_mtime were made with */
+    volatile guint disp_size_serial;
+    volatile guint disp_mtime_serial;
+};
 
-    volatile gboolean color_loaded;
-    volatile gboolean from_native_file;
-    volatile gboolean mime_type_load_done;
+#define GET_FLAG(flag) \
+    ((g_atomic_int_get(&fi->flags) & (flag)) != 0)
 
-    FmSymbol * volatile native_path;
+#define SET_FLAG(flag, value) \
+    _fm_file_info_set_flag(fi, flag, value)
 
-    volatile int filled;
+static inline void _fm_file_info_set_flag(FmFileInfo * fi, guint flag, gboolean value)
+{
+    if (value)
+        g_atomic_int_or(&fi->flags, flag);
+    else
+        g_atomic_int_and(&fi->flags, ~flag);
+}
 
-    /*<private>*/
-    volatile int n_ref;
+/*****************************************************************************/
 
-    FmList * volatile path_bucket;
-    FmList * volatile mime_type_bucket;
-    FmList * volatile icon_bucket;
-    FmList * volatile symbol_bucket;
+/* Pool of FmFileInfo objects. Slots are cut from pages aligned to their
+ * size, so the page of a slot is found from its address. Each page keeps
+ * its freed slots in a list linked through their first word, and pages
+ * with free slots are linked together. A page whose slots are all free is
+ * given back to the system, except FILE_INFO_POOL_KEEP_EMPTY of them, so
+ * a folder opened again doesn't allocate everything anew. Allocation of
+ * a file info is rare compared to its use, so a mutex is good enough. */
+
+#define FILE_INFO_ALIGN 32
+#define FILE_INFO_SLOT_SIZE ((sizeof(FmFileInfo) + FILE_INFO_ALIGN - 1) & ~(gsize)(FILE_INFO_ALIGN - 1))
+#define FILE_INFO_POOL_PAGE_SIZE (64 * 1024)
+#define FILE_INFO_POOL_KEEP_EMPTY 2
+
+typedef struct _FileInfoPoolPage FileInfoPoolPage;
+struct _FileInfoPoolPage
+{
+    FileInfoPoolPage * prev; /* in the list of pages with free slots */
+    FileInfoPoolPage * next;
+    gpointer free_slots;
+    char * uncut; /* slots from here to the end were never used */
+    guint n_used;
 };
 
+#define FILE_INFO_POOL_FIRST_SLOT \
+    ((sizeof(FileInfoPoolPage) + FILE_INFO_ALIGN - 1) & ~(gsize)(FILE_INFO_ALIGN - 1))
+
+static GMutex file_info_pool_mutex;
+static FileInfoPoolPage * file_info_pool_partial = NULL;
+static int file_info_pool_pages = 0;
+static int file_info_pool_empty_pages = 0;
+
+static inline gboolean _fm_file_info_pool_page_is_full(FileInfoPoolPage * page)
+{
+    return !page->free_slots &&
+           page->uncut + FILE_INFO_SLOT_SIZE > (char *) page + FILE_INFO_POOL_PAGE_SIZE;
+}
+
+static void _fm_file_info_pool_link(FileInfoPoolPage * page)
+{
+    page->prev = NULL;
+    page->next = file_info_pool_partial;
+    if (page->next)
+        page->next->prev = page;
+    file_info_pool_partial = page;
+}
+
+static void _fm_file_info_pool_unlink(FileInfoPoolPage * page)
+{
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        file_info_pool_partial = page->next;
+    if (page->next)
+        page->next->prev = page->prev;
+    page->prev = page->next = NULL;
+}
+
+static FmFileInfo * _fm_file_info_pool_alloc(void)
+{
+    FileInfoPoolPage * page;
+    gpointer slot;
+
+    g_mutex_lock(&file_info_pool_mutex);
+    page = file_info_pool_partial;
+    if (!page)
+    {
+        gpointer mem;
+        if (posix_memalign(&mem, FILE_INFO_POOL_PAGE_SIZE, FILE_INFO_POOL_PAGE_SIZE) != 0)
+            g_error("%s: failed to allocate %d bytes", G_STRLOC, FILE_INFO_POOL_PAGE_SIZE);
+        page = mem;
+        page->free_slots = NULL;
+        page->uncut = (char *) page + FILE_INFO_POOL_FIRST_SLOT;
+        page->n_used = 0;
+        _fm_file_info_pool_link(page);
+        ++file_info_pool_pages;
+        ++file_info_pool_empty_pages;
+    }
+    if (page->free_slots)
+    {
+        slot = page->free_slots;
+        page->free_slots = *(gpointer *) slot;
+    }
+    else
+    {
+        slot = page->uncut;
+        page->uncut += FILE_INFO_SLOT_SIZE;
+    }
+    if (page->n_used++ == 0)
+        --file_info_pool_empty_pages;
+    if (_fm_file_info_pool_page_is_full(page))
+        _fm_file_info_pool_unlink(page);
+    g_mutex_unlock(&file_info_pool_mutex);
+
+    memset(slot, 0, sizeof(FmFileInfo));
+    return slot;
+}
+
+static void _fm_file_info_pool_free(FmFileInfo * fi)
+{
+    FileInfoPoolPage * page = (FileInfoPoolPage *) ((gsize) fi & ~(gsize) (FILE_INFO_POOL_PAGE_SIZE - 1));
+
+    g_mutex_lock(&file_info_pool_mutex);
+    if (_fm_file_info_pool_page_is_full(page))
+        _fm_file_info_pool_link(page);
+    *(gpointer *) fi = page->free_slots;
+    page->free_slots = fi;
+    if (--page->n_used == 0)
+    {
+        if (file_info_pool_empty_pages < FILE_INFO_POOL_KEEP_EMPTY)
+            ++file_info_pool_empty_pages;
+        else
+        {
+            _fm_file_info_pool_unlink(page);
+            free(page);
+            --file_info_pool_pages;
+        }
+    }
+    g_mutex_unlock(&file_info_pool_mutex);
+}
+
 /*****************************************************************************/
 
-static FmListFuncs fm_list_funcs_for_path =
+typedef struct
+{
+    gpointer (*ref)(gpointer);
+    void (*unref)(gpointer);
+    gboolean (*equal)(gpointer, gpointer);
+} FmFileInfoValueFuncs;
+
+static FmFileInfoValueFuncs value_funcs_for_path =
 {
-    .item_ref   = (gpointer (*)(gpointer)) &fm_path_ref,
-    .item_unref = (void (*)(gpointer)) &fm_path_unref
+    .ref   = (gpointer (*)(gpointer)) &fm_path_ref,
+    .unref = (void (*)(gpointer)) &fm_path_unref
 };
 
-static FmListFuncs fm_list_funcs_for_mime_type =
+static FmFileInfoValueFuncs value_funcs_for_mime_type =
 {
-    .item_ref   = (gpointer (*)(gpointer)) &fm_mime_type_ref,
-    .item_unref = (void (*)(gpointer)) &fm_mime_type_unref
+    .ref   = (gpointer (*)(gpointer)) &fm_mime_type_ref,
+    .unref = (void (*)(gpointer)) &fm_mime_type_unref
 };
 
-static FmListFuncs fm_list_funcs_for_icon =
+static FmFileInfoValueFuncs value_funcs_for_icon =
 {
-    .item_ref   = (gpointer (*)(gpointer)) &fm_icon_ref,
-    .item_unref = (void (*)(gpointer)) &fm_icon_unref
+    .ref   = (gpointer (*)(gpointer)) &fm_icon_ref,
+    .unref = (void (*)(gpointer)) &fm_icon_unref
 };
 
-static FmListFuncs fm_list_funcs_for_symbol =
+/* collate keys can be COLLATE_USING_DISPLAY_NAME which is not a symbol */
+
+static gpointer _symbol_ref(gpointer s)
+{
+    return (s == COLLATE_USING_DISPLAY_NAME) ? s : fm_symbol_ref(s);
+}
+
+static void _symbol_unref(gpointer s)
 {
-    .item_ref   = (gpointer (*)(gpointer)) &fm_symbol_ref,
-    .item_unref = (void (*)(gpointer)) &fm_symbol_unref,
-    .item_compare = (GCompareFunc) &fm_symbol_compare_fast,
+    if (s != COLLATE_USING_DISPLAY_NAME)
+        fm_symbol_unref(s);
+}
+
+static gboolean _symbol_equal(gpointer s1, gpointer s2)
+{
+    if (s1 == COLLATE_USING_DISPLAY_NAME || s2 == COLLATE_USING_DISPLAY_NAME)
+        return s1 == s2;
+    return fm_symbol_is_equal(s1, s2);
+}
+
+static FmFileInfoValueFuncs value_funcs_for_symbol =
+{
+    .ref   = &_symbol_ref,
+    .unref = &_symbol_unref,
+    .equal = &_symbol_equal
 };
 
-#define DEFINE_PUSH_VALUE(Type, type) \
-static inline Fm##Type * _push_value_##type(FmFileInfo * fi, Fm##Type * value)\
-{\
-    return (Fm##Type *) fm_list_push_head_uniq(fi->type##_bucket, value);\
+/* Replaces value of the field and retires the old one. If the new value is
+ * equal to the current one the field is left as is, so pointers given out
+ * before don't change needlessly. */
+static void _fm_file_info_set_value(gpointer volatile * field, gpointer value,
+                                    FmFileInfoValueFuncs * funcs)
+{
+    gpointer old;
+
+    if (value)
+        funcs->ref(value);
+    do
+    {
+        old = g_atomic_pointer_get(field);
+        if (old == value || (old && value && funcs->equal && funcs->equal(old, value)))
+        {
+            if (value)
+                funcs->unref(value);
+            return;
+        }
+    }
+    while (!g_atomic_pointer_compare_and_exchange(field, old, value));
+
+    if (old)
+        _fm_file_info_retire(old, funcs->unref);
 }
 
-DEFINE_PUSH_VALUE(Path, path)
-DEFINE_PUSH_VALUE(MimeType, mime_type)
-DEFINE_PUSH_VALUE(Icon, icon)
-DEFINE_PUSH_VALUE(Symbol, symbol)
+/* the file info is being freed, nobody can use its values any more */
+static inline void _fm_file_info_release_value(gpointer value, FmFileInfoValueFuncs * funcs)
+{
+    if (value)
+        funcs->unref(value);
+}
 
 #define SET_FIELD(field, type, value)\
 do { \
-    g_atomic_pointer_set(&fi->field, _push_value_##type(fi, value));\
+    _fm_file_info_set_value((gpointer volatile *) &fi->field, value, &value_funcs_for_##type);\
 } while (0)
 
 #define SET_SYMBOL(field, value)\
@@ -220,6 +611,9 @@ do { \
     fm_symbol_unref(s);\
 } while (0)
 
+#define RELEASE_FIELD(field, type)\
+    _fm_file_info_release_value(fi->field, &value_funcs_for_##type)
+
 
 #define DEFINE_GET_VALUE(Type, type) \
 static inline Fm##Type * _get_value_##type(Fm##Type * volatile * ref)\
@@ -245,20 +639,43 @@ int file_info_total;
 void fm_log_memory_usage_for_file_info(void)
 {
     int total = g_atomic_int_get(&file_info_total);
-    g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "memory usage: FmFileInfo: %d bytes * %d items = %lld KiB",
-        sizeof(FmFileInfo), total, sizeof(FmFileInfo) * (long long) total / 1024);
+    int pages = g_atomic_int_get(&file_info_pool_pages);
+    g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "memory usage: FmFileInfo: %d bytes (%d bytes slot) * %d items = %lld KiB, pool %d KiB",
+        (int) sizeof(FmFileInfo), (int) FILE_INFO_SLOT_SIZE, total, FILE_INFO_SLOT_SIZE * (long long) total / 1024,
+        pages * (FILE_INFO_POOL_PAGE_SIZE / 1024));
 }
 
 /*****************************************************************************/
 
 /* intialize the file info system */
+static void _fm_file_info_clear_attributes(FmFileInfo * fi, gboolean retire);
+static void _fm_file_info_finalize_attributes(void);
+
 void _fm_file_info_init(void)
 {
     icon_locked_folder = fm_icon_from_name("folder-locked");
+    _fm_file_info_init_credentials();
+    _fm_format_cache_init();
 }
 
 void _fm_file_info_finalize()
 {
+    g_mutex_lock(&reclaim_mutex);
+    if (reclaim_handler)
+    {
+        g_source_remove(reclaim_handler);
+        reclaim_handler = 0;
+    }
+    _fm_file_info_free_retired(retired_pending);
+    _fm_file_info_free_retired(retired_current);
+    retired_pending = retired_current = NULL;
+    g_mutex_unlock(&reclaim_mutex);
+
+    _fm_format_cache_finalize();
+    _fm_file_info_finalize_attributes();
+    g_free(access_groups);
+    access_groups = NULL;
+    n_access_groups = 0;
     fm_icon_unref(icon_locked_folder);
 }
 
@@ -273,12 +690,8 @@ void _fm_file_info_finalize()
 FmFileInfo* fm_file_info_new ()
 {
     g_atomic_int_inc(&file_info_total);
-    FmFileInfo * fi = g_slice_new0(FmFileInfo);
+    FmFileInfo * fi = _fm_file_info_pool_alloc();
     fi->n_ref = 1;
-    fi->path_bucket = fm_list_new(&fm_list_funcs_for_path);
-    fi->mime_type_bucket = fm_list_new(&fm_list_funcs_for_mime_type);
-    fi->icon_bucket = fm_list_new(&fm_list_funcs_for_icon);
-    fi->symbol_bucket = fm_list_new(&fm_list_funcs_for_symbol);
     return fi;
 }
 
@@ -357,10 +770,30 @@ gboolean fm_file_info_fill_from_native_file(FmFileInfo* fi, const char* path_str
     }
     else
     {
-        return _fm_file_info_fill_from_native_file(fi, path_str, err);
+        return _fm_file_info_fill_from_native_file(fi, AT_FDCWD, path_str, path_str, err);
     }
 }
 
+/*
+ * _fm_file_info_fill_from_native_file_at:
+ * @fi:  A FmFileInfo struct which is not filled yet
+ * @dirfd: file descriptor of the directory containing the file
+ * @name: name of the file in the directory
+ * @path: full path of the file
+ * @err: a GError** to retrive errors
+ *
+ * The same as fm_file_info_fill_from_native_file(), but the file is
+ * looked up relative to @dirfd, so the kernel doesn't walk the whole
+ * path for each system call. Used by folder listing jobs.
+ *
+ * Returns: TRUE if no error happens.
+ */
+gboolean _fm_file_info_fill_from_native_file_at(FmFileInfo* fi, int dirfd, const char* name,
+                                                const char* path, GError** err)
+{
+    return _fm_file_info_fill_from_native_file(fi, dirfd, name, path, err);
+}
+
 static void _fill_from_desktop_entry(FmFileInfo * fi, const char * path)
 {
     GKeyFile * kf = g_key_file_new();
@@ -411,18 +844,172 @@ end:
     g_key_file_free(kf);
 }
 
-static gboolean _fm_file_info_fill_from_native_file(FmFileInfo* fi, const char* path, GError** err)
+/* Credentials access() checks the permissions against. They are
+ * queried once, a file manager doesn't change its user or groups. */
+static uid_t access_uid;
+static gid_t access_gid;
+static gid_t * access_groups = NULL;
+static int n_access_groups = 0;
+
+static void _fm_file_info_init_credentials(void)
+{
+    int n;
+
+    access_uid = getuid();
+    access_gid = getgid();
+    n = getgroups(0, NULL);
+    if (n > 0)
+    {
+        access_groups = g_new(gid_t, n);
+        n = getgroups(n, access_groups);
+    }
+    n_access_groups = MAX(n, 0);
+}
+
+static gboolean _fm_file_info_in_access_groups(gid_t gid)
+{
+    int i;
+
+    if (gid == access_gid)
+        return TRUE;
+    for (i = 0; i < n_access_groups; i++)
+    {
+        if (access_groups[i] == gid)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* The same as access(R_OK), but from the permission bits we already have.
+ * ACLs may grant more than the bits say, so a denial is confirmed by
+ * the system. Files we can't read are rare, so it is not a lot of calls. */
+static gboolean _fm_file_info_is_readable(int dirfd, const char * name, const struct stat * st)
+{
+    mode_t bit;
+
+    if (access_uid == 0)
+        return TRUE;
+    if (st->st_uid == access_uid)
+        bit = S_IRUSR;
+    else if (_fm_file_info_in_access_groups(st->st_gid))
+        bit = S_IRGRP;
+    else
+        bit = S_IROTH;
+    if (st->st_mode & bit)
+        return TRUE;
+    return faccessat(dirfd, name, R_OK, 0) == 0;
+}
+
+#ifdef HAVE_STATX
+/* only what FmFileInfo keeps and the content type cache needs to know
+ * the file, other fields may need a round trip on NFS */
+#define FI_STATX_MASK (STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | \
+                       STATX_SIZE | STATX_MTIME | STATX_ATIME | STATX_INO)
+static volatile gint statx_unsupported = 0;
+#endif
+
+/* lstat() or stat() of @name relative to @dirfd, filling only the fields
+ * FmFileInfo uses */
+static int _fm_file_info_stat_at(int dirfd, const char * name, struct stat * st, gboolean follow)
+{
+#ifdef HAVE_STATX
+    if (!g_atomic_int_get(&statx_unsupported))
+    {
+        struct statx stx;
+        int flags = AT_NO_AUTOMOUNT | (follow ? 0 : AT_SYMLINK_NOFOLLOW);
+        if (statx(dirfd, name, flags, FI_STATX_MASK, &stx) == 0)
+        {
+            memset(st, 0, sizeof(*st));
+            st->st_mode = stx.stx_mode;
+            st->st_uid = stx.stx_uid;
+            st->st_gid = stx.stx_gid;
+            st->st_size = stx.stx_size;
+            st->st_ino = stx.stx_ino;
+            st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+            st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+            st->st_atime = stx.stx_atime.tv_sec;
+            st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+            return 0;
+        }
+        if (errno != ENOSYS)
+            return -1;
+        /* built with a newer libc than the kernel supports */
+        g_atomic_int_set(&statx_unsupported, 1);
+    }
+#endif
+    return fstatat(dirfd, name, st, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+}
+
+/* @size_hint is st_size of the link, the length of its target */
+static char * _fm_file_info_read_link_at(int dirfd, const char * name, goffset size_hint)
+{
+    gsize size = size_hint > 0 ? (gsize)size_hint + 1 : 256;
+
+    for (;;)
+    {
+        char * buf = g_malloc(size);
+        ssize_t len = readlinkat(dirfd, name, buf, size);
+        if (len < 0)
+        {
+            g_free(buf);
+            return NULL;
+        }
+        if ((gsize)len < size)
+        {
+            buf[len] = '\0';
+            return buf;
+        }
+        /* the link was changed meanwhile */
+        g_free(buf);
+        size *= 2;
+    }
+}
+
+/* the part of filling a native file that depends on its name */
+static void _fm_file_info_fill_names(FmFileInfo * fi, const char * path, gboolean is_dir)
+{
+    /* special handling for desktop entry files */
+    if(G_UNLIKELY(fm_file_info_is_desktop_entry(fi)))
+        _fill_from_desktop_entry(fi, path);
+
+    /* By default we use the real file base name for display.
+     * if the base name is not in UTF-8 encoding, we
+     * need to convert it to UTF-8 for display and save its
+     * UTF-8 version in fi->disp_name */
+    if (!fi->disp_name)
+    {
+        char * dname = g_filename_display_basename(path);
+        if (g_strcmp0(dname, fm_path_get_basename(fi->path)) != 0)
+        {
+            SET_SYMBOL(disp_name, dname);
+        }
+        g_free(dname);
+    }
+
+    /* files with . prefix or ~ suffix are regarded as hidden files.
+     * dirs with . prefix are regarded as hidden dirs. */
+    {
+        const char * basename = (char*)fm_path_get_basename(fi->path);
+        SET_FLAG(FI_FLAG_HIDDEN, basename[0] == '.');
+        SET_FLAG(FI_FLAG_BACKUP, !is_dir && g_str_has_suffix(basename, "~"));
+    }
+}
+
+/* @name is the file relative to @dirfd, or the same as @path with AT_FDCWD */
+static gboolean _fm_file_info_fill_from_native_file(FmFileInfo* fi, int dirfd, const char* name,
+                                                    const char* path, GError** err)
 {
     struct stat st;
+    gboolean exists = TRUE;
 
-    if (lstat(path, &st) != 0)
+    if (_fm_file_info_stat_at(dirfd, name, &st, FALSE) != 0)
     {
         g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno),
                     "%s: %s", path, g_strerror(errno));
         return FALSE;
     }
 
-    fi->from_native_file = TRUE;
+    SET_FLAG(FI_FLAG_FROM_NATIVE_FILE, TRUE);
     SET_SYMBOL(native_path, path);
 
     fi->disp_name = NULL;
@@ -434,24 +1021,26 @@ static gboolean _fm_file_info_fill_from_native_file(FmFileInfo* fi, const char*
     fi->uid = st.st_uid;
     fi->gid = st.st_gid;
 
-    fi->native_directory = S_ISDIR(st.st_mode);
-    fi->native_regular_file = S_ISREG(st.st_mode);
+    SET_FLAG(FI_FLAG_NATIVE_DIRECTORY, S_ISDIR(st.st_mode));
+    SET_FLAG(FI_FLAG_NATIVE_REGULAR_FILE, S_ISREG(st.st_mode));
 
     if (S_ISLNK(st.st_mode))
     {
         struct stat _st;
-        if (stat(path, &_st) == 0)
+        char * target = _fm_file_info_read_link_at(dirfd, name, st.st_size);
+        if (_fm_file_info_stat_at(dirfd, name, &_st, TRUE) == 0)
         {
             st = _st;
-            fi->native_directory = S_ISDIR(st.st_mode);
-            fi->native_regular_file = S_ISREG(st.st_mode);
+            SET_FLAG(FI_FLAG_NATIVE_DIRECTORY, S_ISDIR(st.st_mode));
+            SET_FLAG(FI_FLAG_NATIVE_REGULAR_FILE, S_ISREG(st.st_mode));
         }
-        char * target = g_file_read_link(path, NULL);
+        else /* a broken link can't be read */
+            exists = FALSE;
         SET_SYMBOL(target, target);
         g_free(target);
     }
 
-    fi->accessible = (g_access(path, R_OK) == 0);
+    SET_FLAG(FI_FLAG_ACCESSIBLE, exists && _fm_file_info_is_readable(dirfd, name, &st));
 
     if (!fm_config->deferred_mime_type_loading)
     {
@@ -465,33 +1054,105 @@ static gboolean _fm_file_info_fill_from_native_file(FmFileInfo* fi, const char*
         fm_file_info_deferred_load_start();
     }
 
-    /* special handling for desktop entry files */
-    if(G_UNLIKELY(fm_file_info_is_desktop_entry(fi)))
-        _fill_from_desktop_entry(fi, path);
+    _fm_file_info_fill_names(fi, path, S_ISDIR(st.st_mode));
 
-    /* By default we use the real file base name for display.
-     * if the base name is not in UTF-8 encoding, we
-     * need to convert it to UTF-8 for display and save its
-     * UTF-8 version in fi->disp_name */
-    if (!fi->disp_name)
+    return TRUE;
+}
+
+/* Snapshots of folders, see fm-folder-snapshot.c. */
+
+void _fm_file_info_get_snapshot_entry(FmFileInfo * fi, FmFolderSnapshotEntry * entry)
+{
+    FmMimeType * mime_type = GET_FIELD(mime_type, mime_type);
+
+    entry->name = fm_path_get_basename(fi->path);
+    entry->disp_name = fi->disp_name ? GET_CSTR(disp_name) : NULL;
+    entry->target = GET_CSTR(target);
+    entry->mime_type = mime_type ? fm_mime_type_get_type(mime_type) : NULL;
+    entry->mode = fi->mode;
+    entry->uid = fi->uid;
+    entry->gid = fi->gid;
+    entry->flags = 0;
+    if (GET_FLAG(FI_FLAG_NATIVE_DIRECTORY))
+        entry->flags |= FM_FOLDER_SNAPSHOT_DIRECTORY;
+    if (GET_FLAG(FI_FLAG_NATIVE_REGULAR_FILE))
+        entry->flags |= FM_FOLDER_SNAPSHOT_REGULAR;
+    if (GET_FLAG(FI_FLAG_ACCESSIBLE))
+        entry->flags |= FM_FOLDER_SNAPSHOT_ACCESSIBLE;
+    entry->size = fi->size;
+    entry->mtime = fi->mtime;
+    entry->atime = fi->atime;
+    entry->dev = fi->dev;
+}
+
+/* The same as _fm_file_info_fill_from_native_file() with the data the
+ * snapshot has, the file is not touched unless it's a desktop entry. */
+void _fm_file_info_fill_from_snapshot_entry(FmFileInfo * fi, const char * path,
+                                            const FmFolderSnapshotEntry * entry)
+{
+    SET_FLAG(FI_FLAG_FROM_NATIVE_FILE, TRUE);
+    SET_SYMBOL(native_path, path);
+
+    fi->disp_name = NULL;
+    fi->mode = entry->mode;
+    fi->mtime = entry->mtime;
+    fi->atime = entry->atime;
+    fi->size = entry->size;
+    fi->dev = entry->dev;
+    fi->uid = entry->uid;
+    fi->gid = entry->gid;
+
+    SET_FLAG(FI_FLAG_NATIVE_DIRECTORY, (entry->flags & FM_FOLDER_SNAPSHOT_DIRECTORY) != 0);
+    SET_FLAG(FI_FLAG_NATIVE_REGULAR_FILE, (entry->flags & FM_FOLDER_SNAPSHOT_REGULAR) != 0);
+    SET_FLAG(FI_FLAG_ACCESSIBLE, (entry->flags & FM_FOLDER_SNAPSHOT_ACCESSIBLE) != 0);
+    if (entry->target)
+        SET_SYMBOL(target, entry->target);
+
+    if (entry->mime_type)
     {
-        char * dname = g_filename_display_basename(path);
-        if (g_strcmp0(dname, fm_path_get_basename(fi->path)) != 0)
-        {
-            SET_SYMBOL(disp_name, dname);
-        }
-        g_free(dname);
+        FmMimeType * mime_type = fm_mime_type_from_name(entry->mime_type);
+        SET_FIELD(mime_type, mime_type, mime_type);
+        fm_mime_type_unref(mime_type);
+        SET_FLAG(FI_FLAG_MIME_TYPE_LOAD_DONE, TRUE);
     }
-
-    /* files with . prefix or ~ suffix are regarded as hidden files.
-     * dirs with . prefix are regarded as hidden dirs. */
+    else if (!fm_config->deferred_mime_type_loading)
     {
-        const char * basename = (char*)fm_path_get_basename(fi->path);
-        fi->hidden = (basename[0] == '.');
-        fi->backup = (!S_ISDIR(st.st_mode) && g_str_has_suffix(basename, "~"));
+        FmMimeType * mime_type = fm_mime_type_from_native_file(path, fm_file_info_get_disp_name(fi), NULL);
+        SET_FIELD(mime_type, mime_type, mime_type);
+        fm_mime_type_unref(mime_type);
+    }
+    else
+    {
+        fm_file_info_deferred_load_add(fi);
+        fm_file_info_deferred_load_start();
     }
 
-    return TRUE;
+    /* a title of a desktop entry is read again, its icon is not stored */
+    if (entry->disp_name && !fm_file_info_is_desktop_entry(fi))
+        SET_SYMBOL(disp_name, entry->disp_name);
+
+    _fm_file_info_fill_names(fi, path, (entry->flags & FM_FOLDER_SNAPSHOT_DIRECTORY) != 0);
+}
+
+/* Returns TRUE if @fi and @other have the same data from stat(), that is,
+ * if @other was made from the file @fi was made from and it wasn't changed. */
+gboolean _fm_file_info_native_stat_equal(FmFileInfo * fi, FmFileInfo * other)
+{
+    const guint native_flags = FI_FLAG_NATIVE_DIRECTORY | FI_FLAG_NATIVE_REGULAR_FILE |
+                               FI_FLAG_ACCESSIBLE | FI_FLAG_FROM_NATIVE_FILE;
+    gboolean equal;
+    guint section;
+
+    if (fi->mode != other->mode || fi->size != other->size || fi->mtime != other->mtime ||
+        fi->uid != other->uid || fi->gid != other->gid || fi->dev != other->dev ||
+        (g_atomic_int_get(&fi->flags) & native_flags) != (g_atomic_int_get(&other->flags) & native_flags))
+        return FALSE;
+
+    section = fm_file_info_read_begin();
+    equal = g_strcmp0(GET_CSTR(target), fm_symbol_get_cstr(_get_value_symbol(&other->target))) == 0 &&
+            g_strcmp0(fm_file_info_get_disp_name(fi), fm_file_info_get_disp_name(other)) == 0;
+    fm_file_info_read_end(section);
+    return equal;
 }
 
 /**
@@ -543,7 +1204,7 @@ static void _fm_file_info_fill_from_gfileinfo(FmFileInfo* fi, GFileInfo* inf)
     fm_return_if_fail(fi);
     fm_return_if_fail(fi->path);
 
-    fi->from_native_file = FALSE;
+    SET_FLAG(FI_FLAG_FROM_NATIVE_FILE, FALSE);
 
     /* if display name is the same as its name, just use it. */
     tmp = g_file_info_get_display_name(inf);
@@ -605,10 +1266,10 @@ static void _fm_file_info_fill_from_gfileinfo(FmFileInfo* fi, GFileInfo* inf)
     }
 
     if(g_file_info_has_attribute(inf, G_FILE_ATTRIBUTE_ACCESS_CAN_READ))
-        fi->accessible = g_file_info_get_attribute_boolean(inf, G_FILE_ATTRIBUTE_ACCESS_CAN_READ);
+        SET_FLAG(FI_FLAG_ACCESSIBLE, g_file_info_get_attribute_boolean(inf, G_FILE_ATTRIBUTE_ACCESS_CAN_READ));
     else
         /* assume it's accessible */
-        fi->accessible = TRUE;
+        SET_FLAG(FI_FLAG_ACCESSIBLE, TRUE);
 
     switch(type)
     {
@@ -667,7 +1328,7 @@ static void _fm_file_info_fill_from_gfileinfo(FmFileInfo* fi, GFileInfo* inf)
          * the object returned by g_file_info_get_icon is
          * owned by GFileInfo. */
     /* set "locked" icon on unaccesible folder */
-    else if(!fi->accessible && type == G_FILE_TYPE_DIRECTORY)
+    else if(!GET_FLAG(FI_FLAG_ACCESSIBLE) && type == G_FILE_TYPE_DIRECTORY)
         icon = fm_icon_ref(icon_locked_folder);
     else
         icon = fm_icon_ref(fm_mime_type_get_icon(mime_type));
@@ -684,8 +1345,8 @@ static void _fm_file_info_fill_from_gfileinfo(FmFileInfo* fi, GFileInfo* inf)
 
     fi->mtime = g_file_info_get_attribute_uint64(inf, G_FILE_ATTRIBUTE_TIME_MODIFIED);
     fi->atime = g_file_info_get_attribute_uint64(inf, G_FILE_ATTRIBUTE_TIME_ACCESS);
-    fi->hidden = g_file_info_get_is_hidden(inf);
-    fi->backup = g_file_info_get_is_backup(inf);
+    SET_FLAG(FI_FLAG_HIDDEN, g_file_info_get_is_hidden(inf));
+    SET_FLAG(FI_FLAG_BACKUP, g_file_info_get_is_backup(inf));
 
     SET_FIELD(mime_type, mime_type, mime_type);
     fm_mime_type_unref(mime_type);
@@ -701,7 +1362,7 @@ static void _fm_file_info_fill_from_gfileinfo(FmFileInfo* fi, GFileInfo* inf)
 
 gboolean fm_file_info_is_filled(FmFileInfo * fi)
 {
-    return fi && fi->filled;
+    return fi && (g_atomic_int_get(&fi->flags) & FI_FLAG_FILLED);
 }
 
 /*****************************************************************************/
@@ -805,11 +1466,18 @@ void fm_file_info_unref(FmFileInfo* fi)
     if (g_atomic_int_dec_and_test(&fi->n_ref))
     {
         //fm_file_info_clear(fi);
-        fm_list_unref(fi->path_bucket);
-        fm_list_unref(fi->mime_type_bucket);
-        fm_list_unref(fi->icon_bucket);
-        fm_list_unref(fi->symbol_bucket);
-        g_slice_free(FmFileInfo, fi);
+        RELEASE_FIELD(path, path);
+        RELEASE_FIELD(mime_type, mime_type);
+        RELEASE_FIELD(icon, icon);
+        RELEASE_FIELD(disp_name, symbol);
+        RELEASE_FIELD(collate_key_casefold, symbol);
+        RELEASE_FIELD(collate_key_nocasefold, symbol);
+        RELEASE_FIELD(disp_size, symbol);
+        RELEASE_FIELD(disp_mtime, symbol);
+        RELEASE_FIELD(target, symbol);
+        RELEASE_FIELD(native_path, symbol);
+        _fm_file_info_clear_attributes(fi, FALSE);
+        _fm_file_info_pool_free(fi);
         g_atomic_int_add(&file_info_total, -1);
     }
 }
@@ -835,16 +1503,20 @@ void fm_file_info_update(FmFileInfo* fi, FmFileInfo* src)
     if (fi == src)
         return;
 
-    G_LOCK(deferred_icon_load);
-    G_LOCK(deferred_mime_type_load);
-    G_LOCK(deferred_fast_update);
+    FI_LOCK(deferred_icon_load, fi);
+    FI_LOCK(deferred_mime_type_load, fi);
+    FI_LOCK(deferred_fast_update, fi);
+
+    /* the display name falls back to the name of the path, so it's
+     * compared as a string to find if the collate keys are still valid */
+    guint section = fm_file_info_read_begin();
+    const char * old_disp_name = fm_file_info_get_disp_name(fi);
+    gboolean name_changed;
 
     SET_FIELD(path, path, src->path);
     SET_FIELD(mime_type, mime_type, src->mime_type);
     SET_FIELD(icon, icon, src->icon);
 
-    fi->filled = src->filled;
-
     fi->mode = src->mode;
     fi->dev = src->dev;
     fi->fs_id = src->fs_id;
@@ -855,42 +1527,79 @@ void fm_file_info_update(FmFileInfo* fi, FmFileInfo* src)
     fi->mtime = src->mtime;
     fi->atime = src->atime;
 
-    fi->blksize = src->blksize;
     fi->blocks = src->blocks;
 
     SET_FIELD(disp_name, symbol, src->disp_name);
-
-    if (src->collate_key_casefold  == COLLATE_USING_DISPLAY_NAME)
-        fi->collate_key_casefold = COLLATE_USING_DISPLAY_NAME;
-    else
+    name_changed = (strcmp(fm_file_info_get_disp_name(fi), old_disp_name) != 0);
+    fm_file_info_read_end(section);
+
+    /* Values derived from other fields are not computed in @src usually.
+     * Replacing them with NULL would retire a value on every update only
+     * to build the same one again, so they are marked to be rebuilt on
+     * demand instead, and kept if they are still the same. */
+    if (src->collate_key_casefold)
+    {
         SET_FIELD(collate_key_casefold, symbol, src->collate_key_casefold);
-
-    if (src->collate_key_nocasefold == COLLATE_USING_DISPLAY_NAME)
-        fi->collate_key_nocasefold = COLLATE_USING_DISPLAY_NAME;
-    else
+        SET_FLAG(FI_FLAG_COLLATE_KEY_STALE, FALSE);
+    }
+    else if (name_changed)
+        SET_FLAG(FI_FLAG_COLLATE_KEY_STALE, TRUE);
+    if (src->collate_key_nocasefold)
+    {
         SET_FIELD(collate_key_nocasefold, symbol, src->collate_key_nocasefold);
+        SET_FLAG(FI_FLAG_COLLATE_KEY_NOCASEFOLD_STALE, FALSE);
+    }
+    else if (name_changed)
+        SET_FLAG(FI_FLAG_COLLATE_KEY_NOCASEFOLD_STALE, TRUE);
 
-    SET_FIELD(disp_size, symbol, src->disp_size);
-    SET_FIELD(disp_mtime, symbol, src->disp_mtime);
+    /* the getters rebuild them if the serial doesn't match, a serial is never 0 */
+    if (src->disp_size || !S_ISREG(src->mode))
+    {
+        SET_FIELD(disp_size, symbol, src->disp_size);
+        fi->disp_size_serial = src->disp_size_serial;
+    }
+    else
+        fi->disp_size_serial = 0;
+    if (src->disp_mtime || src->mtime <= 0)
+    {
+        SET_FIELD(disp_mtime, symbol, src->disp_mtime);
+        fi->disp_mtime_serial = src->disp_mtime_serial;
+    }
+    else
+        fi->disp_mtime_serial = 0;
 
-    fi->native_directory = src->native_directory;
-    fi->native_regular_file = src->native_regular_file;
-    fi->from_native_file = src->from_native_file;
-    fi->mime_type_load_done = src->mime_type_load_done;
+    guint flags, src_flags = g_atomic_int_get(&src->flags);
+    do
+        flags = g_atomic_int_get(&fi->flags);
+    while (!g_atomic_int_compare_and_exchange(&fi->flags, flags,
+                                              (flags & ~FI_FLAGS_UPDATED) | (src_flags & FI_FLAGS_UPDATED)));
 
     SET_FIELD(native_path, symbol, src->native_path);
 
-    G_UNLOCK(deferred_fast_update);
-    G_UNLOCK(deferred_mime_type_load);
-    G_UNLOCK(deferred_icon_load);
+    FI_UNLOCK(deferred_fast_update, fi);
+    FI_UNLOCK(deferred_mime_type_load, fi);
+    FI_UNLOCK(deferred_icon_load, fi);
+
+    /* they were computed from the old state of the file */
+    _fm_file_info_clear_attributes(fi, TRUE);
 }
 
 /*****************************************************************************/
 
-void fm_file_info_set_color(FmFileInfo* fi, unsigned long color)
+/**
+ * fm_file_info_set_color:
+ * @fi:  A FmFileInfo struct
+ * @color: the color in 0xRRGGBB form
+ *
+ * Sets the color the file is highlighted with.
+ *
+ * Since 1.2.0 the color is #guint32, it was unsigned long before.
+ * Only 32 bits were ever used, so callers need no change.
+ */
+void fm_file_info_set_color(FmFileInfo* fi, guint32 color)
 {
     fi->color = color;
-    fi->color_loaded = TRUE;
+    SET_FLAG(FI_FLAG_COLOR_LOADED, TRUE);
 }
 
 /*****************************************************************************/
@@ -902,11 +1611,11 @@ static void deferred_icon_load(FmFileInfo* fi)
     if (G_LIKELY(fi->icon))
         return;
 
-    G_LOCK(deferred_icon_load);
+    FI_LOCK(deferred_icon_load, fi);
 
-    if (fi->icon || !fi->from_native_file)
+    if (fi->icon || !GET_FLAG(FI_FLAG_FROM_NATIVE_FILE))
     {
-        G_UNLOCK(deferred_icon_load);
+        FI_UNLOCK(deferred_icon_load, fi);
         return;
     }
 
@@ -914,9 +1623,9 @@ static void deferred_icon_load(FmFileInfo* fi)
 
     FmIcon * icon = NULL;
 
-    if (fi->native_directory)
+    if (GET_FLAG(FI_FLAG_NATIVE_DIRECTORY))
     {
-        if (!fi->accessible)
+        if (!GET_FLAG(FI_FLAG_ACCESSIBLE))
             icon = fm_icon_ref(icon_locked_folder);
         else if (g_strcmp0(path, fm_get_home_dir()) == 0)
             icon = fm_icon_from_name("user-home");
@@ -946,7 +1655,7 @@ static void deferred_icon_load(FmFileInfo* fi)
     SET_FIELD(icon, icon, icon);
     fm_icon_unref(icon);
 
-    G_UNLOCK(deferred_icon_load);
+    FI_UNLOCK(deferred_icon_load, fi);
 }
 
 static void deferred_mime_type_load(FmFileInfo* fi)
@@ -954,11 +1663,11 @@ static void deferred_mime_type_load(FmFileInfo* fi)
     if (G_LIKELY(fi->mime_type))
         return;
 
-    G_LOCK(deferred_mime_type_load);
+    FI_LOCK(deferred_mime_type_load, fi);
 
-    if (fi->mime_type || fi->mime_type_load_done || !fi->from_native_file)
+    if (fi->mime_type || GET_FLAG(FI_FLAG_MIME_TYPE_LOAD_DONE) || !GET_FLAG(FI_FLAG_FROM_NATIVE_FILE))
     {
-        G_UNLOCK(deferred_mime_type_load);
+        FI_UNLOCK(deferred_mime_type_load, fi);
         return;
     }
 
@@ -970,9 +1679,55 @@ static void deferred_mime_type_load(FmFileInfo* fi)
     SET_FIELD(mime_type, mime_type, mime_type);
     fm_mime_type_unref(mime_type);
 
-    fi->mime_type_load_done = TRUE;
+    SET_FLAG(FI_FLAG_MIME_TYPE_LOAD_DONE, TRUE);
+
+    FI_UNLOCK(deferred_mime_type_load, fi);
+}
+
+/* Loads MIME types of @n_files files at once, reading together the files
+ * whose type can't be guessed by name. Symlinks and files of other kinds
+ * are left to deferred_mime_type_load(). Should be called in a read section. */
+void _fm_file_info_load_mime_types(FmFileInfo ** files, guint n_files, gboolean sequential)
+{
+    FmMimeTypeNativeFile * native_files = g_new(FmMimeTypeNativeFile, n_files);
+    struct stat * stats = g_new0(struct stat, n_files);
+    FmFileInfo ** loaded = g_new(FmFileInfo *, n_files);
+    guint i, n = 0;
+
+    for (i = 0; i < n_files; i++)
+    {
+        FmFileInfo * fi = files[i];
+        if (fi->mime_type || GET_FLAG(FI_FLAG_MIME_TYPE_LOAD_DONE) ||
+            !GET_FLAG(FI_FLAG_FROM_NATIVE_FILE) || !S_ISREG(fi->mode))
+            continue;
+        stats[n].st_mode = fi->mode;
+        stats[n].st_size = fi->size;
+        native_files[n].file_path = GET_CSTR(native_path);
+        native_files[n].base_name = fm_file_info_get_disp_name(fi);
+        native_files[n].pstat = &stats[n];
+        native_files[n].mime_type = NULL;
+        loaded[n++] = fi;
+    }
+
+    if (n > 0)
+        _fm_mime_type_from_native_files(native_files, n, sequential);
+
+    for (i = 0; i < n; i++)
+    {
+        FmFileInfo * fi = loaded[i];
+        FI_LOCK(deferred_mime_type_load, fi);
+        if (!fi->mime_type && !GET_FLAG(FI_FLAG_MIME_TYPE_LOAD_DONE))
+        {
+            SET_FIELD(mime_type, mime_type, native_files[i].mime_type);
+            SET_FLAG(FI_FLAG_MIME_TYPE_LOAD_DONE, TRUE);
+        }
+        FI_UNLOCK(deferred_mime_type_load, fi);
+        fm_mime_type_unref(native_files[i].mime_type);
+    }
 
-    G_UNLOCK(deferred_mime_type_load);
+    g_free(loaded);
+    g_free(stats);
+    g_free(native_files);
 }
 
 /*****************************************************************************/
@@ -1088,11 +1843,13 @@ const char * fm_file_info_get_disp_size(FmFileInfo* fi)
 
     if (S_ISREG(fi->mode))
     {
-        FAST_UPDATE(!fi->disp_size,
+        guint serial = _fm_format_cache_get_serial();
+        FAST_UPDATE(!fi->disp_size || fi->disp_size_serial != serial,
         {
-            char buf[128];
-            fm_file_size_to_str(buf, sizeof(buf), fi->size, fm_config->si_unit);
-            SET_SYMBOL(disp_size, buf);
+            FmSymbol * s = _fm_format_cache_get_size(fi->size, fm_config->si_unit);
+            SET_FIELD(disp_size, symbol, s);
+            fm_symbol_unref(s);
+            fi->disp_size_serial = serial;
         })
     }
     return GET_CSTR(disp_size);
@@ -1173,9 +1930,9 @@ gboolean fm_file_info_is_directory(FmFileInfo* fi)
 {
     fm_return_val_if_fail(fi, FALSE);
 
-    if (fi->from_native_file)
+    if (GET_FLAG(FI_FLAG_FROM_NATIVE_FILE))
     {
-        return fi->native_directory;
+        return GET_FLAG(FI_FLAG_NATIVE_DIRECTORY);
     }
 
     if (S_ISDIR(fi->mode))
@@ -1244,10 +2001,7 @@ gboolean fm_file_info_is_image(FmFileInfo* fi)
     if (!(fm_file_info_get_mode(fi) & S_IFREG))
         return FALSE;
 
-    /* FIXME: We had better use functions of xdg_mime to check this */
-    if (!strncmp("image/", fm_mime_type_get_type(fm_file_info_get_mime_type(fi)), 6))
-        return TRUE;
-    return FALSE;
+    return (fm_mime_type_get_classes(fm_file_info_get_mime_type(fi)) & FM_MIME_TYPE_CLASS_IMAGE) != 0;
 }
 
 /**
@@ -1260,9 +2014,7 @@ gboolean fm_file_info_is_text(FmFileInfo* fi)
 {
     fm_return_val_if_fail(fi, FALSE);
 
-    if(g_content_type_is_a(fm_mime_type_get_type(fm_file_info_get_mime_type(fi)), "text/plain"))
-        return TRUE;
-    return FALSE;
+    return (fm_mime_type_get_classes(fm_file_info_get_mime_type(fi)) & FM_MIME_TYPE_CLASS_TEXT) != 0;
 }
 
 /**
@@ -1275,16 +2027,16 @@ gboolean fm_file_info_is_desktop_entry(FmFileInfo* fi)
 {
     fm_return_val_if_fail(fi, FALSE);
 
-    if (fi->from_native_file)
+    if (GET_FLAG(FI_FLAG_FROM_NATIVE_FILE))
     {
-        if (!fi->native_regular_file)
+        if (!GET_FLAG(FI_FLAG_NATIVE_REGULAR_FILE))
             return FALSE;
         const char * target = GET_CSTR(target);
         const char * path = target ? target : GET_CSTR(native_path);
         if (!g_str_has_suffix(path, ".desktop"))
             return FALSE;
     }
-    return fm_file_info_get_mime_type(fi) == _fm_mime_type_get_application_x_desktop();
+    return (fm_mime_type_get_classes(fm_file_info_get_mime_type(fi)) & FM_MIME_TYPE_CLASS_DESKTOP_ENTRY) != 0;
 }
 
 /**
@@ -1298,7 +2050,7 @@ gboolean fm_file_info_is_unknown_type(FmFileInfo* fi)
 {
     fm_return_val_if_fail(fi, FALSE);
 
-    return g_content_type_is_unknown(fm_mime_type_get_type(fm_file_info_get_mime_type(fi)));
+    return (fm_mime_type_get_classes(fm_file_info_get_mime_type(fi)) & FM_MIME_TYPE_CLASS_UNKNOWN) != 0;
 }
 
 /**
@@ -1319,9 +2071,12 @@ gboolean fm_file_info_is_unknown_type(FmFileInfo* fi)
 /* full path of the file is required by this function */
 gboolean fm_file_info_is_executable_type(FmFileInfo* fi)
 {
+    FmMimeTypeClasses classes;
+
     fm_return_val_if_fail(fi, FALSE);
 
-    if(strncmp(fm_mime_type_get_type(fm_file_info_get_mime_type(fi)), "text/", 5) == 0)
+    classes = fm_mime_type_get_classes(fm_file_info_get_mime_type(fi));
+    if(classes & FM_MIME_TYPE_CLASS_SCRIPT)
     { /* g_content_type_can_be_executable reports text files as executables too */
         /* We don't execute remote files nor files in trash */
         if(fm_path_is_native(fi->path) && (fi->mode & (S_IXOTH|S_IXGRP|S_IXUSR)))
@@ -1340,7 +2095,7 @@ gboolean fm_file_info_is_executable_type(FmFileInfo* fi)
         }
         return FALSE;
     }
-    return g_content_type_can_be_executable(fm_mime_type_get_type(fm_file_info_get_mime_type(fi)));
+    return (classes & FM_MIME_TYPE_CLASS_EXECUTABLE) != 0;
 }
 
 /**
@@ -1357,7 +2112,7 @@ gboolean fm_file_info_is_accessible(FmFileInfo* fi)
 {
     fm_return_val_if_fail(fi, FALSE);
 
-    return fi->accessible;
+    return GET_FLAG(FI_FLAG_ACCESSIBLE);
 }
 
 /**
@@ -1373,9 +2128,9 @@ gboolean fm_file_info_is_hidden(FmFileInfo* fi)
 {
     fm_return_val_if_fail(fi, FALSE);
 
-    return (fi->hidden ||
+    return (GET_FLAG(FI_FLAG_HIDDEN) ||
             /* bug #3416724: backup and hidden files should be distinguishable */
-            (fm_config->backup_as_hidden && fi->backup));
+            (fm_config->backup_as_hidden && GET_FLAG(FI_FLAG_BACKUP)));
 }
 
 /**
@@ -1405,6 +2160,163 @@ gboolean fm_file_info_can_thumbnail(FmFileInfo* fi)
 }
 
 
+/* Collate keys of pure ASCII names.
+ *
+ * For ASCII g_utf8_casefold() only lowers the case and the normalization
+ * done by g_utf8_collate_key() changes nothing, so the same key as one of
+ * g_utf8_collate_key_for_filename() can be built in a buffer on the stack
+ * with the same algorithm, calling strxfrm() for text segments directly.
+ * In "C" locale strxfrm() copies the string so it's not called at all.
+ * The fast path is taken only with UTF-8 locale charset: otherwise GLib
+ * converts the text and marks the keys with a prefix. The application may
+ * call setlocale() at any time, so both are checked for every key. */
+
+#define ASCII_COLLATE_KEY_MAX 1024
+#define COLLATION_SENTINEL "\1\1\1"
+
+static inline gboolean _collate_locale_is_c(void)
+{
+    const char * locale = setlocale(LC_COLLATE, NULL);
+    return !locale || strcmp(locale, "C") == 0 || strcmp(locale, "POSIX") == 0;
+}
+
+#define KEY_APPEND(data, n)\
+do { \
+    if (key_len + (n) >= ASCII_COLLATE_KEY_MAX)\
+        return -1;\
+    memcpy(key + key_len, data, n);\
+    key_len += (n);\
+} while (0)
+
+/* the same as g_utf8_collate_key() does for an ASCII segment */
+static int _ascii_segment_key(char * key, int key_len, const char * str, int len,
+                              gboolean locale_is_c)
+{
+    char segment[ASCII_COLLATE_KEY_MAX];
+    size_t n;
+
+    if (locale_is_c)
+    {
+        KEY_APPEND(str, len);
+        return key_len;
+    }
+    memcpy(segment, str, len);
+    segment[len] = '\0';
+    n = strxfrm(key + key_len, segment, ASCII_COLLATE_KEY_MAX - key_len);
+    if (key_len + n >= ASCII_COLLATE_KEY_MAX)
+        return -1;
+    return key_len + n;
+}
+
+/* Builds the key of g_utf8_collate_key_for_filename() for @name into @key.
+ * Returns length of the key or -1 if @name is not ASCII or too long. */
+static int _fm_file_info_ascii_collate_key(const char * name, gboolean casefold,
+                                           char key[ASCII_COLLATE_KEY_MAX])
+{
+    char str[ASCII_COLLATE_KEY_MAX];
+    char append[ASCII_COLLATE_KEY_MAX];
+    int key_len = 0, append_len = 0, len;
+    const char * p, * prev, * end;
+    int digits, leading_zeros;
+    gboolean locale_is_c;
+
+    /* g_get_charset() checks if the locale was changed itself */
+    if (!g_get_charset(NULL))
+        return -1;
+    locale_is_c = _collate_locale_is_c();
+    for (len = 0; name[len]; ++len)
+    {
+        if ((guchar) name[len] >= 0x80 || len + 1 >= ASCII_COLLATE_KEY_MAX)
+            return -1;
+        str[len] = casefold ? g_ascii_tolower(name[len]) : name[len];
+    }
+
+    end = str + len;
+    for (prev = p = str; p < end; p++)
+    {
+        if (*p == '.')
+        {
+            if (prev != p && (key_len = _ascii_segment_key(key, key_len, prev, p - prev, locale_is_c)) < 0)
+                return -1;
+            KEY_APPEND(COLLATION_SENTINEL "\1", 4);
+            /* skip the dot */
+            prev = p + 1;
+        }
+        else if (g_ascii_isdigit(*p))
+        {
+            if (prev != p && (key_len = _ascii_segment_key(key, key_len, prev, p - prev, locale_is_c)) < 0)
+                return -1;
+            KEY_APPEND(COLLATION_SENTINEL "\2", 4);
+            prev = p;
+
+            /* numbers are prefixed with (number of digits - 1) colons,
+             * leading zeros are moved to the end of the key */
+            if (*p == '0')
+            {
+                leading_zeros = 1;
+                digits = 0;
+            }
+            else
+            {
+                leading_zeros = 0;
+                digits = 1;
+            }
+            while (++p < end)
+            {
+                if (*p == '0' && !digits)
+                    ++leading_zeros;
+                else if (g_ascii_isdigit(*p))
+                    ++digits;
+                else
+                {
+                    /* count an all-zero sequence as one digit plus leading zeros */
+                    if (!digits)
+                    {
+                        ++digits;
+                        --leading_zeros;
+                    }
+                    break;
+                }
+            }
+            for (; digits > 1; --digits)
+                KEY_APPEND(":", 1);
+            if (leading_zeros > 0)
+            {
+                append[append_len++] = (char) leading_zeros;
+                prev += leading_zeros;
+            }
+            /* write the number itself */
+            KEY_APPEND(prev, p - prev);
+            prev = p;
+            --p; /* go one step back to not disturb the outer loop */
+        }
+    }
+    if (prev != p && (key_len = _ascii_segment_key(key, key_len, prev, p - prev, locale_is_c)) < 0)
+        return -1;
+    KEY_APPEND(COLLATION_SENTINEL "\1", 4);
+    KEY_APPEND(append, append_len);
+    key[key_len] = '\0';
+    return key_len;
+}
+
+#undef KEY_APPEND
+
+/* Returns the collate key of @disp_name, either in @buf or newly allocated. */
+static char * _fm_file_info_make_collate_key(const char * disp_name, gboolean casefold,
+                                             char buf[ASCII_COLLATE_KEY_MAX])
+{
+    char * folded, * collate;
+
+    if (_fm_file_info_ascii_collate_key(disp_name, casefold, buf) >= 0)
+        return buf;
+    if (!casefold)
+        return g_utf8_collate_key_for_filename(disp_name, -1);
+    folded = g_utf8_casefold(disp_name, -1);
+    collate = g_utf8_collate_key_for_filename(folded, -1);
+    g_free(folded);
+    return collate;
+}
+
 /**
  * fm_file_info_get_collate_key:
  * @fi:  A FmFileInfo struct
@@ -1421,17 +2333,18 @@ const char * fm_file_info_get_collate_key(FmFileInfo* fi)
     fm_return_val_if_fail(fi, 0);
 
     /* create a collate key on demand, if we don't have one */
-    FAST_UPDATE(!fi->collate_key_casefold,
+    FAST_UPDATE(!fi->collate_key_casefold || GET_FLAG(FI_FLAG_COLLATE_KEY_STALE),
     {
+        char buf[ASCII_COLLATE_KEY_MAX];
         const char * disp_name = fm_file_info_get_disp_name(fi);
-        char * casefold = g_utf8_casefold(disp_name, -1);
-        char * collate = g_utf8_collate_key_for_filename(casefold, -1);
-        g_free(casefold);
+        char * collate = _fm_file_info_make_collate_key(disp_name, TRUE, buf);
         if (strcmp(collate, disp_name))
             SET_SYMBOL(collate_key_casefold, collate);
         else
-            fi->collate_key_casefold = COLLATE_USING_DISPLAY_NAME;
-        g_free(collate);
+            SET_FIELD(collate_key_casefold, symbol, COLLATE_USING_DISPLAY_NAME);
+        SET_FLAG(FI_FLAG_COLLATE_KEY_STALE, FALSE);
+        if (collate != buf)
+            g_free(collate);
     })
 
     /* if the collate key is the same as the display name, 
@@ -1461,15 +2374,18 @@ const char * fm_file_info_get_collate_key_nocasefold(FmFileInfo* fi)
 {
     fm_return_val_if_fail(fi, 0);
 
-    FAST_UPDATE(!fi->collate_key_nocasefold,
+    FAST_UPDATE(!fi->collate_key_nocasefold || GET_FLAG(FI_FLAG_COLLATE_KEY_NOCASEFOLD_STALE),
     {
+        char buf[ASCII_COLLATE_KEY_MAX];
         const char * disp_name = fm_file_info_get_disp_name(fi);
-        char * collate = g_utf8_collate_key_for_filename(disp_name, -1);
+        char * collate = _fm_file_info_make_collate_key(disp_name, FALSE, buf);
         if (strcmp(collate, disp_name))
             SET_SYMBOL(collate_key_nocasefold, collate);
         else
-            fi->collate_key_nocasefold = COLLATE_USING_DISPLAY_NAME;
-        g_free(collate);
+            SET_FIELD(collate_key_nocasefold, symbol, COLLATE_USING_DISPLAY_NAME);
+        SET_FLAG(FI_FLAG_COLLATE_KEY_NOCASEFOLD_STALE, FALSE);
+        if (collate != buf)
+            g_free(collate);
     })
 
     /* if the collate key is the same as the display name, 
@@ -1530,13 +2446,13 @@ const char * fm_file_info_get_disp_mtime(FmFileInfo* fi)
 
     if (fi->mtime > 0)
     {
-        FAST_UPDATE(!fi->disp_mtime,
+        guint serial = _fm_format_cache_get_serial();
+        FAST_UPDATE(!fi->disp_mtime || fi->disp_mtime_serial != serial,
         {
-            char buf[128];
-            strftime(buf, sizeof(buf),
-                      "%x %R",
-                      localtime(&fi->mtime));
-            SET_SYMBOL(disp_mtime, buf);
+            FmSymbol * s = _fm_format_cache_get_mtime(fi->mtime);
+            SET_FIELD(disp_mtime, symbol, s);
+            fm_symbol_unref(s);
+            fi->disp_mtime_serial = serial;
         })
     }
     return GET_CSTR(disp_mtime);
@@ -1631,16 +2547,298 @@ dev_t fm_file_info_get_dev(FmFileInfo* fi)
     return fi->dev;
 }
 
-unsigned long fm_file_info_get_color(FmFileInfo* fi)
+/**
+ * fm_file_info_get_color:
+ * @fi:  A FmFileInfo struct
+ *
+ * Gets the color the file is highlighted with. It's computed on the
+ * first call unless fm_file_info_set_color() was called.
+ *
+ * Since 1.2.0 the color is #guint32, it was unsigned long before.
+ *
+ * Returns: the color in 0xRRGGBB form.
+ */
+guint32 fm_file_info_get_color(FmFileInfo* fi)
 {
     fm_return_val_if_fail(fi, 0);
 
-    FAST_UPDATE(!fi->color_loaded,
-    {
+    /* no lock here: the highlighter may need the mime type, which can't be
+     * loaded with the fast update lock held; computing it twice is harmless */
+    if (G_UNLIKELY(!GET_FLAG(FI_FLAG_COLOR_LOADED)))
         fm_file_info_highlight(fi);
-        fi->color_loaded = TRUE;
-    })
 
     return fi->color;
 }
 
+
+/*****************************************************************************/
+
+/* Attributes computed by providers the application registers.
+ *
+ * Few files have them, so they are not stored in FmFileInfo itself but
+ * in tables striped like the locks, and FI_FLAG_HAS_ATTRIBUTES tells if
+ * a file has any. Each file has a short list of values. Providers can't
+ * be unregistered, so a provider is never removed while it's used. */
+
+typedef struct _FmFileInfoAttributeProvider FmFileInfoAttributeProvider;
+struct _FmFileInfoAttributeProvider
+{
+    char * name;
+    FmFileInfoAttributeCost cost;
+    FmFileInfoAttributeFunc func;
+    gpointer user_data;
+    GDestroyNotify destroy_value;
+};
+
+typedef struct _FmFileInfoAttribute FmFileInfoAttribute;
+struct _FmFileInfoAttribute
+{
+    FmFileInfoAttribute * next;
+    guint id;
+    gpointer value;
+};
+
+static FmFileInfoAttributeProvider attribute_providers[FM_FILE_INFO_MAX_ATTRIBUTES];
+static volatile gint n_attribute_providers = 0;
+G_LOCK_DEFINE_STATIC(attribute_providers);
+
+static GHashTable * attribute_tables[FILE_INFO_N_LOCKS];
+static GMutex attribute_locks[FILE_INFO_N_LOCKS];
+
+static inline FmFileInfoAttributeProvider * _fm_file_info_get_attribute_provider(guint attribute)
+{
+    if (attribute == 0 || attribute > (guint) g_atomic_int_get(&n_attribute_providers))
+        return NULL;
+    return &attribute_providers[attribute - 1];
+}
+
+/* should be called with the attribute lock held */
+static FmFileInfoAttribute * _fm_file_info_find_attribute_value(FmFileInfo * fi, guint attribute)
+{
+    FmFileInfoAttribute * a;
+    GHashTable * table = attribute_tables[_fm_file_info_lock_index(fi)];
+
+    if (!table)
+        return NULL;
+    for (a = g_hash_table_lookup(table, fi); a; a = a->next)
+    {
+        if (a->id == attribute)
+            return a;
+    }
+    return NULL;
+}
+
+/* Removes all attributes of @fi. Values are retired if the file is still
+ * used, or freed at once if it's being freed. */
+static void _fm_file_info_clear_attributes(FmFileInfo * fi, gboolean retire)
+{
+    guint index = _fm_file_info_lock_index(fi);
+    FmFileInfoAttribute * a, * next;
+
+    if (!GET_FLAG(FI_FLAG_HAS_ATTRIBUTES))
+        return;
+
+    g_mutex_lock(&attribute_locks[index]);
+    a = NULL;
+    if (attribute_tables[index])
+    {
+        a = g_hash_table_lookup(attribute_tables[index], fi);
+        g_hash_table_remove(attribute_tables[index], fi);
+    }
+    SET_FLAG(FI_FLAG_HAS_ATTRIBUTES, FALSE);
+    g_mutex_unlock(&attribute_locks[index]);
+
+    for (; a; a = next)
+    {
+        FmFileInfoAttributeProvider * provider = &attribute_providers[a->id - 1];
+        next = a->next;
+        if (a->value && provider->destroy_value)
+        {
+            if (retire)
+                _fm_file_info_retire(a->value, provider->destroy_value);
+            else
+                provider->destroy_value(a->value);
+        }
+        g_slice_free(FmFileInfoAttribute, a);
+    }
+}
+
+/**
+ * fm_file_info_register_attribute:
+ * @name: unique name of the attribute
+ * @cost: what computing the attribute takes
+ * @func: function which computes the attribute
+ * @user_data: data passed to @func
+ * @destroy_value: (allow-none): function to free values
+ *
+ * Registers a per-file attribute, such as image dimensions or the
+ * status of the file in a version control system, for the lifetime of
+ * the library. The attribute is computed in the background by the same
+ * workers that load MIME types and icons, when requested with
+ * fm_file_info_deferred_load_attribute(), and is dropped when the file
+ * is updated.
+ *
+ * If an attribute with @name is registered already, its id is returned.
+ *
+ * Returns: id of the attribute, or 0 if there are too many of them.
+ *
+ * Since: 1.2.0
+ */
+guint fm_file_info_register_attribute(const char * name, FmFileInfoAttributeCost cost,
+                                      FmFileInfoAttributeFunc func, gpointer user_data,
+                                      GDestroyNotify destroy_value)
+{
+    guint attribute;
+
+    fm_return_val_if_fail(name && func, 0);
+
+    G_LOCK(attribute_providers);
+    attribute = fm_file_info_find_attribute(name);
+    if (!attribute && n_attribute_providers < FM_FILE_INFO_MAX_ATTRIBUTES)
+    {
+        FmFileInfoAttributeProvider * provider = &attribute_providers[n_attribute_providers];
+        provider->name = g_strdup(name);
+        provider->cost = cost;
+        provider->func = func;
+        provider->user_data = user_data;
+        provider->destroy_value = destroy_value;
+        /* this is a full barrier, readers see the provider filled */
+        g_atomic_int_inc(&n_attribute_providers);
+        attribute = n_attribute_providers;
+    }
+    G_UNLOCK(attribute_providers);
+    return attribute;
+}
+
+/**
+ * fm_file_info_find_attribute:
+ * @name: name of the attribute
+ *
+ * Returns: id of the attribute registered with @name, or 0 if none is.
+ *
+ * Since: 1.2.0
+ */
+guint fm_file_info_find_attribute(const char * name)
+{
+    guint i, n = g_atomic_int_get(&n_attribute_providers);
+
+    for (i = 0; i < n; i++)
+    {
+        if (strcmp(attribute_providers[i].name, name) == 0)
+            return i + 1;
+    }
+    return 0;
+}
+
+/**
+ * fm_file_info_get_attribute:
+ * @fi:  A FmFileInfo struct
+ * @attribute: id of the attribute
+ *
+ * Returns: the value of the attribute, or %NULL if it's not loaded.
+ * The value is owned by @fi and should not be freed.
+ *
+ * Since: 1.2.0
+ */
+gpointer fm_file_info_get_attribute(FmFileInfo * fi, guint attribute)
+{
+    guint index;
+    FmFileInfoAttribute * a;
+    gpointer value = NULL;
+
+    fm_return_val_if_fail(fi, NULL);
+
+    if (!GET_FLAG(FI_FLAG_HAS_ATTRIBUTES))
+        return NULL;
+
+    index = _fm_file_info_lock_index(fi);
+    g_mutex_lock(&attribute_locks[index]);
+    a = _fm_file_info_find_attribute_value(fi, attribute);
+    if (a)
+        value = a->value;
+    g_mutex_unlock(&attribute_locks[index]);
+    return value;
+}
+
+/**
+ * fm_file_info_attribute_loaded:
+ * @fi:  A FmFileInfo struct
+ * @attribute: id of the attribute
+ *
+ * Returns: %TRUE if the attribute of @fi is computed.
+ *
+ * Since: 1.2.0
+ */
+gboolean fm_file_info_attribute_loaded(FmFileInfo * fi, guint attribute)
+{
+    guint index;
+    gboolean loaded;
+
+    fm_return_val_if_fail(fi, FALSE);
+
+    if (!GET_FLAG(FI_FLAG_HAS_ATTRIBUTES))
+        return FALSE;
+
+    index = _fm_file_info_lock_index(fi);
+    g_mutex_lock(&attribute_locks[index]);
+    loaded = _fm_file_info_find_attribute_value(fi, attribute) != NULL;
+    g_mutex_unlock(&attribute_locks[index]);
+    return loaded;
+}
+
+/* To use from fm-file-info-deferred-load.c */
+FmFileInfoAttributeCost _fm_file_info_get_attribute_cost(guint attribute)
+{
+    FmFileInfoAttributeProvider * provider = _fm_file_info_get_attribute_provider(attribute);
+    return provider ? provider->cost : FM_FILE_INFO_ATTRIBUTE_COST_CPU;
+}
+
+/* Computes the attribute unless it's loaded. The lock isn't held while
+ * computing, if two threads do it at once, the first value is kept. */
+void _fm_file_info_load_attribute(FmFileInfo * fi, guint attribute)
+{
+    FmFileInfoAttributeProvider * provider = _fm_file_info_get_attribute_provider(attribute);
+    guint index = _fm_file_info_lock_index(fi);
+    FmFileInfoAttribute * a;
+    gpointer value;
+
+    if (!provider || fm_file_info_attribute_loaded(fi, attribute))
+        return;
+
+    value = provider->func(fi, provider->user_data);
+
+    g_mutex_lock(&attribute_locks[index]);
+    if (_fm_file_info_find_attribute_value(fi, attribute))
+    {
+        g_mutex_unlock(&attribute_locks[index]);
+        if (value && provider->destroy_value)
+            provider->destroy_value(value);
+        return;
+    }
+    if (!attribute_tables[index])
+        attribute_tables[index] = g_hash_table_new(g_direct_hash, g_direct_equal);
+    a = g_slice_new(FmFileInfoAttribute);
+    a->id = attribute;
+    a->value = value;
+    a->next = g_hash_table_lookup(attribute_tables[index], fi);
+    g_hash_table_insert(attribute_tables[index], fi, a);
+    SET_FLAG(FI_FLAG_HAS_ATTRIBUTES, TRUE);
+    g_mutex_unlock(&attribute_locks[index]);
+}
+
+static void _fm_file_info_finalize_attributes(void)
+{
+    guint i;
+
+    for (i = 0; i < FILE_INFO_N_LOCKS; i++)
+    {
+        if (attribute_tables[i])
+        {
+            g_hash_table_destroy(attribute_tables[i]);
+            attribute_tables[i] = NULL;
+        }
+    }
+    for (i = 0; i < (guint) n_attribute_providers; i++)
+        g_free(attribute_providers[i].name);
+    n_attribute_providers = 0;
+}
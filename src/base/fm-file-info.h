@@ -57,9 +57,14 @@ FmFileInfo * fm_file_info_new_from_native_file(FmPath * path, const char * path_
 
 void         fm_file_info_fill_from_gfileinfo(FmFileInfo* fi, GFileInfo* inf);
 gboolean     fm_file_info_fill_from_native_file(FmFileInfo* fi, const char* path_str, GError** err);
+gboolean     _fm_file_info_fill_from_native_file_at(FmFileInfo* fi, int dirfd, const char* name,
+                                                    const char* path_str, GError** err);
 
 void         fm_file_info_set_path(FmFileInfo * fi, FmPath * path);
 
+void         _fm_file_info_load_mime_types(FmFileInfo ** files, guint n_files, gboolean sequential);
+void         _fm_file_info_reclaim_retired(void);
+
 gboolean     fm_file_info_is_filled(FmFileInfo * fi);
 
 /*****************************************************************************/
@@ -71,7 +76,10 @@ void         fm_file_info_unref(FmFileInfo * fi);
 
 void fm_file_info_update(FmFileInfo* fi, FmFileInfo* src);
 
-void fm_file_info_set_color(FmFileInfo* fi, unsigned long color);
+guint fm_file_info_read_begin(void);
+void  fm_file_info_read_end(guint section);
+
+void fm_file_info_set_color(FmFileInfo* fi, guint32 color);
 
 /*****************************************************************************/
 
@@ -122,7 +130,46 @@ const char *  fm_file_info_get_collate_key_nocasefold(FmFileInfo * fi);
 
 gboolean      fm_file_info_can_thumbnail(FmFileInfo * fi);
 
-unsigned long fm_file_info_get_color(FmFileInfo * fi);
+guint32       fm_file_info_get_color(FmFileInfo * fi);
+
+/*****************************************************************************/
+
+/**
+ * FmFileInfoAttributeCost:
+ * @FM_FILE_INFO_ATTRIBUTE_COST_CPU: computed from what is known of the file
+ * @FM_FILE_INFO_ATTRIBUTE_COST_IO: reads the file or its metadata
+ *
+ * What computing an attribute takes, so it is scheduled accordingly.
+ */
+typedef enum
+{
+    FM_FILE_INFO_ATTRIBUTE_COST_CPU,
+    FM_FILE_INFO_ATTRIBUTE_COST_IO
+} FmFileInfoAttributeCost;
+
+/**
+ * FmFileInfoAttributeFunc:
+ * @fi: the file
+ * @user_data: data passed to fm_file_info_register_attribute()
+ *
+ * Computes an attribute of @fi. It is called in a worker thread.
+ *
+ * Returns: the value, which is owned by @fi then. %NULL is a value too.
+ */
+typedef gpointer (*FmFileInfoAttributeFunc)(FmFileInfo * fi, gpointer user_data);
+
+#define FM_FILE_INFO_MAX_ATTRIBUTES 32
+
+guint         fm_file_info_register_attribute(const char * name, FmFileInfoAttributeCost cost,
+                                              FmFileInfoAttributeFunc func, gpointer user_data,
+                                              GDestroyNotify destroy_value);
+guint         fm_file_info_find_attribute(const char * name);
+
+gpointer      fm_file_info_get_attribute(FmFileInfo * fi, guint attribute);
+gboolean      fm_file_info_attribute_loaded(FmFileInfo * fi, guint attribute);
+
+FmFileInfoAttributeCost _fm_file_info_get_attribute_cost(guint attribute);
+void          _fm_file_info_load_attribute(FmFileInfo * fi, guint attribute);
 
 /*****************************************************************************/
 
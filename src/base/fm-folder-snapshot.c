@@ -0,0 +1,524 @@
+/*
+ *      fm-folder-snapshot.c
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* Snapshots of folder listings stored on disk.
+ *
+ * When a big native folder is listed, the names, stat() data and the
+ * known MIME types of its files are written to a file in the user cache
+ * directory, together with the device, inode, mtime and ctime of the
+ * folder. When the folder is opened again, even by another process, and
+ * these are the same, no file was added, removed or renamed since then,
+ * so FmFolder shows the files from the snapshot at once. The folder is
+ * listed anyway, and the listing is merged into what is shown, since
+ * the content of the files could change without touching the folder.
+ *
+ * The file is the header, the array of records and the pool of
+ * NUL-terminated strings the records refer to by offset. It is read
+ * with mmap() and is in the native byte order; a snapshot made by
+ * another build is just not recognized.
+ *
+ * A snapshot which doesn't match its folder any more is deleted when
+ * it's found. Using a snapshot touches its mtime, and when one is saved
+ * the least recently used ones are deleted above SNAPSHOT_MAX_FILES
+ * files or SNAPSHOT_MAX_TOTAL_SIZE bytes.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "fm-folder-snapshot.h"
+
+#define SNAPSHOT_MAGIC "smfmsnap"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NO_STRING G_MAXUINT32
+#define SNAPSHOT_BATCH_SIZE 64
+#define SNAPSHOT_MAX_FILES 200
+#define SNAPSHOT_MAX_TOTAL_SIZE (64 << 20)
+
+typedef struct
+{
+    char magic[8];
+    guint32 version;
+    guint32 record_size;
+    guint32 n_records;
+    guint32 n_mime_types; /* records with known MIME type */
+    FmFolderSnapshotKey key;
+    guint64 strings_offset;
+    guint64 strings_size;
+} SnapshotHeader;
+
+typedef struct
+{
+    guint32 name; /* offsets in the strings */
+    guint32 disp_name;
+    guint32 target;
+    guint32 mime_type;
+    guint32 mode;
+    guint32 uid;
+    guint32 gid;
+    guint32 flags;
+    gint64 size;
+    gint64 mtime;
+    gint64 atime;
+    guint64 dev;
+} SnapshotRecord;
+
+static GThreadPool * update_pool = NULL;
+
+/*****************************************************************************/
+
+void _fm_folder_snapshot_key_from_stat(FmFolderSnapshotKey * key, const struct stat * st)
+{
+    memset(key, 0, sizeof(*key));
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    key->mtime_sec = st->st_mtim.tv_sec;
+    key->mtime_nsec = st->st_mtim.tv_nsec;
+    key->ctime_sec = st->st_ctim.tv_sec;
+    key->ctime_nsec = st->st_ctim.tv_nsec;
+}
+
+static gboolean key_for_dir(const char * dir_str, FmFolderSnapshotKey * key)
+{
+    struct stat st;
+
+    if (stat(dir_str, &st) != 0 || !S_ISDIR(st.st_mode))
+        return FALSE;
+    _fm_folder_snapshot_key_from_stat(key, &st);
+    return TRUE;
+}
+
+static char * snapshot_file_name(const char * dir_str)
+{
+    char * checksum = g_compute_checksum_for_string(G_CHECKSUM_MD5, dir_str, -1);
+    char * base = g_strconcat(checksum, ".snapshot", NULL);
+    char * file = g_build_filename(g_get_user_cache_dir(), "libsmfm", "folders", base, NULL);
+    g_free(base);
+    g_free(checksum);
+    return file;
+}
+
+/* Returns the header if @data is a snapshot of this build. The file can
+ * be anything, so every field is checked against the bytes left after
+ * what was checked before, and no sum of fields can wrap around. */
+static const SnapshotHeader * check_snapshot(const char * data, gsize len)
+{
+    const SnapshotHeader * header = (const SnapshotHeader *) data;
+    gsize records_end;
+
+    if (len < sizeof(SnapshotHeader))
+        return NULL;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        header->record_size != sizeof(SnapshotRecord))
+        return NULL;
+    /* the records lie within the file... */
+    if (header->n_records > (len - sizeof(SnapshotHeader)) / sizeof(SnapshotRecord))
+        return NULL;
+    records_end = sizeof(SnapshotHeader) + (gsize) header->n_records * sizeof(SnapshotRecord);
+    /* ...and the strings take the rest of it */
+    if (header->strings_offset != records_end ||
+        header->strings_size == 0 ||
+        header->strings_size != len - records_end)
+        return NULL;
+    /* every offset in the pool is a terminated string then */
+    if (data[len - 1] != '\0')
+        return NULL;
+    return header;
+}
+
+/* the pool ends with NUL, see check_snapshot(), so a string at an offset
+ * below its size never runs past the end of the file */
+static gboolean get_string(const SnapshotHeader * header, const char * strings,
+                           guint32 offset, const char ** str)
+{
+    if (offset == SNAPSHOT_NO_STRING)
+    {
+        *str = NULL;
+        return TRUE;
+    }
+    if (offset >= header->strings_size)
+        return FALSE;
+    *str = strings + offset;
+    return TRUE;
+}
+
+static gboolean get_entry(const SnapshotHeader * header, const char * strings,
+                          const SnapshotRecord * record, FmFolderSnapshotEntry * entry)
+{
+    if (!get_string(header, strings, record->name, &entry->name) || !entry->name ||
+        !get_string(header, strings, record->disp_name, &entry->disp_name) ||
+        !get_string(header, strings, record->target, &entry->target) ||
+        !get_string(header, strings, record->mime_type, &entry->mime_type))
+        return FALSE;
+    entry->mode = record->mode;
+    entry->uid = record->uid;
+    entry->gid = record->gid;
+    entry->flags = record->flags;
+    entry->size = record->size;
+    entry->mtime = record->mtime;
+    entry->atime = record->atime;
+    entry->dev = record->dev;
+    return TRUE;
+}
+
+/*****************************************************************************/
+
+/* Returns files of @dir_path from its snapshot, or NULL if there is no
+ * snapshot or the folder was changed since it was made. */
+FmFileInfoList * _fm_folder_snapshot_load(FmPath * dir_path)
+{
+    FmFileInfoList * files = NULL;
+    char * dir_str = fm_path_to_str(dir_path);
+    char * file = snapshot_file_name(dir_str);
+    GMappedFile * mapped = g_mapped_file_new(file, FALSE, NULL);
+    const SnapshotHeader * header;
+    FmFolderSnapshotKey key;
+
+    if (!mapped)
+        goto out;
+    header = check_snapshot(g_mapped_file_get_contents(mapped), g_mapped_file_get_length(mapped));
+    if (!key_for_dir(dir_str, &key))
+        goto out;
+    if (!header || memcmp(&key, &header->key, sizeof(key)) != 0)
+    {
+        /* it will never be used, the listing will be saved anew */
+        g_unlink(file);
+        goto out;
+    }
+    /* mtime of snapshots tells which ones were used recently */
+    g_utime(file, NULL);
+
+    {
+        const char * data = g_mapped_file_get_contents(mapped);
+        const SnapshotRecord * records = (const SnapshotRecord *) (data + sizeof(SnapshotHeader));
+        const char * strings = data + header->strings_offset;
+        FmFolderSnapshotEntry entries[SNAPSHOT_BATCH_SIZE];
+        const char * names[SNAPSHOT_BATCH_SIZE];
+        FmPath * paths[SNAPSHOT_BATCH_SIZE];
+        GString * path_str = g_string_new(dir_str);
+        gsize dir_len;
+        guint32 first, i, n;
+
+        if (path_str->str[path_str->len - 1] != '/')
+            g_string_append_c(path_str, '/');
+        dir_len = path_str->len;
+
+        files = fm_file_info_list_new();
+        for (first = 0; first < header->n_records; first += n)
+        {
+            n = MIN(header->n_records - first, SNAPSHOT_BATCH_SIZE);
+            for (i = 0; i < n; i++)
+            {
+                if (!get_entry(header, strings, &records[first + i], &entries[i]))
+                {
+                    g_warning("%s: broken folder snapshot", file);
+                    fm_file_info_list_unref(files);
+                    files = NULL;
+                    break;
+                }
+                names[i] = entries[i].name;
+            }
+            if (!files)
+                break;
+            fm_path_new_children_batch(dir_path, names, n, paths);
+            for (i = 0; i < n; i++)
+            {
+                FmFileInfo * fi;
+                if (G_UNLIKELY(!paths[i]))
+                    continue;
+                g_string_truncate(path_str, dir_len);
+                g_string_append(path_str, entries[i].name);
+                fi = fm_file_info_new_from_path_unfilled(paths[i]);
+                _fm_file_info_fill_from_snapshot_entry(fi, path_str->str, &entries[i]);
+                fm_file_info_list_push_tail_noref(files, fi);
+                fm_path_unref(paths[i]);
+            }
+        }
+        g_string_free(path_str, TRUE);
+    }
+
+out:
+    if (mapped)
+        g_mapped_file_unref(mapped);
+    g_free(file);
+    g_free(dir_str);
+    return files;
+}
+
+static guint32 add_string(GString * strings, const char * str)
+{
+    guint32 offset;
+
+    if (!str)
+        return SNAPSHOT_NO_STRING;
+    offset = strings->len;
+    g_string_append_len(strings, str, strlen(str) + 1);
+    return offset;
+}
+
+typedef struct
+{
+    char * file;
+    time_t mtime;
+    goffset size;
+} SnapshotFile;
+
+static gint compare_snapshot_files(gconstpointer a, gconstpointer b)
+{
+    const SnapshotFile * file_a = a;
+    const SnapshotFile * file_b = b;
+
+    /* the most recent first */
+    if (file_a->mtime != file_b->mtime)
+        return (file_a->mtime < file_b->mtime) ? 1 : -1;
+    return 0;
+}
+
+/* Deletes the least recently used snapshots in @dir above the limits. */
+static void prune_snapshots(const char * dir)
+{
+    GDir * gdir = g_dir_open(dir, 0, NULL);
+    GArray * found;
+    const char * name;
+    goffset total = 0;
+    guint i;
+
+    if (!gdir)
+        return;
+    found = g_array_new(FALSE, FALSE, sizeof(SnapshotFile));
+    while ((name = g_dir_read_name(gdir)))
+    {
+        SnapshotFile snapshot;
+        struct stat st;
+
+        if (!g_str_has_suffix(name, ".snapshot"))
+            continue;
+        snapshot.file = g_build_filename(dir, name, NULL);
+        if (stat(snapshot.file, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            g_free(snapshot.file);
+            continue;
+        }
+        snapshot.mtime = st.st_mtime;
+        snapshot.size = st.st_size;
+        g_array_append_val(found, snapshot);
+    }
+    g_dir_close(gdir);
+
+    g_array_sort(found, compare_snapshot_files);
+    for (i = 0; i < found->len; i++)
+    {
+        SnapshotFile * snapshot = &g_array_index(found, SnapshotFile, i);
+        total += snapshot->size;
+        if (i >= SNAPSHOT_MAX_FILES || total > SNAPSHOT_MAX_TOTAL_SIZE)
+            g_unlink(snapshot->file);
+        g_free(snapshot->file);
+    }
+    g_array_free(found, TRUE);
+}
+
+/* Writes @files as the snapshot of @dir_path which had the state @key
+ * when it was listed. Can be called from any thread. */
+gboolean _fm_folder_snapshot_save(FmPath * dir_path, const FmFolderSnapshotKey * key,
+                                  FmFileInfoList * files)
+{
+    SnapshotHeader header;
+    GByteArray * records;
+    GString * strings;
+    GString * data;
+    GList * l;
+    char * dir_str;
+    char * file;
+    char * dir;
+    gboolean ok = FALSE;
+    guint section;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.record_size = sizeof(SnapshotRecord);
+    header.key = *key;
+
+    records = g_byte_array_sized_new(fm_file_info_list_get_length(files) * sizeof(SnapshotRecord));
+    strings = g_string_sized_new(fm_file_info_list_get_length(files) * 32);
+
+    /* the strings of the entries are not copied */
+    section = fm_file_info_read_begin();
+    for (l = fm_file_info_list_peek_head_link(files); l; l = l->next)
+    {
+        FmFolderSnapshotEntry entry;
+        SnapshotRecord record;
+
+        _fm_file_info_get_snapshot_entry(l->data, &entry);
+        record.name = add_string(strings, entry.name);
+        record.disp_name = add_string(strings, entry.disp_name);
+        record.target = add_string(strings, entry.target);
+        record.mime_type = add_string(strings, entry.mime_type);
+        record.mode = entry.mode;
+        record.uid = entry.uid;
+        record.gid = entry.gid;
+        record.flags = entry.flags;
+        record.size = entry.size;
+        record.mtime = entry.mtime;
+        record.atime = entry.atime;
+        record.dev = entry.dev;
+        g_byte_array_append(records, (const guint8 *) &record, sizeof(record));
+        header.n_records++;
+        if (entry.mime_type)
+            header.n_mime_types++;
+    }
+    fm_file_info_read_end(section);
+
+    if (strings->len >= SNAPSHOT_NO_STRING)
+        goto out;
+    /* the pool must end with NUL even if it has no strings */
+    g_string_append_c(strings, '\0');
+    header.strings_offset = sizeof(header) + records->len;
+    header.strings_size = strings->len;
+
+    data = g_string_sized_new(header.strings_offset + header.strings_size);
+    g_string_append_len(data, (const char *) &header, sizeof(header));
+    g_string_append_len(data, (const char *) records->data, records->len);
+    g_string_append_len(data, strings->str, strings->len);
+
+    dir_str = fm_path_to_str(dir_path);
+    file = snapshot_file_name(dir_str);
+    dir = g_path_get_dirname(file);
+    /* the file is replaced atomically, readers never see a partial one */
+    if (g_mkdir_with_parents(dir, 0700) == 0)
+        ok = g_file_set_contents(file, data->str, data->len, NULL);
+    if (ok)
+        prune_snapshots(dir);
+    g_free(dir);
+    g_free(file);
+    g_free(dir_str);
+    g_string_free(data, TRUE);
+
+out:
+    g_string_free(strings, TRUE);
+    g_byte_array_free(records, TRUE);
+    return ok;
+}
+
+/*****************************************************************************/
+
+typedef struct
+{
+    FmPath * dir_path;
+    FmFileInfoList * files;
+} UpdateTask;
+
+/* Rewrites the snapshot if the folder wasn't changed since it was made
+ * and more MIME types are known now. */
+static void update_snapshot(gpointer data, gpointer user_data)
+{
+    UpdateTask * task = data;
+    char * dir_str = fm_path_to_str(task->dir_path);
+    char * file = snapshot_file_name(dir_str);
+    GMappedFile * mapped = g_mapped_file_new(file, FALSE, NULL);
+    const SnapshotHeader * header;
+    FmFolderSnapshotKey key, saved_key;
+    guint32 n_records = 0, n_mime_types = 0;
+    GList * l;
+
+    if (!mapped)
+        goto out;
+    header = check_snapshot(g_mapped_file_get_contents(mapped), g_mapped_file_get_length(mapped));
+    if (!header)
+    {
+        g_unlink(file);
+        goto out;
+    }
+    saved_key = header->key;
+    n_records = header->n_records;
+    n_mime_types = header->n_mime_types;
+    g_mapped_file_unref(mapped);
+    mapped = NULL;
+
+    if (!key_for_dir(dir_str, &key))
+        goto out;
+    if (memcmp(&key, &saved_key, sizeof(key)) != 0)
+    {
+        g_unlink(file);
+        goto out;
+    }
+    if (fm_file_info_list_get_length(task->files) != n_records)
+        goto out;
+
+    {
+        guint section = fm_file_info_read_begin();
+        guint32 n = 0;
+        for (l = fm_file_info_list_peek_head_link(task->files); l; l = l->next)
+        {
+            FmFolderSnapshotEntry entry;
+            _fm_file_info_get_snapshot_entry(l->data, &entry);
+            if (entry.mime_type)
+                n++;
+        }
+        fm_file_info_read_end(section);
+        if (n > n_mime_types)
+            _fm_folder_snapshot_save(task->dir_path, &saved_key, task->files);
+    }
+
+out:
+    if (mapped)
+        g_mapped_file_unref(mapped);
+    g_free(file);
+    g_free(dir_str);
+    fm_file_info_list_unref(task->files);
+    fm_path_unref(task->dir_path);
+    g_slice_free(UpdateTask, task);
+}
+
+/* Rewrites the snapshot of @dir_path in a thread if it is still valid,
+ * so MIME types resolved since the folder was listed are kept too. */
+void _fm_folder_snapshot_update_async(FmPath * dir_path, FmFileInfoList * files)
+{
+    UpdateTask * task;
+    GList * l;
+
+    if (!update_pool)
+        return;
+    task = g_slice_new(UpdateTask);
+    task->dir_path = fm_path_ref(dir_path);
+    task->files = fm_file_info_list_new();
+    for (l = fm_file_info_list_peek_head_link(files); l; l = l->next)
+        fm_file_info_list_push_tail(task->files, l->data);
+    g_thread_pool_push(update_pool, task, NULL);
+}
+
+void _fm_folder_snapshot_init(void)
+{
+    update_pool = g_thread_pool_new(update_snapshot, NULL, 1, FALSE, NULL);
+}
+
+void _fm_folder_snapshot_finalize(void)
+{
+    /* let the pending updates finish */
+    if (update_pool)
+        g_thread_pool_free(update_pool, FALSE, TRUE);
+    update_pool = NULL;
+}
@@ -0,0 +1,92 @@
+/*
+ *      fm-folder-snapshot.h
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef _FM_FOLDER_SNAPSHOT_H_
+#define _FM_FOLDER_SNAPSHOT_H_
+
+#include <glib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "fm-path.h"
+#include "fm-file-info.h"
+
+G_BEGIN_DECLS
+
+/* smaller folders are listed fast enough without a snapshot */
+#define FM_FOLDER_SNAPSHOT_MIN_FILES 256
+
+/* identity and state of a directory, the snapshot is valid while it's the same */
+typedef struct _FmFolderSnapshotKey FmFolderSnapshotKey;
+struct _FmFolderSnapshotKey
+{
+    guint64 dev;
+    guint64 ino;
+    gint64 mtime_sec;
+    gint64 mtime_nsec;
+    gint64 ctime_sec;
+    gint64 ctime_nsec;
+};
+
+enum
+{
+    FM_FOLDER_SNAPSHOT_DIRECTORY  = 1 << 0, /* a directory or a link to it */
+    FM_FOLDER_SNAPSHOT_REGULAR    = 1 << 1, /* a regular file or a link to it */
+    FM_FOLDER_SNAPSHOT_ACCESSIBLE = 1 << 2
+};
+
+/* what is stored for a file, strings are NULL if not set */
+typedef struct _FmFolderSnapshotEntry FmFolderSnapshotEntry;
+struct _FmFolderSnapshotEntry
+{
+    const char * name;
+    const char * disp_name; /* only if differs from the name */
+    const char * target;
+    const char * mime_type;
+    guint32 mode;
+    guint32 uid;
+    guint32 gid;
+    guint32 flags;
+    gint64 size;
+    gint64 mtime;
+    gint64 atime;
+    guint64 dev;
+};
+
+void             _fm_folder_snapshot_init(void);
+void             _fm_folder_snapshot_finalize(void);
+
+void             _fm_folder_snapshot_key_from_stat(FmFolderSnapshotKey * key, const struct stat * st);
+
+FmFileInfoList * _fm_folder_snapshot_load(FmPath * dir_path);
+gboolean         _fm_folder_snapshot_save(FmPath * dir_path, const FmFolderSnapshotKey * key,
+                                          FmFileInfoList * files);
+void             _fm_folder_snapshot_update_async(FmPath * dir_path, FmFileInfoList * files);
+
+/* implemented in fm-file-info.c */
+void             _fm_file_info_get_snapshot_entry(FmFileInfo * fi, FmFolderSnapshotEntry * entry);
+void             _fm_file_info_fill_from_snapshot_entry(FmFileInfo * fi, const char * path,
+                                                        const FmFolderSnapshotEntry * entry);
+gboolean         _fm_file_info_native_stat_equal(FmFileInfo * fi, FmFileInfo * other);
+
+G_END_DECLS
+
+#endif /*_FM_FOLDER_SNAPSHOT_H_*/
@@ -37,6 +37,8 @@
 #include "fm-dummy-monitor.h"
 #include "fm-file.h"
 #include "fm-utils.h"
+#include "fm-config.h"
+#include "fm-folder-snapshot.h"
 
 #include <string.h>
 
@@ -67,12 +69,19 @@ struct _FmFolder
     FmDirListJob* dirlist_job;
     FmFileInfo* dir_fi;
     FmFileInfoList* files;
+    /* basename -> GList* link in files, for lookups by monitor events */
+    GHashTable* files_by_name;
+    /* files not in files_by_name since another file has the same name */
+    guint n_unindexed;
+    /* files shown from the snapshot and not seen by the listing yet,
+     * basename -> GList* link in files */
+    GHashTable* snapshot_files;
 
     /* for file monitor */
     guint idle_handler;
-    GSList* files_to_add;
-    GSList* files_to_update;
-    GSList* files_to_del;
+    guint flush_handler;
+    /* basename -> PendingFile, events not handled yet */
+    GHashTable* pending_files;
     GSList* pending_jobs;
     gboolean pending_change_notify;
     gboolean filesystem_info_pending;
@@ -95,6 +104,7 @@ static void fm_folder_dispose(GObject *object);
 static void fm_folder_content_changed(FmFolder* folder);
 
 static void on_file_info_job_finished(FmFileInfoJob* job, FmFolder* folder);
+static gboolean on_flush(FmFolder* folder);
 
 G_DEFINE_TYPE(FmFolder, fm_folder, G_TYPE_OBJECT);
 
@@ -341,9 +351,79 @@ static void fm_folder_class_init(FmFolderClass *klass)
 }
 
 
+/* Monitor events of a file since the last flush, merged. Events come
+ * in storms when many files are created or written, and often several
+ * times for the same file. They are collected and handled by a timeout,
+ * so a storm makes a few big updates of the view instead of many small
+ * ones. A file which is still changing, like a download, is handled
+ * when it is quiet for the flush interval, or after MAX_DELAY_INTERVALS
+ * of them, so it's shown anyway. */
+typedef struct
+{
+    gboolean refresh : 1;   /* get the file info again */
+    gboolean deleted : 1;   /* remove the file shown */
+    gint64 first_event;
+    gint64 last_event;
+} PendingFile;
+
+#define MAX_DELAY_INTERVALS 10
+
+static void pending_file_free(gpointer pending)
+{
+    g_slice_free(PendingFile, pending);
+}
+
 static void fm_folder_init(FmFolder *folder)
 {
     folder->files = fm_file_info_list_new();
+    folder->files_by_name = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    folder->pending_files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, pending_file_free);
+}
+
+/* Every change of folder->files goes through these, so the index is
+ * always in sync with the list. The keys are copies: the path of a file
+ * info is replaced by fm_file_info_update(). */
+static void add_file(FmFolder* folder, FmFileInfo* fi, gboolean ref)
+{
+    const char* name = fm_path_get_basename(fm_file_info_get_path(fi));
+    if(ref)
+        fm_file_info_list_push_tail(folder->files, fi);
+    else
+        fm_file_info_list_push_tail_noref(folder->files, fi);
+    /* the first file of the name is found, as it was by walking the list */
+    if(!g_hash_table_lookup(folder->files_by_name, name))
+        g_hash_table_insert(folder->files_by_name, g_strdup(name),
+                            fm_list_peek_tail_link((FmList*)folder->files));
+    else
+        folder->n_unindexed++;
+}
+
+static void delete_file_link(FmFolder* folder, GList* l)
+{
+    const char* name = fm_path_get_basename(fm_file_info_get_path(l->data));
+    GList* indexed = g_hash_table_lookup(folder->files_by_name, name);
+    if(indexed == l)
+    {
+        GList* next = NULL;
+        /* files with the same name are rare, the list is only walked
+         * while there are any, and the next one of the name takes over */
+        if(folder->n_unindexed > 0)
+        {
+            for(next = l->next; next; next = next->next)
+                if(strcmp(fm_path_get_basename(fm_file_info_get_path(next->data)), name) == 0)
+                    break;
+        }
+        if(next)
+        {
+            g_hash_table_insert(folder->files_by_name, g_strdup(name), next);
+            folder->n_unindexed--;
+        }
+        else
+            g_hash_table_remove(folder->files_by_name, name);
+    }
+    else if(indexed)
+        folder->n_unindexed--;
+    fm_file_info_list_delete_link_nounref(folder->files, l);
 }
 
 static gboolean on_idle_reload(FmFolder* folder)
@@ -407,7 +487,7 @@ static void on_file_info_job_finished(FmFileInfoJob* job, FmFolder* folder)
                 if(need_added)
                     files_to_add = g_slist_prepend(files_to_add, fi);
                 //fm_file_info_ref(fi);
-                fm_file_info_list_push_tail(folder->files, fi);
+                add_file(folder, fi, TRUE);
             }
         }
         if(files_to_add)
@@ -429,10 +509,6 @@ static void on_file_info_job_finished(FmFileInfoJob* job, FmFolder* folder)
 
 static gboolean on_idle(FmFolder* folder)
 {
-    GSList* l;
-    FmFileInfoJob* job = NULL;
-    FmPath* path;
-
     /* check if folder still exists */
     G_LOCK(query);
     if(g_source_is_destroyed(g_main_current_source()))
@@ -443,35 +519,91 @@ static gboolean on_idle(FmFolder* folder)
     g_object_ref(folder);
     G_UNLOCK(query);
 
-    if(folder->files_to_update || folder->files_to_add)
-        job = (FmFileInfoJob*)fm_file_info_job_new(NULL, 0);
+    if(folder->pending_change_notify)
+    {
+        g_signal_emit(folder, signals[CHANGED], 0);
+        /* update volume info */
+        fm_folder_query_filesystem_info(folder);
+        folder->pending_change_notify = FALSE;
+    }
 
-    if(folder->files_to_update)
+    G_LOCK(query);
+    folder->idle_handler = 0;
+    if(folder->filesystem_info_pending)
     {
-        for(l=folder->files_to_update; l; l = l->next)
-        {
-            char* name = (char*)l->data;
-            path = fm_path_new_child(folder->dir_path, name);
-            fm_file_info_job_add(job, path);
-            fm_path_unref(path);
-            g_free(name);
-        }
-        g_slist_free(folder->files_to_update);
-        folder->files_to_update = NULL;
+        folder->filesystem_info_pending = FALSE;
+        G_UNLOCK(query);
+        g_signal_emit(folder, signals[FS_INFO], 0);
     }
+    else
+        G_UNLOCK(query);
+    g_object_unref(folder);
+
+    return FALSE;
+}
 
-    if(folder->files_to_add)
+static void queue_flush(FmFolder* folder)
+{
+    G_LOCK(query);
+    if(!folder->flush_handler)
+        folder->flush_handler = g_timeout_add_full(G_PRIORITY_LOW, MAX(fm_config->monitor_flush_interval, 0),
+                                                   (GSourceFunc)on_flush, folder, NULL);
+    G_UNLOCK(query);
+}
+
+/* handles the files which stopped changing, at most monitor_max_batch
+ * of them, with one file info job */
+static gboolean on_flush(FmFolder* folder)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 interval = (gint64)MAX(fm_config->monitor_flush_interval, 0) * 1000;
+    guint max_batch = MAX(fm_config->monitor_max_batch, 1);
+    FmFileInfoJob* job = NULL;
+    GSList* files_to_del = NULL;
+    GHashTableIter it;
+    gpointer name, value;
+    guint n = 0;
+
+    /* check if folder still exists */
+    G_LOCK(query);
+    if(g_source_is_destroyed(g_main_current_source()))
+    {
+        G_UNLOCK(query);
+        return FALSE;
+    }
+    g_object_ref(folder);
+    folder->flush_handler = 0;
+    G_UNLOCK(query);
+
+    g_hash_table_iter_init(&it, folder->pending_files);
+    while(n < max_batch && g_hash_table_iter_next(&it, &name, &value))
     {
-        for(l=folder->files_to_add;l;l=l->next)
+        PendingFile* pending = (PendingFile*)value;
+        if(now - pending->last_event < interval &&
+           now - pending->first_event < interval * MAX_DELAY_INTERVALS)
+            continue; /* still changing */
+
+        if(pending->deleted)
+        {
+            GList* l = _fm_folder_get_file_by_name(folder, name);
+            if(l)
+            {
+                if(folder->snapshot_files)
+                    g_hash_table_remove(folder->snapshot_files, name);
+                files_to_del = g_slist_prepend(files_to_del, l->data);
+                delete_file_link(folder, l);
+            }
+        }
+        if(pending->refresh)
         {
-            char* name = (char*)l->data;
-            path = fm_path_new_child(folder->dir_path, name);
+            FmPath* path = fm_path_new_child(folder->dir_path, name);
+            if(!job)
+                job = (FmFileInfoJob*)fm_file_info_job_new(NULL, 0);
             fm_file_info_job_add(job, path);
             fm_path_unref(path);
-            g_free(name);
         }
-        g_slist_free(folder->files_to_add);
-        folder->files_to_add = NULL;
+        g_hash_table_iter_remove(&it);
+        n++;
     }
 
     if(job)
@@ -483,50 +615,26 @@ static gboolean on_idle(FmFolder* folder)
         /* the job will be freed automatically in on_file_info_job_finished() */
     }
 
-    if(folder->files_to_del)
+    if(files_to_del)
     {
-        GSList* ll;
-        for(ll=folder->files_to_del;ll;ll=ll->next)
-        {
-            GList* l= (GList*)ll->data;
-            ll->data = l->data;
-            fm_file_info_list_delete_link_nounref(folder->files , l);
-        }
-        g_signal_emit(folder, signals[FILES_REMOVED], 0, folder->files_to_del);
-        g_slist_foreach(folder->files_to_del, (GFunc)fm_file_info_unref, NULL);
-        g_slist_free(folder->files_to_del);
-        folder->files_to_del = NULL;
-
+        g_signal_emit(folder, signals[FILES_REMOVED], 0, files_to_del);
+        g_slist_foreach(files_to_del, (GFunc)fm_file_info_unref, NULL);
+        g_slist_free(files_to_del);
         g_signal_emit(folder, signals[CONTENT_CHANGED], 0);
     }
 
-    if(folder->pending_change_notify)
-    {
-        g_signal_emit(folder, signals[CHANGED], 0);
-        /* update volume info */
-        fm_folder_query_filesystem_info(folder);
-        folder->pending_change_notify = FALSE;
-    }
+    /* the rest is handled the next time */
+    if(folder->pending_files && g_hash_table_size(folder->pending_files) > 0)
+        queue_flush(folder);
 
-    G_LOCK(query);
-    folder->idle_handler = 0;
-    if(folder->filesystem_info_pending)
-    {
-        folder->filesystem_info_pending = FALSE;
-        G_UNLOCK(query);
-        g_signal_emit(folder, signals[FS_INFO], 0);
-    }
-    else
-        G_UNLOCK(query);
     g_object_unref(folder);
-
     return FALSE;
 }
 
 static void on_folder_changed(GFileMonitor* mon, GFile* gf, GFile* other, GFileMonitorEvent evt, FmFolder* folder)
 {
-    GList* l;
-    GSList* sl;
+    PendingFile* pending;
+    gint64 now;
 
     if (0)
     {
@@ -590,85 +698,153 @@ static void on_folder_changed(GFileMonitor* mon, GFile* gf, GFile* other, GFileM
     }
 
     gchar * name = g_file_get_basename(gf);
+    pending = g_hash_table_lookup(folder->pending_files, name);
+    now = g_get_monotonic_time();
 
     /* NOTE: sometimes, for unknown reasons, GFileMonitor gives us the
-     * same event of the same file for multiple times. So we need to 
-     * check for duplications ourselves here. */
+     * same event of the same file for multiple times. They are merged
+     * in pending_files. */
     switch(evt)
     {
     case G_FILE_MONITOR_EVENT_CREATED:
-    {
-        /* make sure that the file is not already queued for addition. */
-        if(!g_slist_find_custom(folder->files_to_add, name, (GCompareFunc)strcmp))
-        {
-            l = _fm_folder_get_file_by_name(folder, name);
-            if(!l) /* it's new file */
-            {
-                /* add the file name to queue for addition. */
-                folder->files_to_add = g_slist_append(folder->files_to_add, name);
-            }
-            else if(g_slist_find_custom(folder->files_to_update, name, (GCompareFunc)strcmp))
-            {
-                /* file already queued for update, don't duplicate */
-                g_free(name);
-            }
-            /* if we already have the file in FmFolder, update the existing one instead. */
-            else
-            {
-                /* bug #3591771: 'ln -fns . test' leave no file visible in folder.
-                   If it is queued for deletion then cancel that operation */
-                folder->files_to_del = g_slist_remove(folder->files_to_del, l);
-                /* update the existing item. */
-                folder->files_to_update = g_slist_append(folder->files_to_update, name);
-            }
-        }
-        else
-            g_free(name);
-        break;
-    }
     case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
     case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
-    {
-        /* make sure that the file is not already queued for changes or
-         * it's already queued for addition. */
-        if(!g_slist_find_custom(folder->files_to_update, name, (GCompareFunc)strcmp) &&
-            !g_slist_find_custom(folder->files_to_add, name, (GCompareFunc)strcmp))
+        if(!pending)
         {
-            folder->files_to_update = g_slist_append(folder->files_to_update, name);
+            pending = g_slice_new0(PendingFile);
+            pending->first_event = now;
+            g_hash_table_insert(folder->pending_files, g_strdup(name), pending);
         }
-        else
-            g_free(name);
+        /* bug #3591771: 'ln -fns . test' leave no file visible in folder.
+           If it is queued for deletion then cancel that operation */
+        if(evt == G_FILE_MONITOR_EVENT_CREATED)
+            pending->deleted = FALSE;
+        pending->refresh = TRUE;
+        pending->last_event = now;
         break;
-    }
+    case G_FILE_MONITOR_EVENT_CHANGED:
+        /* the file is being written, wait until it's done */
+        if(pending)
+            pending->last_event = now;
+        g_free(name);
+        return;
     case G_FILE_MONITOR_EVENT_DELETED:
-        l = _fm_folder_get_file_by_name(folder, name);
-        if(l && !g_slist_find(folder->files_to_del, l) )
-            folder->files_to_del = g_slist_prepend(folder->files_to_del, l);
-        /* if the file is already queued for addition or update, that operation
-           will be just a waste, therefore cancel it right now */
-        sl = g_slist_find_custom(folder->files_to_update, name, (GCompareFunc)strcmp);
-        if(sl)
+        if(_fm_folder_get_file_by_name(folder, name))
         {
-            g_free(sl->data); /* free name */
-            folder->files_to_update = g_slist_delete_link(folder->files_to_update, sl);
-        }
-        else if((sl = g_slist_find_custom(folder->files_to_add, name,
-                                          (GCompareFunc)strcmp)))
-        {
-            g_free(sl->data); /* free name */
-            folder->files_to_add = g_slist_delete_link(folder->files_to_add, sl);
+            if(!pending)
+            {
+                pending = g_slice_new0(PendingFile);
+                pending->first_event = now;
+                g_hash_table_insert(folder->pending_files, g_strdup(name), pending);
+            }
+            /* getting the file info again would be just a waste */
+            pending->refresh = FALSE;
+            pending->deleted = TRUE;
+            pending->last_event = now;
         }
-        g_free(name);
+        else if(pending) /* the file was not shown yet */
+            g_hash_table_remove(folder->pending_files, name);
         break;
     default:
         /* g_debug("folder %p %s event: %s", folder, name, names[evt]); */
         g_free(name);
         return;
     }
-    G_LOCK(query);
-    if(!folder->idle_handler)
-        folder->idle_handler = g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)on_idle, folder, NULL);
-    G_UNLOCK(query);
+    g_free(name);
+    queue_flush(folder);
+}
+
+/* shows the files from the snapshot of the folder, if it has a valid one */
+static void load_snapshot(FmFolder* folder)
+{
+    FmFileInfoList* snapshot = _fm_folder_snapshot_load(folder->dir_path);
+    GSList* files = NULL;
+    FmFileInfo* fi;
+
+    if(!snapshot)
+        return;
+    folder->snapshot_files = g_hash_table_new(g_str_hash, g_str_equal);
+    while((fi = fm_file_info_list_pop_head(snapshot)))
+    {
+        add_file(folder, fi, FALSE);
+        g_hash_table_insert(folder->snapshot_files,
+                            (gpointer)fm_path_get_basename(fm_file_info_get_path(fi)),
+                            fm_list_peek_tail_link((FmList*)folder->files));
+        files = g_slist_prepend(files, fi);
+    }
+    fm_file_info_list_unref(snapshot);
+    if(files)
+    {
+        g_signal_emit(folder, signals[FILES_ADDED], 0, files);
+        g_slist_free(files);
+    }
+    g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "FmFolder: %s: %u files shown from snapshot in %lld µs",
+        fm_path_get_basename(folder->dir_path), g_hash_table_size(folder->snapshot_files),
+        (long long)(g_get_monotonic_time() - folder->start_time));
+}
+
+/* Files found by the listing replace those shown from the snapshot.
+ * Files which were not changed since the snapshot are kept as they are,
+ * with the MIME type it had. */
+static void merge_listed_files(FmFolder* folder, FmFileInfoList* listed)
+{
+    GSList* files_added = NULL;
+    GSList* files_changed = NULL;
+    GList* l;
+
+    for(l = fm_file_info_list_peek_head_link(listed); l; l = l->next)
+    {
+        FmFileInfo* fi = (FmFileInfo*)l->data;
+        const char* name = fm_path_get_basename(fm_file_info_get_path(fi));
+        GList* shown = g_hash_table_lookup(folder->snapshot_files, name);
+        if(shown)
+        {
+            FmFileInfo* old = (FmFileInfo*)shown->data;
+            g_hash_table_remove(folder->snapshot_files, name);
+            if(!_fm_file_info_native_stat_equal(old, fi))
+            {
+                fm_file_info_update(old, fi);
+                files_changed = g_slist_prepend(files_changed, old);
+            }
+        }
+        else
+        {
+            add_file(folder, fi, TRUE);
+            files_added = g_slist_prepend(files_added, fi);
+        }
+    }
+    if(files_added)
+    {
+        g_signal_emit(folder, signals[FILES_ADDED], 0, files_added);
+        g_slist_free(files_added);
+    }
+    if(files_changed)
+    {
+        g_signal_emit(folder, signals[FILES_CHANGED], 0, files_changed);
+        g_slist_free(files_changed);
+    }
+}
+
+static void remove_unlisted_snapshot_files(FmFolder* folder)
+{
+    GSList* files_removed = NULL;
+    GHashTableIter it;
+    gpointer link;
+
+    g_hash_table_iter_init(&it, folder->snapshot_files);
+    while(g_hash_table_iter_next(&it, NULL, &link))
+    {
+        files_removed = g_slist_prepend(files_removed, ((GList*)link)->data);
+        delete_file_link(folder, link);
+        g_hash_table_iter_remove(&it);
+    }
+    if(files_removed)
+    {
+        g_signal_emit(folder, signals[FILES_REMOVED], 0, files_removed);
+        g_slist_foreach(files_removed, (GFunc)fm_file_info_unref, NULL);
+        g_slist_free(files_removed);
+        g_signal_emit(folder, signals[CONTENT_CHANGED], 0);
+    }
 }
 
 static void on_dirlist_job_finished(FmDirListJob* job, FmFolder* folder)
@@ -687,40 +863,31 @@ static void on_dirlist_job_finished(FmDirListJob* job, FmFolder* folder)
     if(!fm_job_is_cancelled(FM_JOB(job)) && !folder->wants_incremental)
     {
         GList* l;
-        for(l = fm_file_info_list_peek_head_link(job->files); l; l=l->next)
-        {
-            FmFileInfo* inf = (FmFileInfo*)l->data;
-            files = g_slist_prepend(files, inf);
-            fm_file_info_list_push_tail(folder->files, inf);
-        }
-        if(G_LIKELY(files))
-        {
-            g_signal_emit(folder, signals[FILES_ADDED], 0, files);
-            g_slist_free(files);
-        }
-
-        /* Some new files are created while FmDirListJob is loading the folder. */
-        if(G_UNLIKELY(folder->files_to_add))
+        if(folder->snapshot_files)
+            merge_listed_files(folder, job->files);
+        else
         {
-            /* This should be a very rare case. Could this happen? */
-            GSList* l;
-            for(l = folder->files_to_add; l;)
+            for(l = fm_file_info_list_peek_head_link(job->files); l; l=l->next)
+            {
+                FmFileInfo* inf = (FmFileInfo*)l->data;
+                files = g_slist_prepend(files, inf);
+                add_file(folder, inf, TRUE);
+            }
+            if(G_LIKELY(files))
             {
-                char* name = (char*)l->data;
-                GSList* next = l->next;
-                if(_fm_folder_get_file_by_name(folder, name))
-                {
-                    /* we already have the file. remove it from files_to_add, 
-                     * and put it in files_to_update instead.
-                     * No strdup for name is needed here. We steal
-                     * the string from files_to_add.*/
-                    folder->files_to_update = g_slist_prepend(folder->files_to_update, name);
-                    folder->files_to_add = g_slist_delete_link(folder->files_to_add, l);
-                }
-                l = next;
+                g_signal_emit(folder, signals[FILES_ADDED], 0, files);
+                g_slist_free(files);
             }
         }
     }
+    if(folder->snapshot_files)
+    {
+        /* files the listing didn't find were deleted since the snapshot */
+        if(!fm_job_is_cancelled(FM_JOB(job)))
+            remove_unlisted_snapshot_files(folder);
+        g_hash_table_destroy(folder->snapshot_files);
+        folder->snapshot_files = NULL;
+    }
     g_object_unref(folder->dirlist_job);
     folder->dirlist_job = NULL;
 
@@ -739,10 +906,20 @@ static void on_dirlist_job_files_found(FmDirListJob* job, GSList* files, gpointe
 {
     FmFolder* folder = FM_FOLDER(user_data);
     GSList* l;
+    if(folder->snapshot_files)
+    {
+        FmFileInfoList* list = fm_file_info_list_new();
+        for(l = files; l; l = l->next)
+            fm_file_info_list_push_tail(list, FM_FILE_INFO(l->data));
+        merge_listed_files(folder, list);
+        fm_file_info_list_unref(list);
+        g_signal_emit(folder, signals[CONTENT_CHANGED], 0);
+        return;
+    }
     for(l = files; l; l = l->next)
     {
         FmFileInfo* file = FM_FILE_INFO(l->data);
-        fm_file_info_list_push_tail(folder->files, file);
+        add_file(folder, file, TRUE);
     }
     g_signal_emit(folder, signals[FILES_ADDED], 0, files);
     g_signal_emit(folder, signals[CONTENT_CHANGED], 0);
@@ -768,6 +945,8 @@ static FmFolder* fm_folder_new_internal(FmPath* path, GFile* gf)
 {
     FmFolder* folder = (FmFolder*)g_object_new(FM_TYPE_FOLDER, NULL);
     folder->dir_path = fm_path_ref(path);
+    /* its files will be converted into strings many times */
+    _fm_path_cache_str(path);
     folder->gf = (GFile*)g_object_ref(gf);
     folder->wants_incremental = fm_file_wants_incremental(gf);
     fm_folder_reload(folder);
@@ -822,6 +1001,17 @@ static void fm_folder_dispose(GObject *object)
 
     if(folder->dirlist_job)
         free_dirlist_job(folder);
+    /* MIME types resolved while the folder was open are worth keeping */
+    else if(fm_config->folder_snapshots && folder->files && folder->dir_path &&
+            fm_path_is_native(folder->dir_path) &&
+            fm_file_info_list_get_length(folder->files) >= FM_FOLDER_SNAPSHOT_MIN_FILES)
+        _fm_folder_snapshot_update_async(folder->dir_path, folder->files);
+
+    if(folder->snapshot_files)
+    {
+        g_hash_table_destroy(folder->snapshot_files);
+        folder->snapshot_files = NULL;
+    }
 
     if(folder->pending_jobs)
     {
@@ -855,25 +1045,17 @@ static void fm_folder_dispose(GObject *object)
     {
         g_source_remove(folder->idle_handler);
         folder->idle_handler = 0;
-        if(folder->files_to_add)
-        {
-            g_slist_foreach(folder->files_to_add, (GFunc)g_free, NULL);
-            g_slist_free(folder->files_to_add);
-            folder->files_to_add = NULL;
-        }
-        if(folder->files_to_update)
-        {
-            g_slist_foreach(folder->files_to_update, (GFunc)g_free, NULL);
-            g_slist_free(folder->files_to_update);
-            folder->files_to_update = NULL;
-        }
-        if(folder->files_to_del)
-        {
-            // FIXME: is this needed?
-            /* g_slist_foreach(folder->files_to_del, (GFunc)g_free, NULL); */
-            g_slist_free(folder->files_to_del);
-            folder->files_to_del = NULL;
-        }
+    }
+
+    if(folder->flush_handler)
+    {
+        g_source_remove(folder->flush_handler);
+        folder->flush_handler = 0;
+    }
+    if(folder->pending_files)
+    {
+        g_hash_table_destroy(folder->pending_files);
+        folder->pending_files = NULL;
     }
 
     if(folder->fs_size_cancellable)
@@ -909,6 +1091,11 @@ static void fm_folder_dispose(GObject *object)
         fm_file_info_list_unref(folder->files);
         folder->files = NULL;
     }
+    if(folder->files_by_name)
+    {
+        g_hash_table_destroy(folder->files_by_name);
+        folder->files_by_name = NULL;
+    }
 
     (* G_OBJECT_CLASS(fm_folder_parent_class)->dispose)(object);
 }
@@ -1029,6 +1216,13 @@ void fm_folder_reload(FmFolder* folder)
             g_slist_free(files_to_del);
         }
         fm_file_info_list_clear(folder->files); /* fm_file_info_unref will be invoked. */
+        g_hash_table_remove_all(folder->files_by_name);
+        folder->n_unindexed = 0;
+    }
+    if(folder->snapshot_files)
+    {
+        g_hash_table_destroy(folder->snapshot_files);
+        folder->snapshot_files = NULL;
     }
 
     /* also re-create a new file monitor */
@@ -1049,6 +1243,10 @@ void fm_folder_reload(FmFolder* folder)
         folder->mon = NULL;
     }
 
+    /* show the files at once if they are known, the listing will verify them */
+    if(fm_config->folder_snapshots && fm_path_is_native(folder->dir_path))
+        load_snapshot(folder);
+
     g_signal_emit(folder, signals[CONTENT_CHANGED], 0);
 
     /* run a new dir listing job */
@@ -1059,6 +1257,8 @@ void fm_folder_reload(FmFolder* folder)
     if(folder->wants_incremental)
         g_signal_connect(folder->dirlist_job, "files-found", G_CALLBACK(on_dirlist_job_files_found), folder);
     fm_dir_list_job_set_incremental(folder->dirlist_job, folder->wants_incremental);
+    fm_dir_list_job_set_precompute_collate_keys(folder->dirlist_job, TRUE);
+    fm_dir_list_job_set_save_snapshot(folder->dirlist_job, fm_config->folder_snapshots);
     g_signal_connect(folder->dirlist_job, "error", G_CALLBACK(on_dirlist_job_error), folder);
     fm_job_run_async(FM_JOB(folder->dirlist_job));
     /* FIXME: free job if error */
@@ -1137,15 +1337,9 @@ FmPath* fm_folder_get_path(FmFolder* folder)
 
 static GList* _fm_folder_get_file_by_name(FmFolder* folder, const char* name)
 {
-    GList* l = fm_file_info_list_peek_head_link(folder->files);
-    for(;l;l=l->next)
-    {
-        FmFileInfo* fi = (FmFileInfo*)l->data;
-        FmPath* path = fm_file_info_get_path(fi);
-        if(strcmp(fm_path_get_basename(path), name) == 0)
-            return l;
-    }
-    return NULL;
+    if(!folder->files_by_name)
+        return NULL;
+    return g_hash_table_lookup(folder->files_by_name, name);
 }
 
 /**
@@ -1449,6 +1643,7 @@ static void on_mount_removed(GVolumeMonitor* vm, GMount* mount, gpointer user_da
 void _fm_folder_init()
 {
     hash = g_hash_table_new((GHashFunc)fm_path_hash, (GEqualFunc)fm_path_equal);
+    _fm_folder_snapshot_init();
     volume_monitor = g_volume_monitor_get();
     if(G_LIKELY(volume_monitor))
     {
@@ -1461,6 +1656,7 @@ void _fm_folder_finalize()
 {
     g_hash_table_destroy(hash);
     hash = NULL;
+    _fm_folder_snapshot_finalize();
     if(volume_monitor)
     {
         g_signal_handlers_disconnect_by_func(volume_monitor, on_mount_added, NULL);
@@ -0,0 +1,243 @@
+/*
+ *      fm-format-cache.c
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* Caches of formatted file sizes and modification times.
+ *
+ * Files of a folder often show the same text in the size and the date
+ * columns: "4.0 KiB" or a date and time accurate to a minute. Instead of
+ * formatting it for each file, the text is looked up by the value it is
+ * formatted from. The key is what the user sees: the exact size for
+ * sizes below 1 kB, otherwise the unit and the size in tenths of it, and
+ * the minute for modification times.
+ *
+ * Both caches are direct-mapped tables of fixed size, a new entry just
+ * replaces an old one in its slot, so they never grow. Values are
+ * interned symbols, so files that got the text from the cache and files
+ * that formatted it themselves share the same string.
+ *
+ * The text depends on the si_unit setting and on the locale. The caches
+ * are flushed when either changes, and the serial number is incremented,
+ * so FmFileInfo objects that store the serial of their text know it has
+ * to be formatted again. Since there is no notification of locale changes,
+ * the locale is checked at most once per second.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <locale.h>
+
+#include "fm-format-cache.h"
+#include "fm-config.h"
+#include "fm-utils.h"
+
+#define FORMAT_CACHE_SIZE 1024 /* entries in each cache, power of 2 */
+#define LOCALE_CHECK_INTERVAL G_USEC_PER_SEC
+
+typedef struct
+{
+    guint64 key;
+    FmSymbol * value; /* NULL if the slot is empty */
+} FormatCacheEntry;
+
+static FormatCacheEntry size_cache[FORMAT_CACHE_SIZE];
+static FormatCacheEntry mtime_cache[FORMAT_CACHE_SIZE];
+static GMutex cache_mutex;
+
+static volatile guint serial = 1;
+static char * saved_locale = NULL;
+static gint64 last_locale_check = 0;
+
+static void flush_cache(FormatCacheEntry * cache)
+{
+    int i;
+
+    for (i = 0; i < FORMAT_CACHE_SIZE; i++)
+    {
+        if (cache[i].value)
+        {
+            fm_symbol_unref(cache[i].value);
+            cache[i].value = NULL;
+        }
+    }
+}
+
+/* should be called with cache_mutex locked */
+static void invalidate(void)
+{
+    flush_cache(size_cache);
+    flush_cache(mtime_cache);
+    g_atomic_int_inc(&serial);
+}
+
+static void on_si_unit_changed(FmConfig * cfg, gpointer user_data)
+{
+    g_mutex_lock(&cache_mutex);
+    invalidate();
+    g_mutex_unlock(&cache_mutex);
+}
+
+static inline guint slot_of(guint64 key)
+{
+    /* Fibonacci hashing, adjacent keys go to different slots */
+    return (guint)((key * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)) >> 54) & (FORMAT_CACHE_SIZE - 1);
+}
+
+/* returns a new reference to the cached value or NULL */
+static FmSymbol * lookup(FormatCacheEntry * cache, guint64 key)
+{
+    FormatCacheEntry * entry = &cache[slot_of(key)];
+    FmSymbol * value = NULL;
+
+    g_mutex_lock(&cache_mutex);
+    if (entry->value && entry->key == key)
+        value = fm_symbol_ref(entry->value);
+    g_mutex_unlock(&cache_mutex);
+    return value;
+}
+
+static void insert(FormatCacheEntry * cache, guint64 key, FmSymbol * value)
+{
+    FormatCacheEntry * entry = &cache[slot_of(key)];
+
+    g_mutex_lock(&cache_mutex);
+    if (entry->value)
+        fm_symbol_unref(entry->value);
+    entry->key = key;
+    entry->value = fm_symbol_ref(value);
+    g_mutex_unlock(&cache_mutex);
+}
+
+/*****************************************************************************/
+
+void _fm_format_cache_init(void)
+{
+    saved_locale = g_strdup(setlocale(LC_ALL, NULL));
+    last_locale_check = g_get_monotonic_time();
+    g_signal_connect(fm_config, "changed::si_unit",
+                     G_CALLBACK(on_si_unit_changed), NULL);
+}
+
+void _fm_format_cache_finalize(void)
+{
+    g_signal_handlers_disconnect_by_func(fm_config, on_si_unit_changed, NULL);
+    g_mutex_lock(&cache_mutex);
+    invalidate();
+    g_free(saved_locale);
+    saved_locale = NULL;
+    g_mutex_unlock(&cache_mutex);
+}
+
+/* Returns the serial number of the current formatting. Text formatted
+ * with another serial number is out of date. */
+guint _fm_format_cache_get_serial(void)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (G_UNLIKELY(now - last_locale_check >= LOCALE_CHECK_INTERVAL))
+    {
+        g_mutex_lock(&cache_mutex);
+        if (now - last_locale_check >= LOCALE_CHECK_INTERVAL)
+        {
+            const char * locale = setlocale(LC_ALL, NULL);
+            last_locale_check = now;
+            if (g_strcmp0(locale, saved_locale) != 0)
+            {
+                g_free(saved_locale);
+                saved_locale = g_strdup(locale);
+                invalidate();
+            }
+        }
+        g_mutex_unlock(&cache_mutex);
+    }
+    return g_atomic_int_get(&serial);
+}
+
+/* Returns the text fm_file_size_to_str() makes of @size.
+ * The result should be freed with fm_symbol_unref(). */
+FmSymbol * _fm_format_cache_get_size(goffset size, gboolean si_unit)
+{
+    gdouble base = si_unit ? 1000.0 : 1024.0;
+    gdouble val = (gdouble)size;
+    guint64 key, unit = 0;
+    FmSymbol * value;
+    char buf[128];
+
+    /* sizes which are not known are rare, they aren't worth a key */
+    if (G_UNLIKELY(size < 0))
+    {
+        fm_file_size_to_str(buf, sizeof(buf), size, si_unit);
+        return fm_symbol_new_interned(buf, -1);
+    }
+
+    /* the same units as fm_file_size_to_str() chooses */
+    if (val < base)
+        key = (guint64)size;
+    else
+    {
+        for (unit = 1; unit < 4 && val >= base * base; unit++)
+            val /= base;
+        val /= base;
+        /* tenths of the unit is what "%.1f" shows; halfway cases are
+         * left to printf() since its rounding of them may differ */
+        val *= 10.0;
+        if (G_UNLIKELY(ABS(val - (gdouble)(guint64)val - 0.5) < 1e-6))
+        {
+            fm_file_size_to_str(buf, sizeof(buf), size, si_unit);
+            return fm_symbol_new_interned(buf, -1);
+        }
+        key = (guint64)(val + 0.5);
+    }
+    key = ((guint64)(si_unit != FALSE) << 63) | (unit << 59) | (key & ((G_GUINT64_CONSTANT(1) << 59) - 1));
+
+    value = lookup(size_cache, key);
+    if (!value)
+    {
+        fm_file_size_to_str(buf, sizeof(buf), size, si_unit);
+        value = fm_symbol_new_interned(buf, -1);
+        insert(size_cache, key, value);
+    }
+    return value;
+}
+
+/* Returns the text of @mtime shown in the UI. Seconds are not shown,
+ * so all times within a minute are the same entry.
+ * The result should be freed with fm_symbol_unref(). */
+FmSymbol * _fm_format_cache_get_mtime(time_t mtime)
+{
+    guint64 key = (guint64)(mtime / 60);
+    FmSymbol * value;
+    struct tm tm;
+    char buf[128];
+
+    value = lookup(mtime_cache, key);
+    if (!value)
+    {
+        if (localtime_r(&mtime, &tm) == NULL ||
+            strftime(buf, sizeof(buf), "%x %R", &tm) == 0)
+            buf[0] = '\0';
+        value = fm_symbol_new_interned(buf, -1);
+        insert(mtime_cache, key, value);
+    }
+    return value;
+}
@@ -28,7 +28,7 @@
 
 void fm_file_info_highlight(FmFileInfo * fi)
 {
-    unsigned long color = FILE_INFO_DEFAULT_COLOR;
+    guint32 color = FILE_INFO_DEFAULT_COLOR;
 
     if (fm_file_info_is_directory(fi))
         color = 0x000080;
@@ -33,6 +33,7 @@
 #endif
 
 #include "fm-mime-type.h"
+#include "fm-content-type-cache.h"
 
 #include <glib/gi18n-lib.h>
 #include <sys/types.h>
@@ -41,6 +42,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <ctype.h>
+#include <fnmatch.h>
 
 #ifdef HAVE_MMAP
 #include <sys/mman.h>
@@ -56,12 +58,39 @@ struct _FmMimeType
     GList* thumbnailers; /* FmMimeType does "not" own the FmThumbnailer objects */
 
     int n_ref;
+
+    guint hash; /* of the type name, for the registry */
+
+    FmMimeTypeClasses classes;
 };
 
 /* FIXME: how can we handle reload of xdg mime? */
 
-static GHashTable *mime_hash = NULL;
-G_LOCK_DEFINE(mime_hash);
+/* The registry of MIME types.
+ *
+ * Every file looks its type up here, from many threads, so lookups take
+ * no lock. The table uses open addressing, and a slot once filled is
+ * never changed. A full table is replaced by a bigger copy. Inserts are
+ * serialized with mime_table_mutex. A lookup may still be reading a
+ * replaced table, so these are freed only when the library is finalized;
+ * since the size doubles, all of them take less than the last one. */
+typedef struct _FmMimeTable FmMimeTable;
+struct _FmMimeTable
+{
+    FmMimeTable * replaced;
+    guint size; /* power of 2 */
+    guint n_types;
+    FmMimeType * volatile slots[];
+};
+
+#define MIME_TABLE_INITIAL_SIZE 512
+
+static FmMimeTable * volatile mime_table = NULL;
+static GMutex mime_table_mutex;
+
+/* reads heads of files for _fm_mime_type_from_native_files() */
+static GThreadPool * content_read_pool = NULL;
+G_LOCK_DEFINE_STATIC(content_read_pool);
 
 /* Preallocated MIME types */
 static FmMimeType * inode_directory_type = NULL;
@@ -79,10 +108,269 @@ static FmMimeType * shortcut_type = NULL;
 
 static FmMimeType* fm_mime_type_new(const char* type_name);
 
+/*****************************************************************************/
+
+/* Cache of content types guessed by file name.
+ *
+ * g_content_type_guess() matches the name against all the globs of the
+ * shared-mime-info database under a global lock each time, though files
+ * with the same extension always get the same answer. Here the answer is
+ * kept for the tail of the name from its first dot: globs like "*.tar.gz"
+ * or "*.[1-9]" can only match inside it, so the rest of the name doesn't
+ * matter. Other globs, as "Makefile", "README*" or "*~", depend on the
+ * whole name. They are read from the database: names equal to a literal
+ * one are cached by the whole name, names matching the rest are not
+ * cached. The check for them is case-insensitive, so it may find more
+ * names than GIO does, which only makes them not cached.
+ *
+ * The database files are checked for changes at most once in
+ * NAME_GUESS_CHECK_INTERVAL, like GIO does, and the cache is cleared if
+ * they changed. */
+
+#define NAME_GUESS_CHECK_INTERVAL (5 * G_USEC_PER_SEC)
+#define NAME_GUESS_MAX_ENTRIES 4096
+
+typedef struct
+{
+    gchar * type;
+    gboolean uncertain;
+} NameGuess;
+
+static GRWLock name_guess_lock;
+static GHashTable * name_guesses = NULL;   /* key -> NameGuess */
+static GHashTable * literal_globs = NULL;  /* lowercase names */
+static GPtrArray * name_globs = NULL;      /* lowercase globs depending on the whole name */
+static char * globs_stamp = NULL;          /* mtimes and sizes of the glob files */
+static gint64 globs_checked = 0;
+
+static void name_guess_free(gpointer data)
+{
+    NameGuess * guess = data;
+    g_free(guess->type);
+    g_slice_free(NameGuess, guess);
+}
+
+static void add_glob(const char * glob)
+{
+    if (!strpbrk(glob, "*?["))
+        g_hash_table_add(literal_globs, g_utf8_strdown(glob, -1));
+    else if (glob[0] != '*' || glob[1] != '.' || strchr(glob + 2, '*'))
+        g_ptr_array_add(name_globs, g_utf8_strdown(glob, -1));
+}
+
+/* lines are "weight:type:glob[:flags]" in globs2, "type:glob" in globs */
+static void load_globs_file(const char * file, gboolean weighted)
+{
+    char * content, ** lines, ** line;
+
+    if (!g_file_get_contents(file, &content, NULL, NULL))
+        return;
+    lines = g_strsplit(content, "\n", -1);
+    for (line = lines; *line; line++)
+    {
+        char ** fields;
+        if (**line == '#' || **line == '\0')
+            continue;
+        fields = g_strsplit(*line, ":", 4);
+        if (fields[0] && fields[1] && (!weighted || fields[2]))
+            add_glob(fields[weighted ? 2 : 1]);
+        g_strfreev(fields);
+    }
+    g_strfreev(lines);
+    g_free(content);
+}
+
+/* the mime directories of all data directories */
+static char ** mime_dirs_new(void)
+{
+    const char * const * dirs = g_get_system_data_dirs();
+    GPtrArray * files = g_ptr_array_new();
+
+    g_ptr_array_add(files, g_build_filename(g_get_user_data_dir(), "mime", NULL));
+    for (; *dirs; dirs++)
+        g_ptr_array_add(files, g_build_filename(*dirs, "mime", NULL));
+    g_ptr_array_add(files, NULL);
+    return (char **) g_ptr_array_free(files, FALSE);
+}
+
+static char * make_globs_stamp(char ** mime_dirs)
+{
+    GString * stamp = g_string_new(NULL);
+    char ** dir;
+
+    for (dir = mime_dirs; *dir; dir++)
+    {
+        struct stat st;
+        char * file = g_build_filename(*dir, "globs2", NULL);
+        if (stat(file, &st) != 0)
+        {
+            g_free(file);
+            file = g_build_filename(*dir, "globs", NULL);
+            if (stat(file, &st) != 0)
+                memset(&st, 0, sizeof(st));
+        }
+        g_string_append_printf(stamp, "%lld.%ld:%lld;", (long long) st.st_mtim.tv_sec,
+                               (long) st.st_mtim.tv_nsec, (long long) st.st_size);
+        g_free(file);
+    }
+    return g_string_free(stamp, FALSE);
+}
+
+/* reloads the globs if they changed; should be called with the writer lock held */
+static void name_guess_check_globs(void)
+{
+    char ** mime_dirs = mime_dirs_new();
+    char * stamp = make_globs_stamp(mime_dirs);
+    char ** dir;
+
+    if (g_strcmp0(stamp, globs_stamp) == 0)
+    {
+        g_free(stamp);
+        g_strfreev(mime_dirs);
+        return;
+    }
+    g_free(globs_stamp);
+    globs_stamp = stamp;
+
+    if (name_guesses)
+    {
+        g_hash_table_destroy(name_guesses);
+        g_hash_table_destroy(literal_globs);
+        g_ptr_array_free(name_globs, TRUE);
+    }
+    name_guesses = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, name_guess_free);
+    literal_globs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    name_globs = g_ptr_array_new_with_free_func(g_free);
+
+    for (dir = mime_dirs; *dir; dir++)
+    {
+        char * file = g_build_filename(*dir, "globs2", NULL);
+        if (g_file_test(file, G_FILE_TEST_EXISTS))
+            load_globs_file(file, TRUE);
+        else
+        {
+            g_free(file);
+            file = g_build_filename(*dir, "globs", NULL);
+            load_globs_file(file, FALSE);
+        }
+        g_free(file);
+    }
+    g_strfreev(mime_dirs);
+}
+
+/* Returns the key the guess for @base_name is cached under, or NULL if
+ * it's not cached. Should be called with a lock held. */
+static char * name_guess_key(const char * base_name)
+{
+    char * lower = g_utf8_strdown(base_name, -1);
+    const char * dot;
+    char * key = NULL;
+    guint i;
+
+    if (g_hash_table_contains(literal_globs, lower))
+        key = g_strconcat("=", base_name, NULL);
+    else
+    {
+        for (i = 0; i < name_globs->len; i++)
+        {
+            if (fnmatch(g_ptr_array_index(name_globs, i), lower, 0) == 0)
+                break;
+        }
+        if (i == name_globs->len)
+        {
+            dot = strchr(base_name, '.');
+            key = g_strdup(dot ? dot : "");
+        }
+    }
+    g_free(lower);
+    return key;
+}
+
+static void _name_guess_cache_finalize(void)
+{
+    g_rw_lock_writer_lock(&name_guess_lock);
+    if (name_guesses)
+    {
+        g_hash_table_destroy(name_guesses);
+        g_hash_table_destroy(literal_globs);
+        g_ptr_array_free(name_globs, TRUE);
+        name_guesses = literal_globs = NULL;
+        name_globs = NULL;
+    }
+    g_free(globs_stamp);
+    globs_stamp = NULL;
+    globs_checked = 0;
+    g_rw_lock_writer_unlock(&name_guess_lock);
+}
+
+/* g_content_type_guess() by the name only */
+static gchar * _content_type_guess_by_name(const char * name, gboolean * uncertain)
+{
+    const char * base_name = strrchr(name, '/');
+    gint64 now = g_get_monotonic_time();
+    NameGuess * guess = NULL;
+    char * key = NULL;
+    gchar * type = NULL;
+
+    /* GIO knows a directory by the slash at the end */
+    base_name = base_name ? base_name + 1 : name;
+    if (*base_name == '\0')
+        return g_content_type_guess(name, NULL, 0, uncertain);
+
+    if (G_UNLIKELY(now - globs_checked >= NAME_GUESS_CHECK_INTERVAL))
+    {
+        g_rw_lock_writer_lock(&name_guess_lock);
+        if (now - globs_checked >= NAME_GUESS_CHECK_INTERVAL)
+        {
+            name_guess_check_globs();
+            globs_checked = now;
+        }
+        g_rw_lock_writer_unlock(&name_guess_lock);
+    }
+
+    g_rw_lock_reader_lock(&name_guess_lock);
+    if (name_guesses)
+    {
+        key = name_guess_key(base_name);
+        if (key)
+            guess = g_hash_table_lookup(name_guesses, key);
+        if (guess)
+        {
+            type = g_strdup(guess->type);
+            *uncertain = guess->uncertain;
+        }
+    }
+    g_rw_lock_reader_unlock(&name_guess_lock);
+    if (guess)
+    {
+        g_free(key);
+        return type;
+    }
+
+    type = g_content_type_guess(base_name, NULL, 0, uncertain);
+    if (key)
+    {
+        g_rw_lock_writer_lock(&name_guess_lock);
+        if (name_guesses)
+        {
+            if (g_hash_table_size(name_guesses) >= NAME_GUESS_MAX_ENTRIES)
+                g_hash_table_remove_all(name_guesses);
+            guess = g_slice_new(NameGuess);
+            guess->type = g_strdup(type);
+            guess->uncertain = *uncertain;
+            g_hash_table_replace(name_guesses, key, guess);
+            key = NULL;
+        }
+        g_rw_lock_writer_unlock(&name_guess_lock);
+        g_free(key);
+    }
+    return type;
+}
+
 void _fm_mime_type_init()
 {
-    mime_hash = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                       NULL, fm_mime_type_unref);
+    mime_table = g_malloc0(sizeof(FmMimeTable) + MIME_TABLE_INITIAL_SIZE * sizeof(FmMimeType *));
+    mime_table->size = MIME_TABLE_INITIAL_SIZE;
 
     /* Preallocated to save hash table lookup. */
     inode_directory_type = fm_mime_type_from_name("inode/directory");
@@ -115,7 +403,26 @@ void _fm_mime_type_finalize()
     fm_mime_type_unref(mountable_type);
     fm_mime_type_unref(shortcut_type);
 
-    g_hash_table_destroy(mime_hash);
+    if (content_read_pool)
+    {
+        g_thread_pool_free(content_read_pool, FALSE, TRUE);
+        content_read_pool = NULL;
+    }
+    _fm_content_type_cache_finalize();
+    _name_guess_cache_finalize();
+
+    {
+        FmMimeTable * table = mime_table, * replaced;
+        guint i;
+        for (i = 0; i < table->size; i++)
+            fm_mime_type_unref(table->slots[i]);
+        for (; table; table = replaced)
+        {
+            replaced = table->replaced;
+            g_free(table);
+        }
+        mime_table = NULL;
+    }
 }
 
 /**
@@ -135,7 +442,7 @@ FmMimeType* fm_mime_type_from_file_name(const char* ufile_name)
     FmMimeType* mime_type;
     char * type;
     gboolean uncertain;
-    type = g_content_type_guess(ufile_name, NULL, 0, &uncertain);
+    type = _content_type_guess_by_name(ufile_name, &uncertain);
     mime_type = fm_mime_type_from_name(type);
     g_free(type);
     return mime_type;
@@ -143,6 +450,8 @@ FmMimeType* fm_mime_type_from_file_name(const char* ufile_name)
 
 /*****************************************************************************/
 
+#define CONTENT_HEAD_SIZE 4096 /* bytes read to guess the type by content */
+
 #define HAS_PREFIX(buf, prefix) (memcmp(buf, prefix, sizeof(prefix) - 1) == 0)
 
 static
@@ -229,26 +538,238 @@ gchar * _fast_content_type_guess(const char * base_name, const guchar * buf, gui
 
 #undef HAS_PREFIX
 
-static
-gchar * _guess_content_for_regular_file(const char* file_path, const char* base_name, struct stat* pstat)
+/*****************************************************************************/
+
+/* Magic numbers of the formats most files are in.
+ *
+ * g_content_type_guess() tries all the magic rules of the shared-mime-info
+ * database for each file. Most files are in one of a few dozens of
+ * formats, which are recognized here by their first bytes, with the
+ * entries indexed by the first byte of the magic.
+ *
+ * Type names differ between versions of the database, and it may lack
+ * some formats. So the table has no names: on first use, each entry's
+ * sample, a minimal header of the format, is given to GIO, and the entry
+ * gets the type GIO tells. Entries GIO doesn't recognize are disabled.
+ *
+ * This is used only when no glob matched the name. GIO chooses among the
+ * types matched by name using the content, which the table can't do.
+ * Containers which can hold more specific formats are checked, so
+ * what GIO knows by the content is left to GIO. */
+
+typedef struct
+{
+    guint offset;           /* of the magic */
+    const char * magic;
+    guint magic_len;
+    guint offset2;          /* of the second magic, if any */
+    const char * magic2;
+    guint magic2_len;
+    gboolean (*check)(const guchar * buf, gsize len);
+    const char * type;      /* filled on first use, NULL if disabled */
+} MagicEntry;
+
+#define MAGIC(s) s, sizeof(s) - 1
+#define NO_MAGIC2 0, NULL, 0
+
+/* ZIP files named by their first member are ODF, EPUB, OOXML, JAR... */
+static gboolean check_plain_zip(const guchar * buf, gsize len)
+{
+    static const char * const markers[] = {
+        "mimetype", "[Content_Types]", "_rels/", "docProps/", "word/", "xl/", "ppt/", "META-INF/"
+    };
+    guint name_len, i;
+
+    if (len < 30)
+        return FALSE;
+    name_len = buf[26] | (buf[27] << 8);
+    if (len < 30 + name_len)
+        return FALSE;
+    for (i = 0; i < G_N_ELEMENTS(markers); i++)
+    {
+        gsize marker_len = strlen(markers[i]);
+        if (name_len >= marker_len && memcmp(buf + 30, markers[i], marker_len) == 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean find_in_head(const guchar * buf, gsize len, const char * what, gsize limit)
 {
-    gchar * type1 = NULL;
-    gchar * type2 = NULL;
+    gsize what_len = strlen(what);
+    gsize i;
+
+    len = MIN(len, limit);
+    for (i = 0; i + what_len <= len; i++)
+        if (memcmp(buf + i, what, what_len) == 0)
+            return TRUE;
+    return FALSE;
+}
+
+/* the EBML header tells the document type */
+static gboolean check_matroska(const guchar * buf, gsize len)
+{
+    return find_in_head(buf, len, "\x42\x82\x88matroska", 64);
+}
+
+static gboolean check_webm(const guchar * buf, gsize len)
+{
+    return find_in_head(buf, len, "\x42\x82\x84webm", 64);
+}
+
+static MagicEntry magic_entries[] =
+{
+    /* images */
+    { 0, MAGIC("\x89PNG\r\n\x1a\n"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("\xff\xd8\xff"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("GIF87a"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("GIF89a"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("II*\0"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("MM\0*"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("RIFF"), 8, MAGIC("WEBP"), NULL, NULL },
+    { 0, MAGIC("8BPS\0\1"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("gimp xcf "), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("\x76\x2f\x31\x01"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("\0\0\0\x0cjP  \r\n\x87\n"), NO_MAGIC2, NULL, NULL },
+    { 4, MAGIC("ftyp"), 8, MAGIC("heic"), NULL, NULL },
+    { 4, MAGIC("ftyp"), 8, MAGIC("avif"), NULL, NULL },
+    /* documents and data */
+    { 0, MAGIC("%PDF-"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("SQLite format 3\0"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("wOFF"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("wOF2"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("OTTO"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("\0asm"), NO_MAGIC2, NULL, NULL },
+    /* archives and compressed files */
+    { 0, MAGIC("PK\x03\x04"), NO_MAGIC2, check_plain_zip, NULL },
+    { 0, MAGIC("\x1f\x8b"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("BZh"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("\xfd" "7zXZ\0"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("\x28\xb5\x2f\xfd"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("7z\xbc\xaf\x27\x1c"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("Rar!\x1a\x07"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("\x04\x22\x4d\x18"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("LZIP"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("MSCF\0\0\0\0"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("\xed\xab\xee\xdb"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("!<arch>\ndebian-binary"), NO_MAGIC2, NULL, NULL },
+    /* audio */
+    { 0, MAGIC("fLaC"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("ID3"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("OggS"), 28, MAGIC("\x01vorbis"), NULL, NULL },
+    { 0, MAGIC("OggS"), 28, MAGIC("OpusHead"), NULL, NULL },
+    { 0, MAGIC("OggS"), 28, MAGIC("\x7f" "FLAC"), NULL, NULL },
+    { 0, MAGIC("OggS"), 28, MAGIC("\x80theora"), NULL, NULL },
+    { 0, MAGIC("RIFF"), 8, MAGIC("WAVE"), NULL, NULL },
+    { 0, MAGIC("FORM"), 8, MAGIC("AIFF"), NULL, NULL },
+    { 0, MAGIC("MThd"), NO_MAGIC2, NULL, NULL },
+    { 4, MAGIC("ftyp"), 8, MAGIC("M4A "), NULL, NULL },
+    /* video */
+    { 4, MAGIC("ftyp"), 8, MAGIC("isom"), NULL, NULL },
+    { 4, MAGIC("ftyp"), 8, MAGIC("mp41"), NULL, NULL },
+    { 4, MAGIC("ftyp"), 8, MAGIC("mp42"), NULL, NULL },
+    { 4, MAGIC("ftyp"), 8, MAGIC("qt  "), NULL, NULL },
+    { 4, MAGIC("ftyp"), 8, MAGIC("3gp4"), NULL, NULL },
+    { 4, MAGIC("ftyp"), 8, MAGIC("3gp5"), NULL, NULL },
+    { 0, MAGIC("\x1a\x45\xdf\xa3"), NO_MAGIC2, check_matroska, NULL },
+    { 0, MAGIC("\x1a\x45\xdf\xa3"), NO_MAGIC2, check_webm, NULL },
+    { 0, MAGIC("RIFF"), 8, MAGIC("AVI "), NULL, NULL },
+    { 0, MAGIC("FLV\x01"), NO_MAGIC2, NULL, NULL },
+    { 0, MAGIC("\0\0\x01\xba"), NO_MAGIC2, NULL, NULL },
+};
+
+#undef MAGIC
+#undef NO_MAGIC2
+
+#define MAGIC_SAMPLE_SIZE 128
+
+/* entries with the magic at 0 by its first byte, then the others */
+static guint8 magic_order[G_N_ELEMENTS(magic_entries)];
+static guint8 magic_bucket[258]; /* start of the entries in magic_order */
+
+static gboolean magic_entry_matches(const MagicEntry * entry, const guchar * buf, gsize len)
+{
+    if (len < entry->offset + entry->magic_len ||
+        memcmp(buf + entry->offset, entry->magic, entry->magic_len) != 0)
+        return FALSE;
+    if (entry->magic2 && (len < entry->offset2 + entry->magic2_len ||
+        memcmp(buf + entry->offset2, entry->magic2, entry->magic2_len) != 0))
+        return FALSE;
+    return !entry->check || entry->check(buf, len);
+}
 
-    { /* guess by name */
+static gpointer magic_init(gpointer unused)
+{
+    guint i, b, n = 0;
+
+    for (i = 0; i < G_N_ELEMENTS(magic_entries); i++)
+    {
+        MagicEntry * entry = &magic_entries[i];
+        guchar sample[MAGIC_SAMPLE_SIZE];
         gboolean uncertain;
-        type1 = g_content_type_guess(base_name, NULL, 0, &uncertain);
-        if(!uncertain)
-            goto end;
+        gchar * type;
+
+        memset(sample, 0, sizeof(sample));
+        memcpy(sample + entry->offset, entry->magic, entry->magic_len);
+        if (entry->magic2)
+            memcpy(sample + entry->offset2, entry->magic2, entry->magic2_len);
+        if (entry->check == check_plain_zip)
+        {
+            sample[26] = 5;
+            memcpy(sample + 30, "a.txt", 5);
+        }
+        else if (entry->check == check_matroska)
+            memcpy(sample + 5, "\x42\x82\x88matroska", 11);
+        else if (entry->check == check_webm)
+            memcpy(sample + 5, "\x42\x82\x84webm", 7);
+
+        type = g_content_type_guess(NULL, sample, sizeof(sample), &uncertain);
+        if (!uncertain && !g_content_type_is_unknown(type) && magic_entry_matches(entry, sample, sizeof(sample)))
+            entry->type = g_intern_string(type);
+        g_free(type);
     }
 
-    /* treat an empty file as text/plain  */
-    if (pstat->st_size == 0)
+    /* counting sort by the first byte, entries with the magic farther go last */
+    for (b = 0; b < 257; b++)
     {
-        type2 = g_strdup("text/plain");
-        goto end;
+        magic_bucket[b] = n;
+        for (i = 0; i < G_N_ELEMENTS(magic_entries); i++)
+        {
+            const MagicEntry * entry = &magic_entries[i];
+            guint key = entry->offset == 0 ? (guchar) entry->magic[0] : 256;
+            if (key == b && entry->type)
+                magic_order[n++] = i;
+        }
     }
+    magic_bucket[257] = n;
+    return NULL;
+}
+
+/* Returns the type GIO would tell by the content, or NULL if not sure. */
+static const char * _magic_content_type_guess(const guchar * buf, gsize len)
+{
+    static GOnce once = G_ONCE_INIT;
+    guint i, end;
+
+    g_once(&once, magic_init, NULL);
 
+    if (len == 0)
+        return NULL;
+    end = magic_bucket[buf[0] + 1];
+    for (i = magic_bucket[buf[0]]; i < end; i++)
+        if (magic_entry_matches(&magic_entries[magic_order[i]], buf, len))
+            return magic_entries[magic_order[i]].type;
+    /* the magic is farther */
+    for (i = magic_bucket[256]; i < magic_bucket[257]; i++)
+        if (magic_entry_matches(&magic_entries[magic_order[i]], buf, len))
+            return magic_entries[magic_order[i]].type;
+    return NULL;
+}
+
+/* Reads the head of the file, returns its length or -1. */
+static gssize _read_file_head(const char* file_path, const struct stat* pstat, char* buf)
+{
+    gssize len = -1;
     int fd = open(file_path, O_RDONLY);
     if(fd >= 0)
     {
@@ -261,30 +782,240 @@ gchar * _guess_content_for_regular_file(const char* file_path, const char* base_
          * processes or I/O errors happen, we may receive SIGBUS.
          * It's a pity that we cannot use mmap for speed up here. */
 
-        char buf[4097];
-        ssize_t len = read(fd, buf, MIN(pstat->st_size, 4096));
+        len = read(fd, buf, MIN(pstat->st_size, CONTENT_HEAD_SIZE));
+        close(fd);
+    }
+    if (len >= 0)
         buf[len] = 0;
+    return len;
+}
 
-        type2 = _fast_content_type_guess(base_name, (guchar*)buf, len, pstat);
-        if (!type2)
-            type2 = g_content_type_guess(base_name, (guchar*)buf, len, NULL);
+/* Guesses by name. Returns NULL if the content is to be read. */
+static gchar * _guess_content_by_name(const char* base_name, const struct stat* pstat, gchar** by_name)
+{
+    gboolean uncertain;
 
-        close(fd);
-    }
+    *by_name = _content_type_guess_by_name(base_name, &uncertain);
+    if(!uncertain)
+        return *by_name;
 
-end:
-    if (type2)
+    /* treat an empty file as text/plain  */
+    if (pstat->st_size == 0)
     {
-        g_free(type1);
-        type1 = type2;
+        g_free(*by_name);
+        return g_strdup("text/plain");
     }
+    return NULL;
+}
 
-    return type1;
+static gchar * _guess_content_by_head(const char* base_name, char* buf, gssize len,
+                                      struct stat* pstat, gchar* by_name)
+{
+    gchar * type;
+
+    if (len < 0)
+        return by_name;
+
+    type = _fast_content_type_guess(base_name, (guchar*)buf, len, pstat);
+    if (!type && g_content_type_is_unknown(by_name))
+    {
+        const char * magic_type = _magic_content_type_guess((guchar*)buf, len);
+        if (magic_type)
+            type = g_strdup(magic_type);
+    }
+    if (!type)
+        type = g_content_type_guess(base_name, (guchar*)buf, len, NULL);
+    g_free(by_name);
+    return type;
 }
 
+static
+gchar * _guess_content_for_regular_file(const char* file_path, const char* base_name, struct stat* pstat)
+{
+    gchar * by_name;
+    gchar * type = _guess_content_by_name(base_name, pstat, &by_name);
+    char buf[CONTENT_HEAD_SIZE + 1];
+    gssize len;
+
+    if (type)
+        return type;
+
+    type = _fm_content_type_cache_lookup(pstat);
+    if (type)
+    {
+        g_free(by_name);
+        return type;
+    }
+
+    len = _read_file_head(file_path, pstat, buf);
+    type = _guess_content_by_head(base_name, buf, len, pstat, by_name);
+    if (len >= 0)
+        _fm_content_type_cache_insert(pstat, type);
+    return type;
+}
 
 /*****************************************************************************/
 
+/* Files whose type can't be guessed by name are read by a pool of
+ * threads, so requests for all of them are in flight at once. It is
+ * what makes listing a folder of such files on a network mount fast:
+ * the time is spent waiting for replies, not reading. */
+
+#define CONTENT_READ_THREADS 8
+
+typedef struct
+{
+    GMutex mutex;
+    GCond cond;
+    guint pending;
+} ContentReadBatch;
+
+typedef struct
+{
+    ContentReadBatch * batch;
+    FmMimeTypeNativeFile * file;
+    gchar * by_name;
+    gchar * cached;   /* the type found in the cache */
+    struct stat st;   /* the key of the cache, st_ino is 0 if unknown */
+    char * buf;
+    gssize len;
+} ContentRead;
+
+/* Files of the batch have only the type and the size known, the complete
+ * stat() is done here, with the read, to look the file up in the cache. */
+static void content_read(ContentRead * read)
+{
+    FmMimeTypeNativeFile * file = read->file;
+
+    if (stat(file->file_path, &read->st) == 0 && S_ISREG(read->st.st_mode))
+    {
+        read->cached = _fm_content_type_cache_lookup(&read->st);
+        if (read->cached)
+            return;
+    }
+    else
+        read->st.st_ino = 0;
+    read->len = _read_file_head(file->file_path, file->pstat, read->buf);
+}
+
+static void content_read_func(gpointer data, gpointer user_data)
+{
+    ContentRead * read = data;
+    ContentReadBatch * batch = read->batch;
+
+    content_read(read);
+
+    g_mutex_lock(&batch->mutex);
+    if (--batch->pending == 0)
+        g_cond_signal(&batch->cond);
+    g_mutex_unlock(&batch->mutex);
+}
+
+static GThreadPool * get_content_read_pool(void)
+{
+    GThreadPool * pool;
+
+    G_LOCK(content_read_pool);
+    if (!content_read_pool)
+        content_read_pool = g_thread_pool_new(content_read_func, NULL,
+                                              CONTENT_READ_THREADS, FALSE, NULL);
+    pool = content_read_pool;
+    G_UNLOCK(content_read_pool);
+    return pool;
+}
+
+/* Finds MIME types of @n_files files, like fm_mime_type_from_native_file()
+ * does for each of them, reading the files at once. Files of a rotating
+ * disk should be read one after another, as listed, with @sequential. */
+void _fm_mime_type_from_native_files(FmMimeTypeNativeFile * files, guint n_files, gboolean sequential)
+{
+    ContentRead * reads = g_new0(ContentRead, n_files);
+    ContentReadBatch batch;
+    GThreadPool * pool = NULL;
+    char * bufs;
+    guint i, n_reads = 0;
+
+    for (i = 0; i < n_files; i++)
+    {
+        FmMimeTypeNativeFile * file = &files[i];
+        gchar * type;
+
+        if (!S_ISREG(file->pstat->st_mode))
+        {
+            file->mime_type = fm_mime_type_from_native_file(file->file_path, file->base_name, file->pstat);
+            continue;
+        }
+        type = _guess_content_by_name(file->base_name, file->pstat, &reads[n_reads].by_name);
+        if (type)
+        {
+            file->mime_type = fm_mime_type_from_name(type);
+            g_free(type);
+            continue;
+        }
+        reads[n_reads].file = file;
+        reads[n_reads].len = -1;
+        n_reads++;
+    }
+    if (n_reads == 0)
+    {
+        g_free(reads);
+        return;
+    }
+
+    bufs = g_malloc(n_reads * (CONTENT_HEAD_SIZE + 1));
+    for (i = 0; i < n_reads; i++)
+        reads[i].buf = bufs + i * (CONTENT_HEAD_SIZE + 1);
+
+    if (!sequential && n_reads > 1)
+        pool = get_content_read_pool();
+    if (pool)
+    {
+        g_mutex_init(&batch.mutex);
+        g_cond_init(&batch.cond);
+        batch.pending = n_reads;
+        for (i = 0; i < n_reads; i++)
+        {
+            reads[i].batch = &batch;
+            g_thread_pool_push(pool, &reads[i], NULL);
+        }
+        g_mutex_lock(&batch.mutex);
+        while (batch.pending)
+            g_cond_wait(&batch.cond, &batch.mutex);
+        g_mutex_unlock(&batch.mutex);
+        g_cond_clear(&batch.cond);
+        g_mutex_clear(&batch.mutex);
+    }
+    else
+    {
+        for (i = 0; i < n_reads; i++)
+            content_read(&reads[i]);
+    }
+
+    for (i = 0; i < n_reads; i++)
+    {
+        FmMimeTypeNativeFile * file = reads[i].file;
+        gchar * type;
+
+        if (reads[i].cached)
+        {
+            type = reads[i].cached;
+            g_free(reads[i].by_name);
+        }
+        else
+        {
+            type = _guess_content_by_head(file->base_name, reads[i].buf, reads[i].len,
+                                          file->pstat, reads[i].by_name);
+            if (reads[i].len >= 0)
+                _fm_content_type_cache_insert(&reads[i].st, type);
+        }
+        file->mime_type = fm_mime_type_from_name(type);
+        g_free(type);
+    }
+
+    g_free(bufs);
+    g_free(reads);
+}
+
 /**
  * fm_mime_type_from_native_file
  * @file_path: full path to file
@@ -344,6 +1075,32 @@ FmMimeType* fm_mime_type_from_native_file(const char* file_path,
     return fm_mime_type_from_name("application/octet-stream");
 }
 
+static FmMimeType * mime_table_lookup(FmMimeTable * table, const char * type, guint hash)
+{
+    guint mask = table->size - 1;
+    guint i;
+    FmMimeType * mime_type;
+
+    for (i = hash & mask; (mime_type = g_atomic_pointer_get(&table->slots[i])); i = (i + 1) & mask)
+    {
+        if (mime_type->hash == hash && strcmp(mime_type->type, type) == 0)
+            return mime_type;
+    }
+    return NULL;
+}
+
+/* should be called with mime_table_mutex locked */
+static void mime_table_add(FmMimeTable * table, FmMimeType * mime_type)
+{
+    guint mask = table->size - 1;
+    guint i;
+
+    for (i = mime_type->hash & mask; table->slots[i]; i = (i + 1) & mask);
+    /* this is a full barrier, the type is seen filled */
+    g_atomic_pointer_set(&table->slots[i], mime_type);
+    table->n_types++;
+}
+
 /**
  * fm_mime_type_from_name
  * @type: MIME type name
@@ -358,18 +1115,84 @@ FmMimeType* fm_mime_type_from_native_file(const char* file_path,
  */
 FmMimeType* fm_mime_type_from_name(const char* type)
 {
+    guint hash = g_str_hash(type);
+    FmMimeTable * table;
     FmMimeType * mime_type;
 
-    G_LOCK(mime_hash);
-    mime_type = g_hash_table_lookup(mime_hash, type);
+    mime_type = mime_table_lookup(g_atomic_pointer_get(&mime_table), type, hash);
+    if (G_LIKELY(mime_type))
+        return fm_mime_type_ref(mime_type);
+
+    g_mutex_lock(&mime_table_mutex);
+    table = mime_table;
+    mime_type = mime_table_lookup(table, type, hash);
     if (!mime_type)
     {
+        /* keep it at most half full so probes are short */
+        if ((table->n_types + 1) * 2 > table->size)
+        {
+            FmMimeTable * bigger = g_malloc0(sizeof(FmMimeTable) + table->size * 2 * sizeof(FmMimeType *));
+            guint i;
+            bigger->size = table->size * 2;
+            bigger->replaced = table;
+            for (i = 0; i < table->size; i++)
+                if (table->slots[i])
+                    mime_table_add(bigger, table->slots[i]);
+            g_atomic_pointer_set(&mime_table, bigger);
+            table = bigger;
+        }
         mime_type = fm_mime_type_new(type);
-        g_hash_table_insert(mime_hash, mime_type->type, mime_type);
+        mime_table_add(table, mime_type);
     }
-    G_UNLOCK(mime_hash);
-    fm_mime_type_ref(mime_type);
-    return mime_type;
+    g_mutex_unlock(&mime_table_mutex);
+    return fm_mime_type_ref(mime_type);
+}
+
+/* archives and compressed files have no common parent type */
+static const char * const archive_types[] = {
+    "application/x-archive", "application/x-tar", "application/x-compressed-tar",
+    "application/x-bzip-compressed-tar", "application/x-xz-compressed-tar",
+    "application/x-zstd-compressed-tar", "application/zip", "application/x-7z-compressed",
+    "application/vnd.rar", "application/x-rar", "application/x-cpio", "application/x-cd-image",
+    "application/vnd.ms-cab-compressed", "application/x-lzip", "application/x-lz4",
+    "application/gzip", "application/x-gzip", "application/x-bzip", "application/x-bzip2",
+    "application/x-xz", "application/x-lzma", "application/zstd", "application/x-compress",
+    "application/vnd.debian.binary-package", "application/x-rpm"
+};
+
+/* Predicates on files are checked for each file on each redraw. Walking
+ * the subclass hierarchy is done once here instead. */
+static FmMimeTypeClasses mime_type_classes(const char * type)
+{
+    FmMimeTypeClasses classes = 0;
+    guint i;
+
+    if (g_content_type_is_unknown(type))
+        classes |= FM_MIME_TYPE_CLASS_UNKNOWN;
+    if (g_content_type_is_a(type, "text/plain"))
+        classes |= FM_MIME_TYPE_CLASS_TEXT;
+    if (g_str_has_prefix(type, "image/"))
+        classes |= FM_MIME_TYPE_CLASS_IMAGE;
+    else if (g_str_has_prefix(type, "audio/"))
+        classes |= FM_MIME_TYPE_CLASS_AUDIO;
+    else if (g_str_has_prefix(type, "video/"))
+        classes |= FM_MIME_TYPE_CLASS_VIDEO;
+    /* g_content_type_can_be_executable() reports text files as executables too */
+    if (g_str_has_prefix(type, "text/"))
+        classes |= FM_MIME_TYPE_CLASS_SCRIPT;
+    else if (g_content_type_can_be_executable(type))
+        classes |= FM_MIME_TYPE_CLASS_EXECUTABLE;
+    if (strcmp(type, "application/x-desktop") == 0)
+        classes |= FM_MIME_TYPE_CLASS_DESKTOP_ENTRY;
+    for (i = 0; i < G_N_ELEMENTS(archive_types); i++)
+    {
+        if (g_content_type_is_a(type, archive_types[i]))
+        {
+            classes |= FM_MIME_TYPE_CLASS_ARCHIVE;
+            break;
+        }
+    }
+    return classes;
 }
 
 /**
@@ -386,6 +1209,8 @@ FmMimeType* fm_mime_type_new(const char* type_name)
 {
     FmMimeType * mime_type = g_slice_new0(FmMimeType);
     mime_type->type = g_strdup(type_name);
+    mime_type->hash = g_str_hash(type_name);
+    mime_type->classes = mime_type_classes(type_name);
     mime_type->n_ref = 1;
 
     return mime_type;
@@ -509,6 +1334,22 @@ const char* fm_mime_type_get_type(FmMimeType* mime_type)
     return mime_type ? mime_type->type : NULL;
 }
 
+/**
+ * fm_mime_type_get_classes
+ * @mime_type: a #FmMimeType descriptor
+ *
+ * Retrieves the classes @mime_type belongs to. They are computed when
+ * the descriptor is created, so the call is cheap.
+ *
+ * Returns: the classes, 0 for %NULL.
+ *
+ * Since: 1.2.0
+ */
+FmMimeTypeClasses fm_mime_type_get_classes(FmMimeType* mime_type)
+{
+    return mime_type ? mime_type->classes : 0;
+}
+
 /**
  * fm_mime_type_get_thumbnailers
  * @mime_type: a #FmMimeType descriptor
@@ -33,6 +33,35 @@ G_BEGIN_DECLS
 
 typedef struct _FmMimeType FmMimeType;
 
+/**
+ * FmMimeTypeClasses:
+ * @FM_MIME_TYPE_CLASS_TEXT: a kind of text/plain
+ * @FM_MIME_TYPE_CLASS_IMAGE: an image/ type
+ * @FM_MIME_TYPE_CLASS_AUDIO: an audio/ type
+ * @FM_MIME_TYPE_CLASS_VIDEO: a video/ type
+ * @FM_MIME_TYPE_CLASS_ARCHIVE: an archive or a compressed file
+ * @FM_MIME_TYPE_CLASS_EXECUTABLE: a binary or another file that can be
+ * executed, except text ones
+ * @FM_MIME_TYPE_CLASS_SCRIPT: a text/ type, which can be executed if the
+ * file starts with "#!"
+ * @FM_MIME_TYPE_CLASS_UNKNOWN: the type of the content is not known
+ * @FM_MIME_TYPE_CLASS_DESKTOP_ENTRY: application/x-desktop
+ *
+ * Classes the type belongs to, computed once when the type is created.
+ */
+typedef enum
+{
+    FM_MIME_TYPE_CLASS_TEXT = 1 << 0,
+    FM_MIME_TYPE_CLASS_IMAGE = 1 << 1,
+    FM_MIME_TYPE_CLASS_AUDIO = 1 << 2,
+    FM_MIME_TYPE_CLASS_VIDEO = 1 << 3,
+    FM_MIME_TYPE_CLASS_ARCHIVE = 1 << 4,
+    FM_MIME_TYPE_CLASS_EXECUTABLE = 1 << 5,
+    FM_MIME_TYPE_CLASS_SCRIPT = 1 << 6,
+    FM_MIME_TYPE_CLASS_UNKNOWN = 1 << 7,
+    FM_MIME_TYPE_CLASS_DESKTOP_ENTRY = 1 << 8
+} FmMimeTypeClasses;
+
 void _fm_mime_type_init();
 
 void _fm_mime_type_finalize();
@@ -46,6 +75,18 @@ FmMimeType* fm_mime_type_from_native_file(const char* file_path,  /* Should be o
 
 FmMimeType* fm_mime_type_from_name(const char* type);
 
+/* a file for _fm_mime_type_from_native_files() */
+typedef struct _FmMimeTypeNativeFile FmMimeTypeNativeFile;
+struct _FmMimeTypeNativeFile
+{
+    const char* file_path;
+    const char* base_name;
+    struct stat* pstat;     /* only st_mode and st_size are used */
+    FmMimeType* mime_type;  /* the result */
+};
+
+void _fm_mime_type_from_native_files(FmMimeTypeNativeFile* files, guint n_files, gboolean sequential);
+
 FmMimeType* _fm_mime_type_get_inode_directory();
 FmMimeType* _fm_mime_type_get_inode_x_shortcut();
 FmMimeType* _fm_mime_type_get_inode_x_mountable();
@@ -59,6 +100,8 @@ FmIcon* fm_mime_type_get_icon(FmMimeType* mime_type);
 /* Get mime-type string */
 const char* fm_mime_type_get_type(FmMimeType* mime_type);
 
+FmMimeTypeClasses fm_mime_type_get_classes(FmMimeType* mime_type);
+
 /* Get human-readable description of mime-type */
 const char* fm_mime_type_get_desc(FmMimeType* mime_type);
 
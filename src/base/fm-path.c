@@ -33,6 +33,8 @@
 #endif
 
 #include "fm-path.h"
+#include "fm-symbol.h"
+#include "fm-slab.h"
 #include "fm-file-info.h"
 #include "fm-file.h"
 #include "fm-utils.h"
@@ -44,9 +46,13 @@
 struct _FmPath
 {
     gint n_ref;
+    guint hash; /* value of fm_path_hash(), computed on creation */
     FmPath* parent;
-    guchar flags; /* FmPathFlags flags : 8; */
+    FmPath* next; /* next path in the same bucket of the interning table */
+    FmSymbol* str; /* cached fm_path_to_str() of a directory, see _fm_path_cache_str() */
+    int depth; /* value of fm_path_depth(), computed on creation */
     int name_len;
+    guchar flags; /* FmPathFlags flags : 8; */
     char name[1]; /* basename: in local encoding if native, uri-escaped otherwise */
 };
 
@@ -72,45 +78,317 @@ static FmPath* network_root = NULL;*/
 static FmPath* apps_root_path = NULL;
 static FmPath* computer_root_path = NULL;
 
-static GSList* roots = NULL;
-G_LOCK_DEFINE(roots);
+/* Registry of root paths like sftp://user@host/, keyed by scheme and
+ * authority. It's an open addressing table which is read without locking:
+ * new roots are published with an atomic store into an empty slot, and
+ * when the table grows a new copy replaces it while the old one is kept
+ * until _fm_path_finalize() since readers may still use it. The registry
+ * holds a reference on each root so they never go away while libfm is
+ * running; there are only as many of them as hosts the user visits. */
+typedef struct
+{
+    guint n_slots; /* power of 2 */
+    guint n_items;
+    FmPath* slots[1];
+} FmPathRootTable;
+
+#define ROOT_TABLE_MIN_SLOTS 16
+
+static FmPathRootTable* roots = NULL;
+static GSList* retired_roots = NULL;
+G_LOCK_DEFINE_STATIC(roots);
+
+/* A root which is a whole URI, like mailto:someone@somewhere.net, is not
+ * put into the registry since there are as many of them as addresses.
+ * It's interned like other paths instead and released with the last
+ * reference. */
+#define FM_PATH_IN_TABLE FM_PATH_IS_RESERVED3
 
 /*****************************************************************************/
 
 int path_total;
 int path_bytes_total;
 
+/*****************************************************************************/
+
+/* Interning table.
+ *
+ * Every non-root path is registered in a table keyed by (parent, name), so
+ * there is at most one FmPath object for any path at a time. Since parents
+ * are interned as well, two paths are equal only if they are the same object.
+ * The table is split into shards with a mutex each, so job threads creating
+ * paths in different directories don't wait for each other. Buckets are
+ * chained through FmPath::next to avoid a separate node per entry. */
+
+#define PATH_TABLE_N_SHARDS 16 /* should match the shift in _fm_path_get_shard() */
+#define PATH_TABLE_MIN_BUCKETS 64
+
+typedef struct
+{
+    GMutex mutex;
+    FmPath** buckets;
+    guint n_buckets;
+    guint n_items;
+} FmPathTableShard;
+
+static FmPathTableShard path_table[PATH_TABLE_N_SHARDS];
+
+/* calculates the value returned by fm_path_hash() for the new path */
+static inline guint _fm_path_compute_hash(FmPath* parent, const char* name, int name_len)
+{
+    const signed char* p = (const signed char*)name;
+    const signed char* name_end = p + name_len;
+    guint hash = 5381;
+
+    /* the same as g_str_hash() but doesn't need terminated string */
+    for(; p < name_end; ++p)
+        hash = (hash << 5) + hash + *p;
+    if(parent)
+    {
+        /* this is learned from g_str_hash() of glib. */
+        hash = (hash << 5) - hash + '/';
+        /* this is learned from g_icon_hash() of gio. */
+        hash ^= parent->hash;
+    }
+    return hash;
+}
+
+/* mixes the bits of the path hash so both the shard (upper bits)
+ * and the bucket (lower bits) indexes are well distributed */
+static inline guint _fm_path_table_key(guint hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static inline FmPathTableShard* _fm_path_get_shard(guint key)
+{
+    return &path_table[key >> 28];
+}
+
+static void _fm_path_table_resize(FmPathTableShard* shard, guint n_buckets)
+{
+    FmPath** buckets = g_new0(FmPath*, n_buckets);
+    FmPath* path, *next;
+    guint i;
+
+    for(i = 0; i < shard->n_buckets; ++i)
+    {
+        for(path = shard->buckets[i]; path; path = next)
+        {
+            FmPath** bucket = &buckets[_fm_path_table_key(path->hash) & (n_buckets - 1)];
+            next = path->next;
+            path->next = *bucket;
+            *bucket = path;
+        }
+    }
+    g_free(shard->buckets);
+    shard->buckets = buckets;
+    shard->n_buckets = n_buckets;
+}
+
+/* should be called with shard->mutex locked */
+static void _fm_path_table_remove(FmPathTableShard* shard, FmPath* path)
+{
+    FmPath** link = &shard->buckets[_fm_path_table_key(path->hash) & (shard->n_buckets - 1)];
+
+    while(*link != path)
+        link = &(*link)->next;
+    *link = path->next;
+    path->next = NULL;
+    --shard->n_items;
+    /* give memory back after a big folder has been torn down */
+    if(shard->n_buckets > PATH_TABLE_MIN_BUCKETS && shard->n_items < shard->n_buckets / 8)
+        _fm_path_table_resize(shard, shard->n_buckets / 2);
+}
+
 void fm_log_memory_usage_for_path(void)
 {
-    g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "memory usage: FmPath: %d items, %d KiB",
-        g_atomic_int_get(&path_total), g_atomic_int_get(&path_bytes_total) / 1024);
+    int i, table_bytes = 0;
+
+    for(i = 0; i < PATH_TABLE_N_SHARDS; ++i)
+        table_bytes += g_atomic_int_get((gint*)&path_table[i].n_buckets) * sizeof(FmPath*);
+
+    g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "memory usage: FmPath: %d items, %d KiB, interning table %d KiB",
+        g_atomic_int_get(&path_total), g_atomic_int_get(&path_bytes_total) / 1024,
+        table_bytes / 1024);
 }
 
 /*****************************************************************************/
 
 
-static FmPath* _fm_path_alloc(FmPath* parent, int name_len, int flags)
+static FmPath* _fm_path_alloc(FmPath* parent, int name_len, int flags, guint hash)
 {
     g_atomic_int_inc(&path_total);
     g_atomic_int_add(&path_bytes_total, sizeof(FmPath) + name_len);
 
     FmPath* path;
-    path = (FmPath*)g_malloc(sizeof(FmPath) + name_len);
+    path = (FmPath*)_fm_slab_alloc(sizeof(FmPath) + name_len);
     path->n_ref = 1;
     path->flags = flags;
     path->parent = parent ? fm_path_ref(parent) : NULL;
+    path->next = NULL;
+    path->str = NULL;
+    path->hash = hash;
+    path->depth = parent ? parent->depth + 1 : 1;
     path->name_len = name_len;
     return path;
 }
 
-static inline FmPath* _fm_path_new_internal(FmPath* parent, const char* name, int name_len, int flags)
+static void _fm_path_free(FmPath* path)
+{
+    g_atomic_int_add(&path_total, -1);
+    g_atomic_int_add(&path_bytes_total, -(sizeof(FmPath) + path->name_len));
+
+    if(G_LIKELY(path->parent))
+        fm_path_unref(path->parent);
+    if(path->str)
+        fm_symbol_unref(path->str);
+    _fm_slab_free(path, sizeof(FmPath) + path->name_len);
+}
+
+static inline FmPath* _fm_path_new_internal(FmPath* parent, const char* name, int name_len,
+                                            int flags, guint hash)
 {
-    FmPath* path = _fm_path_alloc(parent, name_len, flags);
+    FmPath* path = _fm_path_alloc(parent, name_len, flags, hash);
     memcpy(path->name, name, name_len);
     path->name[name_len] = '\0';
     return path;
 }
 
+/* Returns the existing path for (@parent, @name) or creates a new one.
+ * @hash and @key should be already calculated for the new path.
+ * Should be called with shard->mutex locked. */
+static FmPath* _fm_path_intern_locked(FmPathTableShard* shard, FmPath* parent,
+                                      const char* name, int name_len, int flags,
+                                      guint hash, guint key)
+{
+    FmPath* path;
+
+    if(G_LIKELY(shard->buckets))
+    {
+        for(path = shard->buckets[key & (shard->n_buckets - 1)]; path; path = path->next)
+        {
+            /* cheap checks go first so memcmp() is done only on a real match */
+            if(path->hash == hash && path->parent == parent &&
+               path->name_len == name_len && memcmp(path->name, name, name_len) == 0)
+            {
+                /* the last reference is only dropped with the lock held
+                 * so the path cannot be freed under our feet */
+                g_atomic_int_inc(&path->n_ref);
+                return path;
+            }
+        }
+    }
+    else
+        _fm_path_table_resize(shard, PATH_TABLE_MIN_BUCKETS);
+
+    path = _fm_path_new_internal(parent, name, name_len, flags, hash);
+    if(shard->n_items >= shard->n_buckets)
+        _fm_path_table_resize(shard, shard->n_buckets * 2);
+    path->next = shard->buckets[key & (shard->n_buckets - 1)];
+    shard->buckets[key & (shard->n_buckets - 1)] = path;
+    ++shard->n_items;
+    return path;
+}
+
+/* Returns the existing path for (@parent, @name) or creates a new one. */
+static FmPath* _fm_path_new_interned(FmPath* parent, const char* name, int name_len, int flags)
+{
+    guint hash = _fm_path_compute_hash(parent, name, name_len);
+    guint key = _fm_path_table_key(hash);
+    FmPathTableShard* shard = _fm_path_get_shard(key);
+    FmPath* path;
+
+    g_mutex_lock(&shard->mutex);
+    path = _fm_path_intern_locked(shard, parent, name, name_len, flags, hash, key);
+    g_mutex_unlock(&shard->mutex);
+    return path;
+}
+
+static FmPath* _fm_path_root_table_lookup(FmPathRootTable* table, const char* name,
+                                          int name_len, guint hash)
+{
+    guint mask, i;
+
+    if(G_UNLIKELY(!table))
+        return NULL;
+    mask = table->n_slots - 1;
+    for(i = _fm_path_table_key(hash) & mask; ; i = (i + 1) & mask)
+    {
+        FmPath* path = g_atomic_pointer_get(&table->slots[i]);
+        if(!path)
+            return NULL;
+        if(path->hash == hash && path->name_len == name_len &&
+           memcmp(path->name, name, name_len) == 0)
+            return path;
+    }
+}
+
+/* should be called with roots lock held, consumes the reference on @path */
+static void _fm_path_root_table_insert(FmPath* path)
+{
+    FmPathRootTable* table = roots;
+    guint mask, i;
+
+    if(!table || (table->n_items + 1) * 2 > table->n_slots)
+    {
+        /* readers may be walking the old table now, publish a grown copy */
+        guint n_slots = table ? table->n_slots * 2 : ROOT_TABLE_MIN_SLOTS;
+        FmPathRootTable* new_table = g_malloc0(sizeof(FmPathRootTable) + (n_slots - 1) * sizeof(FmPath*));
+        new_table->n_slots = n_slots;
+        if(table)
+        {
+            for(i = 0; i < table->n_slots; ++i)
+            {
+                FmPath* root = table->slots[i];
+                guint j;
+                if(!root)
+                    continue;
+                for(j = _fm_path_table_key(root->hash) & (n_slots - 1); new_table->slots[j];
+                    j = (j + 1) & (n_slots - 1));
+                new_table->slots[j] = root;
+            }
+            new_table->n_items = table->n_items;
+            retired_roots = g_slist_prepend(retired_roots, table);
+        }
+        g_atomic_pointer_set(&roots, new_table);
+        table = new_table;
+    }
+
+    mask = table->n_slots - 1;
+    for(i = _fm_path_table_key(path->hash) & mask; table->slots[i]; i = (i + 1) & mask);
+    ++table->n_items;
+    /* the path is complete by now, the store makes it visible to readers */
+    g_atomic_pointer_set(&table->slots[i], path);
+}
+
+/* Returns the existing root path with the @name or creates a new one. */
+static FmPath* _fm_path_new_root(const char* name, int name_len, int flags)
+{
+    guint hash = _fm_path_compute_hash(NULL, name, name_len);
+    FmPath* path;
+
+    path = _fm_path_root_table_lookup(g_atomic_pointer_get(&roots), name, name_len, hash);
+    if(G_LIKELY(path))
+        return fm_path_ref(path);
+
+    G_LOCK(roots);
+    /* it might have been added while we were waiting for the lock */
+    path = _fm_path_root_table_lookup(roots, name, name_len, hash);
+    if(!path)
+    {
+        path = _fm_path_new_internal(NULL, name, name_len, flags, hash);
+        _fm_path_root_table_insert(path);
+    }
+    G_UNLOCK(roots);
+    return fm_path_ref(path);
+}
+
 /**
  * _fm_path_new_uri_root
  * @uri: the uri in the form scheme://user@host/remaining/path
@@ -122,9 +400,7 @@ static inline FmPath* _fm_path_new_internal(FmPath* parent, const char* name, in
  */
 static FmPath* _fm_path_new_uri_root(const char* uri, int len, const char** remaining)
 {
-    FmPath* path;
-    GSList* l;
-    char* buf;
+    char* name, *buf;
     const char* uri_end = uri + len;
     const char* host;
     const char* host_end;
@@ -182,7 +458,7 @@ static FmPath* _fm_path_new_uri_root(const char* uri, int len, const char** rema
         /* is any special handling needed? */
         if(remaining)
             *remaining = uri_end;
-        return _fm_path_new_internal(NULL, uri, len, 0);
+        return _fm_path_new_interned(NULL, uri, len, FM_PATH_IN_TABLE);
     }
     else /* it's a normal remote URI */
     {
@@ -217,23 +493,7 @@ static FmPath* _fm_path_new_uri_root(const char* uri, int len, const char** rema
 
     /* it's reasonable to have double slashes :// for URIs other than mailto: */
     len = scheme_len + 3 + host_len + 1;
-    G_LOCK(roots);
-    for(l = roots; l; l = l->next)
-    {
-        path = l->data;
-        if(strncmp(path->name, uri, scheme_len) == 0 &&
-           (!host_len || !strncmp(&path->name[scheme_len + 3], host, host_len)) &&
-           strcmp(&path->name[len-1], "/") == 0)
-        {
-            fm_path_ref(path);
-            G_UNLOCK(roots);
-            return path;
-        }
-    }
-    path = _fm_path_alloc(NULL, len, flags);
-    roots = g_slist_append(roots, path);
-    G_UNLOCK(roots);
-    buf = path->name;
+    name = buf = g_alloca(len);
     memcpy(buf, uri, scheme_len); /* the scheme */
     buf += scheme_len;
     memcpy(buf, "://", 3); /* :// */
@@ -244,8 +504,7 @@ static FmPath* _fm_path_new_uri_root(const char* uri, int len, const char** rema
         buf += host_len;
     }
     buf[0] = '/'; /* the trailing / */
-    buf[1] = '\0';
-    return path;
+    return _fm_path_new_root(name, len, flags);
 
 on_error: /* this is not a valid URI */
     /* FIXME: should we return root or NULL? */
@@ -254,25 +513,80 @@ on_error: /* this is not a valid URI */
     return fm_path_ref(root_path);
 }
 
-#if 0
-static inline FmPath* _fm_path_reuse_existing_paths(FmPath* parent, const char* basename, int name_len)
+/* bytes which g_uri_escape_string(name, "/", TRUE) leaves as is: unreserved
+ * characters of RFC 3986 and '/'; bytes above 0x7f are not escaped only if
+ * they make a valid UTF-8 character, those are checked separately */
+static const guchar uri_child_safe[256] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0
+    /* the rest is 0 */
+};
+
+/* returns length of a valid UTF-8 character at @p or 0 */
+static inline int _fm_path_utf8_char_len(const guchar* p, const guchar* end)
+{
+    gunichar c = g_utf8_get_char_validated((const char*)p, end - p);
+    if(c == (gunichar)-1 || c == (gunichar)-2)
+        return 0;
+    return g_utf8_skip[*p];
+}
+
+/* Returns length of @name escaped the same way g_uri_escape_string(name, "/", TRUE)
+ * does it. If the result is @len then nothing should be escaped. */
+static int _fm_path_child_escaped_len(const char* name, int len)
 {
-    FmPath* current;
-    /* This is a way to reuse cached FmPath objects created for $HOME and desktop dir.
-     * Since most of the files a user may use are under $HOME, reusing this can
-     * more or less reduce memory usage. However, this may slow things down a little. */
-    for(current = desktop_path; current; current = current->parent)
+    const guchar* p = (const guchar*)name, *end = p + len;
+    int escaped_len = len, n;
+
+    while(p < end)
     {
-        if(fm_path_equal(current->parent, parent))
+        /* the most common case: ASCII letters, digits and dots */
+        if(G_LIKELY(uri_child_safe[*p]))
+            ++p;
+        else if(*p >= 0x80 && (n = _fm_path_utf8_char_len(p, end)) > 0)
+            p += n;
+        else
         {
-            if(strncmp(basename, current->name, name_len) == 0 && current->name[name_len] == '\0')
-                return fm_path_ref(current);
-            break;
+            escaped_len += 2; /* %XX */
+            ++p;
+        }
+    }
+    return escaped_len;
+}
+
+/* escapes @name into @buf which should have _fm_path_child_escaped_len() bytes */
+static void _fm_path_child_escape(char* buf, const char* name, int len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    const guchar* p = (const guchar*)name, *end = p + len;
+    int n;
+
+    while(p < end)
+    {
+        if(uri_child_safe[*p])
+            *buf++ = *p++;
+        else if(*p >= 0x80 && (n = _fm_path_utf8_char_len(p, end)) > 0)
+        {
+            memcpy(buf, p, n);
+            buf += n;
+            p += n;
+        }
+        else
+        {
+            *buf++ = '%';
+            *buf++ = hex[*p >> 4];
+            *buf++ = hex[*p & 0xf];
+            ++p;
         }
     }
-    return NULL;
 }
-#endif
 
 /**
  * fm_path_new_child_len
@@ -286,6 +600,8 @@ static inline FmPath* _fm_path_reuse_existing_paths(FmPath* parent, const char*
  * If @parent is %NULL then @basename assumed to be root of some file
  * system.
  *
+ * If the path already exists then a new reference to it is returned.
+ *
  * Returns: (transfer full): a new #FmPath for the path. You have to call
  * fm_path_unref() when it's no longer needed.
  */
@@ -293,8 +609,7 @@ FmPath* _fm_path_new_child_len(FmPath* parent, const char* basename, int name_le
                                gboolean dont_escape)
 {
     FmPath* path;
-    gboolean append_slash = FALSE;
-    int flags;
+    int flags, escaped_len;
 
     /* skip empty basename */
     if(G_UNLIKELY(!basename || name_len == 0))
@@ -302,16 +617,6 @@ FmPath* _fm_path_new_child_len(FmPath* parent, const char* basename, int name_le
 
     if(G_LIKELY(parent)) /* remove slashes if needed. */
     {
-        #if 0 /* This saves some memory, but it's too inefficient. */
-        /* Optimization: reuse existing FmPaths */
-        if(fm_path_is_native(parent))
-        {
-            path = _fm_path_reuse_existing_paths(parent, basename, name_len);
-            if(G_UNLIKELY(path))
-                return path;
-        }
-        #endif
-
         flags = parent->flags; /* inherit flags of parent */
         while(basename[0] == '/')
         {
@@ -351,30 +656,22 @@ FmPath* _fm_path_new_child_len(FmPath* parent, const char* basename, int name_le
     if(name_len == 0)
         return parent ? fm_path_ref(parent) : NULL;
 
-    if(dont_escape)
-    {
-        path = _fm_path_alloc(parent, (G_UNLIKELY(append_slash) ? name_len + 1 : name_len), flags);
-        memcpy(path->name, basename, name_len);
-    }
+    /* remote file names don't come escaped from gvfs; isn't that a bug of gvfs? */
+    if(dont_escape ||
+       (escaped_len = _fm_path_child_escaped_len(basename, name_len)) == name_len)
+        path = _fm_path_new_interned(parent, basename, name_len, flags);
     else
     {
-        GString *str = g_string_new_len(basename, name_len);
-        /* remote file names don't come escaped from gvfs; isn't that a bug of gvfs? */
-        char *escaped = g_uri_escape_string(str->str, "/", TRUE);
-        /* g_debug("got child %s", escaped); */
-        name_len = strlen(escaped);
-        path = _fm_path_alloc(parent, (G_UNLIKELY(append_slash) ? name_len + 1 : name_len), flags);
-        memcpy(path->name, escaped, name_len);
-        g_free(escaped);
-        g_string_free(str, TRUE);
+        /* the escaped name is only needed to look it up in the interning
+         * table and is copied into the new path from there, so keep it on
+         * the stack unless it's unusually long */
+        char* escaped = G_LIKELY(escaped_len <= 1024) ? g_alloca(escaped_len) : g_malloc(escaped_len);
+        _fm_path_child_escape(escaped, basename, name_len);
+        /* g_debug("got child %.*s", escaped_len, escaped); */
+        path = _fm_path_new_interned(parent, escaped, escaped_len, flags);
+        if(G_UNLIKELY(escaped_len > 1024))
+            g_free(escaped);
     }
-    if(G_UNLIKELY(append_slash))
-    {
-        path->name[name_len] = '/';
-        path->name[name_len + 1] = '\0';
-    }
-    else
-        path->name[name_len] = '\0';
     return path;
 }
 
@@ -407,6 +704,91 @@ FmPath* fm_path_new_child(FmPath* parent, const char* basename)
     return G_LIKELY(parent) ? fm_path_ref(parent) : NULL;
 }
 
+#define CHILDREN_BATCH_SIZE 64
+
+/**
+ * fm_path_new_children_batch
+ * @parent: a parent path
+ * @names: (array length=n): basenames of direct children of @parent
+ * @n: number of elements in @names
+ * @out: (array length=n) (out caller-allocates): array for new paths
+ *
+ * Creates new #FmPath for each of @names, the same as fm_path_new_child()
+ * does. This is meant for names returned by readdir() so it's faster:
+ * each name is checked once, and the interning table is locked once for
+ * all names which fall into the same part of it instead of once per name.
+ * Names which are not a valid basename (empty, "." and "..", or containing
+ * a slash) are skipped and %NULL is set in @out for them.
+ *
+ * Returns: number of paths created. You have to call fm_path_unref()
+ * on each of them when they are no longer needed.
+ *
+ * Since: 1.2.0
+ */
+guint fm_path_new_children_batch(FmPath* parent, const char* const* names, guint n, FmPath** out)
+{
+    struct
+    {
+        guint hash;
+        guint key;
+        int len; /* -1 if name is invalid or already done */
+    } info[CHILDREN_BATCH_SIZE];
+    guint base, i, j, m, n_created = 0;
+
+    fm_return_val_if_fail(parent != NULL, 0);
+
+    for(base = 0; base < n; base += m)
+    {
+        m = MIN(n - base, CHILDREN_BATCH_SIZE);
+        for(i = 0; i < m; ++i)
+        {
+            const char* name = names[base + i];
+            /* both are vectorized in libc, unlike a check per character */
+            int len = name ? strlen(name) : 0;
+            if(len == 0 || memchr(name, '/', len) ||
+               (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.'))))
+            {
+                info[i].len = -1;
+                out[base + i] = NULL;
+            }
+            else if(!fm_path_is_native(parent))
+            {
+                /* remote names should be escaped first */
+                info[i].len = -1;
+                out[base + i] = _fm_path_new_child_len(parent, name, len, FALSE);
+                ++n_created;
+            }
+            else
+            {
+                info[i].len = len;
+                info[i].hash = _fm_path_compute_hash(parent, name, len);
+                info[i].key = _fm_path_table_key(info[i].hash);
+            }
+        }
+
+        /* take each shard lock once and do all the names of that shard */
+        for(i = 0; i < m; ++i)
+        {
+            FmPathTableShard* shard;
+            if(info[i].len < 0)
+                continue;
+            shard = _fm_path_get_shard(info[i].key);
+            g_mutex_lock(&shard->mutex);
+            for(j = i; j < m; ++j)
+            {
+                if(info[j].len < 0 || _fm_path_get_shard(info[j].key) != shard)
+                    continue;
+                out[base + j] = _fm_path_intern_locked(shard, parent, names[base + j], info[j].len,
+                                                       parent->flags, info[j].hash, info[j].key);
+                info[j].len = -1;
+                ++n_created;
+            }
+            g_mutex_unlock(&shard->mutex);
+        }
+    }
+    return n_created;
+}
+
 /**
  * fm_path_new_for_gfile
  * @gf: a GFile object
@@ -639,18 +1021,34 @@ void fm_path_unref(FmPath* path)
 {
     fm_return_if_fail(path != NULL);
     /* g_debug("fm_path_unref: %s, n_ref = %d", fm_path_to_str(path), path->n_ref); */
-    if(g_atomic_int_dec_and_test(&path->n_ref))
+    for(;;)
     {
-        g_atomic_int_add(&path_total, -1);
-        g_atomic_int_add(&path_bytes_total, -(sizeof(FmPath) + path->name_len));
+        gint n_ref = g_atomic_int_get(&path->n_ref);
+        if(n_ref <= 1)
+            break;
+        if(g_atomic_int_compare_and_exchange(&path->n_ref, n_ref, n_ref - 1))
+            return;
+    }
 
-        if(G_LIKELY(path->parent))
-            fm_path_unref(path->parent);
-        G_LOCK(roots);
-        roots = g_slist_remove(roots, path);
-        G_UNLOCK(roots);
-        g_free(path);
+    /* This may be the last reference. Drop it with the lock of the table
+     * the path is registered in held, so it cannot be found there and
+     * referenced again while it's being destroyed. Registered roots are
+     * never released this way since the registry holds a reference. */
+    if(G_LIKELY(path->parent) || (path->flags & FM_PATH_IN_TABLE))
+    {
+        FmPathTableShard* shard = _fm_path_get_shard(_fm_path_table_key(path->hash));
+        g_mutex_lock(&shard->mutex);
+        if(!g_atomic_int_dec_and_test(&path->n_ref))
+        {
+            g_mutex_unlock(&shard->mutex);
+            return;
+        }
+        _fm_path_table_remove(shard, path);
+        g_mutex_unlock(&shard->mutex);
     }
+    else if(!g_atomic_int_dec_and_test(&path->n_ref))
+        return;
+    _fm_path_free(path);
 }
 
 /**
@@ -717,7 +1115,7 @@ const char* fm_path_get_basename(FmPath* path)
  */
 FmPathFlags fm_path_get_flags(FmPath* path)
 {
-    return path ? path->flags : 0;
+    return path ? path->flags & ~FM_PATH_IN_TABLE : 0;
 }
 
 /**
@@ -733,34 +1131,135 @@ FmPathFlags fm_path_get_flags(FmPath* path)
  */
 gboolean fm_path_has_prefix(FmPath* path, FmPath* prefix)
 {
-    for(; path; path = path->parent)
+    if(G_UNLIKELY(!path || !prefix))
+        return FALSE;
+    /* only one element of @path can be on the same depth as @prefix */
+    if(path->depth < prefix->depth)
+        return FALSE;
+    while(path->depth > prefix->depth)
+        path = path->parent;
+    return path == prefix;
+}
+
+/* characters which g_filename_to_uri() leaves unescaped */
+static inline gboolean _fm_path_uri_char_is_safe(guchar c)
+{
+    switch(c)
     {
-        if(fm_path_equal(path, prefix))
-            return TRUE;
+    case '-': case '_': case '.': case '!': case '~': case '*': case '\'':
+    case '(': case ')': case '/': case '&': case '=': case ':': case '@':
+    case '+': case '$': case ',':
+        return TRUE;
+    default:
+        return g_ascii_isalnum(c);
     }
-    return FALSE;
 }
 
-/* recursive internal implem. of fm_path_to_str returns end of current
-   build string */
-static gchar* fm_path_to_str_int(FmPath* path, gchar** ret, gint str_len)
+static inline gsize _fm_path_part_len(const char* str, gsize len, gboolean escape)
+{
+    gsize i, escaped_len;
+
+    if(!escape)
+        return len;
+    for(i = 0, escaped_len = len; i < len; ++i)
+        if(!_fm_path_uri_char_is_safe(str[i]))
+            escaped_len += 2;
+    return escaped_len;
+}
+
+/* copies @str so it ends right before @end, returns start of the copy */
+static inline char* _fm_path_copy_part_back(char* end, const char* str, gsize len, gboolean escape)
 {
-    gint name_len = strlen(path->name);
-    gchar* pbuf;
+    static const char hex[] = "0123456789ABCDEF";
+    const char* p;
 
-    if (!path->parent)
+    if(!escape)
     {
-        *ret = g_new0(gchar, str_len + name_len + 1 );
-        pbuf = *ret;
+        end -= len;
+        memcpy(end, str, len);
+        return end;
     }
-    else
+    for(p = str + len; p > str; )
     {
-        pbuf = fm_path_to_str_int( path->parent, ret, str_len + name_len + 1 );
-        if (path->parent->parent) /* if parent dir is not root_path */
-            *pbuf++ = G_DIR_SEPARATOR;
+        guchar c = *--p;
+        if(_fm_path_uri_char_is_safe(c))
+            *--end = c;
+        else
+        {
+            *--end = hex[c & 0xf];
+            *--end = hex[c >> 4];
+            *--end = '%';
+        }
     }
-    memcpy( pbuf, path->name, name_len );
-    return pbuf + name_len;
+    return end;
+}
+
+/* Builds string representation of @path in @buf if it fits there.
+ * Returns length of the string. It's built from the end so walking up
+ * stops at the nearest parent which has its string cached. */
+static gsize _fm_path_to_buf(FmPath* path, char* buf, gsize buf_size, gboolean escape)
+{
+    FmPath* element;
+    FmSymbol* cached;
+    gsize len = escape ? 7 : 0; /* file:// */
+    char* p;
+
+    for(element = path; element; element = element->parent)
+    {
+        cached = g_atomic_pointer_get(&element->str);
+        if(cached)
+        {
+            len += _fm_path_part_len(fm_symbol_get_cstr(cached), fm_symbol_get_size(cached), escape);
+            break;
+        }
+        len += _fm_path_part_len(element->name, element->name_len, escape);
+        if(element->parent && element->parent->parent) /* parent is not a root */
+            ++len; /* G_DIR_SEPARATOR */
+    }
+    if(len >= buf_size)
+        return len;
+
+    p = buf + len;
+    *p = '\0';
+    for(element = path; element; element = element->parent)
+    {
+        cached = g_atomic_pointer_get(&element->str);
+        if(cached)
+        {
+            p = _fm_path_copy_part_back(p, fm_symbol_get_cstr(cached), fm_symbol_get_size(cached), escape);
+            break;
+        }
+        p = _fm_path_copy_part_back(p, element->name, element->name_len, escape);
+        if(element->parent && element->parent->parent)
+            *--p = G_DIR_SEPARATOR;
+    }
+    if(escape)
+        memcpy(buf, "file://", 7);
+    return len;
+}
+
+/* Directories usually have many children which are converted into strings
+ * one by one. A directory which expects that (i.e. FmFolder) may ask to keep
+ * its string with it so children can be done by just appending their names.
+ * It is an opt-in since the string lives as long as the path does and doing
+ * it for any parent would keep strings of every directory ever visited.
+ * Roots don't need that, their name is enough. */
+void _fm_path_cache_str(FmPath* path)
+{
+    FmSymbol* str;
+    char* buf;
+    gsize len;
+
+    if(!path->parent || g_atomic_pointer_get(&path->str))
+        return;
+    len = _fm_path_to_buf(path, NULL, 0, FALSE);
+    buf = g_malloc(len + 1);
+    _fm_path_to_buf(path, buf, len + 1, FALSE);
+    str = fm_symbol_new(buf, len);
+    g_free(buf);
+    /* another thread may be doing the same, only one will win */
+    if(!g_atomic_pointer_compare_and_exchange(&path->str, NULL, str))
+        fm_symbol_unref(str);
 }
 
 /**
@@ -778,10 +1277,34 @@ static gchar* fm_path_to_str_int(FmPath* path, gchar** ret, gint str_len)
 char* fm_path_to_str(FmPath* path)
 {
     gchar *ret;
-    fm_path_to_str_int( path, &ret, 0 );
+    gsize len;
+
+    len = _fm_path_to_buf(path, NULL, 0, FALSE);
+    ret = g_malloc(len + 1);
+    _fm_path_to_buf(path, ret, len + 1, FALSE);
     return ret;
 }
 
+/**
+ * fm_path_to_str_buf
+ * @path: a path
+ * @buf: (out caller-allocates) (allow-none): buffer to write to
+ * @buf_size: size of @buf in bytes
+ *
+ * Writes string representation of @path into @buf, the same as returned
+ * by fm_path_to_str() but without allocating memory. If @buf_size is not
+ * bigger than length of the string then nothing is written and caller
+ * may retry with a buffer of returned length plus one.
+ *
+ * Returns: length of the string not counting the terminating nul.
+ *
+ * Since: 1.2.0
+ */
+gsize fm_path_to_str_buf(FmPath* path, char* buf, gsize buf_size)
+{
+    return _fm_path_to_buf(path, buf, buf_size, FALSE);
+}
+
 /**
  * fm_path_to_uri
  * @path: a path
@@ -794,17 +1317,34 @@ char* fm_path_to_str(FmPath* path)
  */
 char* fm_path_to_uri(FmPath* path)
 {
-    char* uri = NULL;
-    char* str = fm_path_to_str(path);
-    if( G_LIKELY(str) )
-    {
-        if(str[0] == '/') /* absolute path */
-            uri = g_filename_to_uri(str, NULL, NULL);
-        else /* it's already an URI */
-            return str;
-        g_free(str);
-    }
-    return uri;
+    gboolean escape = fm_path_is_native(path);
+    gchar *ret;
+    gsize len;
+
+    len = _fm_path_to_buf(path, NULL, 0, escape);
+    ret = g_malloc(len + 1);
+    _fm_path_to_buf(path, ret, len + 1, escape);
+    return ret;
+}
+
+/**
+ * fm_path_to_uri_buf
+ * @path: a path
+ * @buf: (out caller-allocates) (allow-none): buffer to write to
+ * @buf_size: size of @buf in bytes
+ *
+ * Writes URI representation of @path into @buf, the same as returned
+ * by fm_path_to_uri() but without allocating memory. If @buf_size is not
+ * bigger than length of the URI then nothing is written and caller may
+ * retry with a buffer of returned length plus one.
+ *
+ * Returns: length of the URI not counting the terminating nul.
+ *
+ * Since: 1.2.0
+ */
+gsize fm_path_to_uri_buf(FmPath* path, char* buf, gsize buf_size)
+{
+    return _fm_path_to_buf(path, buf, buf_size, fm_path_is_native(path));
 }
 
 /**
@@ -891,13 +1431,16 @@ char* fm_path_display_basename(FmPath* path)
 GFile* fm_path_to_gfile(FmPath* path)
 {
     GFile* gf;
-    char* str;
-    str = fm_path_to_str(path);
+    char buf[512];
+    char* str = buf;
+    if(fm_path_to_str_buf(path, buf, sizeof(buf)) >= sizeof(buf))
+        str = fm_path_to_str(path);
     if(fm_path_is_native(path))
         gf = g_file_new_for_path(str);
     else
         gf = fm_file_new_for_uri(str);
-    g_free(str);
+    if(str != buf)
+        g_free(str);
     return gf;
 }
 
@@ -987,7 +1530,8 @@ void _fm_path_init()
     FmPath* tmp, *parent;
 
     /* path object of root_path dir */
-    root_path = _fm_path_new_internal(NULL, "/", 1, FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE);
+    root_path = _fm_path_new_internal(NULL, "/", 1, FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE,
+                                      _fm_path_compute_hash(NULL, "/", 1));
     home_dir = fm_get_home_dir();
     home_len = strlen(home_dir);
     while(home_dir[home_len - 1] == '/')
@@ -1003,12 +1547,12 @@ void _fm_path_init()
         {
             /* ref counting is not a problem here since this path component
              * will exist till the termination of the program. So mem leak is ok. */
-            tmp = _fm_path_new_internal(parent, name, len, FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE);
+            tmp = _fm_path_new_interned(parent, name, len, FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE);
             parent = tmp;
         }
         name = sep + 1;
     }
-    home_path = _fm_path_new_internal(parent, name, strlen(name), FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE);
+    home_path = _fm_path_new_interned(parent, name, strlen(name), FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE);
 
     desktop_dir = g_get_user_special_dir(G_USER_DIRECTORY_DESKTOP);
     desktop_len = strlen(desktop_dir);
@@ -1037,18 +1581,26 @@ void _fm_path_init()
         {
             /* ref counting is not a problem here since this path component
              * will exist till the termination of the program. So mem leak is ok. */
-            tmp = _fm_path_new_internal(parent, name, len, FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE);
+            tmp = _fm_path_new_interned(parent, name, len, FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE);
             parent = tmp;
         }
         name = sep + 1;
     }
-    desktop_path = _fm_path_new_internal(parent, name, strlen(name), FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE);
+    desktop_path = _fm_path_new_interned(parent, name, strlen(name), FM_PATH_IS_LOCAL|FM_PATH_IS_NATIVE);
 
     /* build path object for trash can */
     /* FIXME: currently there are problems with URIs. using trash:/ here will cause problems. */
-    trash_root_path = _fm_path_new_internal(NULL, "trash:///", 9, FM_PATH_IS_TRASH|FM_PATH_IS_VIRTUAL|FM_PATH_IS_LOCAL);
-    apps_root_path = _fm_path_new_internal(NULL, "menu://applications/", 20, FM_PATH_IS_VIRTUAL|FM_PATH_IS_XDG_MENU);
-    computer_root_path = _fm_path_new_internal(NULL, "computer:///", 12, FM_PATH_IS_VIRTUAL|FM_PATH_IS_LOCAL);
+    trash_root_path = _fm_path_new_internal(NULL, "trash:///", 9, FM_PATH_IS_TRASH|FM_PATH_IS_VIRTUAL|FM_PATH_IS_LOCAL,
+                                            _fm_path_compute_hash(NULL, "trash:///", 9));
+    apps_root_path = _fm_path_new_internal(NULL, "menu://applications/", 20, FM_PATH_IS_VIRTUAL|FM_PATH_IS_XDG_MENU,
+                                           _fm_path_compute_hash(NULL, "menu://applications/", 20));
+    computer_root_path = _fm_path_new_internal(NULL, "computer:///", 12, FM_PATH_IS_VIRTUAL|FM_PATH_IS_LOCAL,
+                                               _fm_path_compute_hash(NULL, "computer:///", 12));
+    /* computer:/// URIs are not special-cased in _fm_path_new_uri_root()
+     * so register it there to keep root paths unique */
+    G_LOCK(roots);
+    _fm_path_root_table_insert(fm_path_ref(computer_root_path));
+    G_UNLOCK(roots);
 }
 
 void _fm_path_finalize(void)
@@ -1059,6 +1611,20 @@ void _fm_path_finalize(void)
     fm_path_unref(trash_root_path);
     fm_path_unref(apps_root_path);
     root_path = home_path = desktop_path = trash_root_path = apps_root_path = NULL;
+
+    G_LOCK(roots);
+    if(roots)
+    {
+        guint i;
+        for(i = 0; i < roots->n_slots; ++i)
+            if(roots->slots[i])
+                fm_path_unref(roots->slots[i]);
+        g_free(roots);
+        roots = NULL;
+    }
+    g_slist_free_full(retired_roots, g_free);
+    retired_roots = NULL;
+    G_UNLOCK(roots);
 }
 
 /* For used in hash tables */
@@ -1073,18 +1639,9 @@ void _fm_path_finalize(void)
  *
  * Since: 0.1.0
  */
-/* FIXME: is this good enough? */
 guint fm_path_hash(FmPath* path)
 {
-    guint hash = g_str_hash(path->name);
-    if(path->parent)
-    {
-        /* this is learned from g_str_hash() of glib. */
-        hash = (hash << 5) - hash + '/';
-        /* this is learned from g_icon_hash() of gio. */
-        hash ^= fm_path_hash(path->parent);
-    }
-    return hash;
+    return path->hash;
 }
 
 /**
@@ -1103,23 +1660,11 @@ guint fm_path_hash(FmPath* path)
  *
  * Since: 0.1.0
  */
-/* this is not equal to fm_path_compare()==0
- * fm_path_equal is optimized for equality
- * while fm_path_compare() needs to determine
- * orders of two items, which is slower.
- * When you only care about equality, not orders,
- * use this. */
+/* Paths are interned: there is never more than one FmPath object
+ * for the same path, so comparing pointers is enough. */
 gboolean fm_path_equal(FmPath* p1, FmPath* p2)
 {
-    if(p1 == p2)
-        return TRUE;
-    if(!p1) /* if p2 is also NULL then p1==p2 and that is handled above */
-        return FALSE;
-    if(!p2) /* case of p1==NULL handled above */
-        return FALSE;
-    if( strcmp(p1->name, p2->name) != 0 )
-        return FALSE;
-    return fm_path_equal( p1->parent, p2->parent);
+    return p1 == p2;
 }
 
 /*
@@ -1142,17 +1687,23 @@ gboolean fm_path_equal(FmPath* p1, FmPath* p2)
  */
 int fm_path_compare(FmPath* p1, FmPath* p2)
 {
-    int result;
     if(p1 == p2)
         return 0;
     if(!p1) /* if p2 is also NULL then p1==p2 and that is handled above */
         return -1;
     if(!p2) /* case of p1==NULL handled above */
         return 1;
-    result = fm_path_compare(p1->parent, p2->parent);
-    if(result == 0) /* if parent paths are equal, compare children */
-        result = strcmp(p1->name, p2->name);
-    return result;
+    /* shorter paths go first */
+    if(p1->depth != p2->depth)
+        return p1->depth < p2->depth ? -1 : 1;
+    /* go up to the topmost elements which differ, i.e. to the siblings
+     * (or to different roots), the order is defined by their names */
+    while(p1->parent != p2->parent)
+    {
+        p1 = p1->parent;
+        p2 = p2->parent;
+    }
+    return strcmp(p1->name, p2->name);
 }
 
 /**
@@ -1204,18 +1755,12 @@ gboolean fm_path_equal_str(FmPath *path, const gchar *str, int n)
  *
  * Calculates how many elements are in this path.
  *
- * Returns: %TRUE if paths are equal.
+ * Returns: number of elements in the path.
  *
  * Since: 1.0.0
  */
 int fm_path_depth(FmPath* path)
 {
-    int depth = 1;
-    while(path->parent)
-    {
-        ++depth;
-        path = path->parent;
-    }
-    return depth;
+    return path->depth;
 }
 
@@ -69,6 +69,7 @@ typedef enum
 
 void _fm_path_init(void);
 void _fm_path_finalize(void);
+void _fm_path_cache_str(FmPath* path);
 
 FmPath* fm_path_new_for_path(const char* path_name);
 FmPath* fm_path_new_for_uri(const char* uri);
@@ -77,6 +78,7 @@ FmPath* fm_path_new_for_commandline_arg(const char* arg);
 
 FmPath* fm_path_new_child(FmPath* parent, const char* basename);
 FmPath* fm_path_new_child_len(FmPath* parent, const char* basename, int name_len);
+guint fm_path_new_children_batch(FmPath* parent, const char* const* names, guint n, FmPath** out);
 FmPath* fm_path_new_relative(FmPath* parent, const char* rel);
 FmPath* fm_path_new_for_gfile(GFile* gf);
 
@@ -109,6 +111,8 @@ FmPath* fm_path_get_scheme_path(FmPath* path);
 
 char* fm_path_to_str(FmPath* path);
 char* fm_path_to_uri(FmPath* path);
+gsize fm_path_to_str_buf(FmPath* path, char* buf, gsize buf_size);
+gsize fm_path_to_uri_buf(FmPath* path, char* buf, gsize buf_size);
 GFile* fm_path_to_gfile(FmPath* path);
 
 char* fm_path_display_name(FmPath* path, gboolean human_readable);
@@ -366,7 +366,11 @@ static void load_thumbnails(ThumbnailTask* task)
     if (task->cancelled)
         goto _out;
 
+#ifdef ENABLE_DEBUG
+    guint section = fm_file_info_read_begin();
     DEBUG("loading: %s, %s", fm_file_info_get_name(task->fi), normal_path);
+    fm_file_info_read_end(section);
+#endif
 
     if (task->flags & LOAD_NORMAL)
     {
@@ -444,9 +448,13 @@ static void load_simple_icon(ThumbnailTask * task)
         {
             g_rec_mutex_unlock(&queue_lock);
 
+            guint section;
+
             if (current_pix)
                 g_object_unref(current_pix);
+            section = fm_file_info_read_begin();
             current_pix = backend.read_simple_icon(task->fi, req->size);
+            fm_file_info_read_end(section);
             current_pix_size = req->size;
 
             /*g_debug("%s: %s: %d %s", __FUNCTION__, fm_file_info_get_name(task->fi),
@@ -476,6 +484,9 @@ static gpointer load_thumbnail_thread(gpointer user_data)
     gchar* normal_basename = strrchr(normal_path, '/') + 1;
     gchar* large_path = g_build_filename(thumb_dir, "large/00000000000000000000000000000000.png", NULL);
     gchar* large_basename = strrchr(large_path, '/') + 1;
+    /* reused for every task, grown when needed */
+    gsize uri_size = 512;
+    char* uri = g_malloc(uri_size);
 
     /* ensure thumbnail directories exists */
     g_mkdir_with_parents(normal_path, 0700);
@@ -490,15 +501,27 @@ static gpointer load_thumbnail_thread(gpointer user_data)
 
         if(G_LIKELY(task))
         {
-            char* uri;
+            FmPath* path;
+            gsize uri_len;
             const char* md5;
+            guint section;
 
             task->locked = TRUE;
             g_rec_mutex_unlock(&queue_lock);
-            uri = fm_path_to_uri(fm_file_info_get_path(task->fi));
+            /* task->fi can be updated by its folder meanwhile */
+            section = fm_file_info_read_begin();
+            path = fm_file_info_get_path(task->fi);
+            uri_len = fm_path_to_uri_buf(path, uri, uri_size);
+            if(G_UNLIKELY(uri_len >= uri_size))
+            {
+                uri_size = uri_len + 1;
+                uri = g_realloc(uri, uri_size);
+                fm_path_to_uri_buf(path, uri, uri_size);
+            }
+            fm_file_info_read_end(section);
 
             /* generate filename for the thumbnail */
-            g_checksum_update(sum, (guchar*)uri, -1);
+            g_checksum_update(sum, (guchar*)uri, uri_len);
             md5 = g_checksum_get_string(sum); /* md5 sum of the URI */
 
             task->uri = uri;
@@ -525,7 +548,6 @@ static gpointer load_thumbnail_thread(gpointer user_data)
             task->uri = NULL;
             task->normal_path = NULL;
             task->large_path = NULL;
-            g_free(uri);
 
             g_rec_mutex_lock(&queue_lock);
             cur_loading = NULL;
@@ -548,6 +570,7 @@ static gpointer load_thumbnail_thread(gpointer user_data)
         {
             g_free(normal_path);
             g_free(large_path);
+            g_free(uri);
             g_checksum_free(sum);
 
             g_thread_unref(loader_thread_id);
@@ -844,7 +867,11 @@ void _fm_thumbnail_loader_finalize(void)
 /* in thread */
 static void generate_thumbnails(ThumbnailTask* task)
 {
-    if(fm_file_info_is_image(task->fi))
+    guint section = fm_file_info_read_begin();
+    gboolean is_image = fm_file_info_is_image(task->fi);
+    fm_file_info_read_end(section);
+
+    if(is_image)
     {
         /* FIXME: if the built-in thumbnail generation fails
          * still call external thumbnailer to handle it.
@@ -931,8 +958,11 @@ static GObject* load_picture_object_from_exif_thumbnail(ThumbnailTask * task, in
 #ifdef USE_EXIF
     /* use libexif to extract thumbnails embedded in jpeg files */
 
+    guint section = fm_file_info_read_begin();
     FmMimeType* mime_type = fm_file_info_get_mime_type(task->fi);
-    if (strcmp(fm_mime_type_get_type(mime_type), "image/jpeg") != 0)
+    gboolean is_jpeg = (strcmp(fm_mime_type_get_type(mime_type), "image/jpeg") == 0);
+    fm_file_info_read_end(section);
+    if (!is_jpeg)
         return NULL;
 
     GFileInputStream * ins = *_ins;
@@ -1022,8 +1052,10 @@ static GObject* load_picture_object_from_exif_thumbnail(ThumbnailTask * task, in
 static GObject* load_picture_object(ThumbnailTask * task, int * _rotate_degrees)
 {
     /* FIXME: only formats supported by GObject should be handled this way. */
+    guint section = fm_file_info_read_begin();
     GFile* gf = fm_path_to_gfile(fm_file_info_get_path(task->fi));
     GFileInputStream* ins;
+    fm_file_info_read_end(section);
 
     GObject* picture = NULL;
 
@@ -1053,7 +1085,11 @@ static void generate_thumbnails_with_builtin(ThumbnailTask* task)
     GObject* normal_pix = NULL;
     GObject* large_pix = NULL;
 
+#ifdef ENABLE_DEBUG
+    guint section = fm_file_info_read_begin();
     DEBUG("generate thumbnail for %s", fm_file_info_get_name(task->fi));
+    fm_file_info_read_end(section);
+#endif
 
     int rotate_degrees = 0;
     GObject* ori_pix = load_picture_object(task, &rotate_degrees);
@@ -1192,7 +1228,12 @@ static void generate_thumbnails_with_thumbnailers(ThumbnailTask* task)
     /* external thumbnailer support */
     GObject* normal_pix = NULL;
     GObject* large_pix = NULL;
+    /* keep the mime type even if task->fi is updated while thumbnailers run */
+    guint section = fm_file_info_read_begin();
     FmMimeType* mime_type = fm_file_info_get_mime_type(task->fi);
+    if(mime_type)
+        fm_mime_type_ref(mime_type);
+    fm_file_info_read_end(section);
     /* TODO: we need to add timeout for external thumbnailers.
      * If a thumbnailer program is broken or locked for unknown reason,
      * the thumbnailer process should be killed once a timeout is reached. */
@@ -1225,6 +1266,7 @@ static void generate_thumbnails_with_thumbnailers(ThumbnailTask* task)
             if(generated == task->flags)
                 break;
         }
+        fm_mime_type_unref(mime_type);
     }
 
     thumbnail_task_apply_pixmaps_to_requests(task, normal_pix, large_pix);
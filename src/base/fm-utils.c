@@ -43,6 +43,7 @@
 #include <string.h>
 #include "fm-utils.h"
 #include "fm-symbol.h"
+#include "fm-slab.h"
 #include "fm-file-info-job.h"
 
 #define BI_KiB  ((gdouble)1024.0)
@@ -497,4 +498,5 @@ void fm_log_memory_usage(void)
     fm_log_memory_usage_for_symbol();
     fm_log_memory_usage_for_path();
     fm_log_memory_usage_for_file_info();
+    _fm_slab_log_memory_usage();
 }
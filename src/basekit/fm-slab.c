@@ -0,0 +1,334 @@
+/*
+ *      fm-slab.c
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include "fm-slab.h"
+
+/* Objects are grouped into size classes which are multiple of
+ * FM_SLAB_ALIGN. Each class cuts chunks from pages of FM_SLAB_PAGE_SIZE
+ * bytes and keeps freed chunks in a depot protected by a mutex. Each
+ * thread has a magazine of chunks per class, so most of allocations and
+ * frees don't touch shared data at all; magazines are refilled from and
+ * flushed into the depot in batches.
+ * Pages are aligned to their size, so the page of a chunk is found from
+ * its address. The depot is the list of pages with free chunks, each one
+ * with its own list of them. When no chunk of a page is out of the depot,
+ * the page is given back to the system, except FM_SLAB_KEEP_EMPTY_PAGES
+ * per class. A magazine keeps up to FM_SLAB_MAGAZINE_SIZE chunks per
+ * class until its thread exits, which bounds what threads hold.
+ * Objects bigger than FM_SLAB_MAX_SIZE are allocated with g_malloc(). */
+
+#define FM_SLAB_ALIGN 8
+#define FM_SLAB_MAX_SIZE 256
+#define FM_SLAB_N_CLASSES (FM_SLAB_MAX_SIZE / FM_SLAB_ALIGN)
+#define FM_SLAB_PAGE_SIZE (16 * 1024)
+#define FM_SLAB_MAGAZINE_SIZE 64
+#define FM_SLAB_KEEP_EMPTY_PAGES 1
+
+typedef struct _FmSlabChunk FmSlabChunk;
+struct _FmSlabChunk
+{
+    FmSlabChunk* next;
+};
+
+typedef struct _FmSlabPage FmSlabPage;
+struct _FmSlabPage
+{
+    FmSlabPage* prev; /* in the depot */
+    FmSlabPage* next;
+    FmSlabChunk* free_chunks;
+    char* uncut; /* chunks from here to the end were never used */
+    guint n_out; /* chunks in magazines or given to callers */
+};
+
+#define FM_SLAB_FIRST_CHUNK ((sizeof(FmSlabPage) + FM_SLAB_ALIGN - 1) & ~(gsize)(FM_SLAB_ALIGN - 1))
+
+typedef struct
+{
+    GMutex mutex;
+    FmSlabPage* pages; /* the depot: pages with free chunks */
+    guint n_empty_pages;
+    /* statistics */
+    guint n_pages;
+    guint n_free; /* chunks in the depot */
+    guint n_out; /* chunks given to magazines */
+    gint n_used; /* chunks given to callers */
+    gssize requested; /* bytes requested by callers */
+} FmSlabClass;
+
+typedef struct
+{
+    FmSlabChunk* chunks;
+    guint n_chunks;
+    /* statistics not yet added to the class */
+    gint used_delta;
+    gssize requested_delta;
+} FmSlabMagazine;
+
+static void _fm_slab_magazines_free(gpointer data);
+
+static FmSlabClass slab_classes[FM_SLAB_N_CLASSES];
+static GPrivate slab_magazines = G_PRIVATE_INIT(_fm_slab_magazines_free);
+
+/*****************************************************************************/
+
+/* should be called with class mutex locked */
+static inline void _fm_slab_merge_stats(FmSlabClass* cls, FmSlabMagazine* mag)
+{
+    cls->n_used += mag->used_delta;
+    cls->requested += mag->requested_delta;
+    mag->used_delta = 0;
+    mag->requested_delta = 0;
+}
+
+/* the tail of a page shorter than chunk_size is never used */
+static inline gboolean _fm_slab_page_is_full(FmSlabPage* page, gsize chunk_size)
+{
+    return !page->free_chunks && page->uncut + chunk_size > (char*)page + FM_SLAB_PAGE_SIZE;
+}
+
+/* should be called with class mutex locked */
+static void _fm_slab_link_page(FmSlabClass* cls, FmSlabPage* page)
+{
+    page->prev = NULL;
+    page->next = cls->pages;
+    if(page->next)
+        page->next->prev = page;
+    cls->pages = page;
+}
+
+/* should be called with class mutex locked */
+static void _fm_slab_unlink_page(FmSlabClass* cls, FmSlabPage* page)
+{
+    if(page->prev)
+        page->prev->next = page->next;
+    else
+        cls->pages = page->next;
+    if(page->next)
+        page->next->prev = page->prev;
+    page->prev = page->next = NULL;
+}
+
+static void _fm_slab_refill(guint index, FmSlabMagazine* mag)
+{
+    FmSlabClass* cls = &slab_classes[index];
+    gsize chunk_size = (index + 1) * FM_SLAB_ALIGN;
+    guint n = 0;
+
+    g_mutex_lock(&cls->mutex);
+    _fm_slab_merge_stats(cls, mag);
+    while(n < FM_SLAB_MAGAZINE_SIZE / 2)
+    {
+        FmSlabPage* page = cls->pages;
+        FmSlabChunk* chunk;
+        if(!page)
+        {
+            gpointer mem;
+            if(posix_memalign(&mem, FM_SLAB_PAGE_SIZE, FM_SLAB_PAGE_SIZE) != 0)
+                g_error("%s: failed to allocate %d bytes", G_STRLOC, FM_SLAB_PAGE_SIZE);
+            page = mem;
+            page->free_chunks = NULL;
+            page->uncut = (char*)page + FM_SLAB_FIRST_CHUNK;
+            page->n_out = 0;
+            _fm_slab_link_page(cls, page);
+            ++cls->n_pages;
+            ++cls->n_empty_pages;
+        }
+        chunk = page->free_chunks;
+        if(chunk)
+        {
+            page->free_chunks = chunk->next;
+            --cls->n_free;
+        }
+        else
+        {
+            chunk = (FmSlabChunk*)page->uncut;
+            page->uncut += chunk_size;
+        }
+        if(page->n_out++ == 0)
+            --cls->n_empty_pages;
+        if(_fm_slab_page_is_full(page, chunk_size))
+            _fm_slab_unlink_page(cls, page);
+        chunk->next = mag->chunks;
+        mag->chunks = chunk;
+        ++n;
+    }
+    cls->n_out += n;
+    g_mutex_unlock(&cls->mutex);
+    mag->n_chunks += n;
+}
+
+/* returns all but @n_keep chunks of the magazine to the depot */
+static void _fm_slab_flush(guint index, FmSlabMagazine* mag, guint n_keep)
+{
+    FmSlabClass* cls = &slab_classes[index];
+    gsize chunk_size = (index + 1) * FM_SLAB_ALIGN;
+    FmSlabChunk* chunks = mag->chunks;
+    guint n = 0;
+
+    while(mag->n_chunks - n > n_keep)
+    {
+        mag->chunks = mag->chunks->next;
+        ++n;
+    }
+    mag->n_chunks -= n;
+
+    g_mutex_lock(&cls->mutex);
+    _fm_slab_merge_stats(cls, mag);
+    cls->n_free += n;
+    cls->n_out -= n;
+    while(n > 0)
+    {
+        FmSlabChunk* chunk = chunks;
+        FmSlabPage* page = (FmSlabPage*)((gsize)chunk & ~(gsize)(FM_SLAB_PAGE_SIZE - 1));
+
+        chunks = chunk->next;
+        --n;
+        if(_fm_slab_page_is_full(page, chunk_size))
+            _fm_slab_link_page(cls, page);
+        chunk->next = page->free_chunks;
+        page->free_chunks = chunk;
+        if(--page->n_out > 0)
+            continue;
+        if(cls->n_empty_pages < FM_SLAB_KEEP_EMPTY_PAGES)
+            ++cls->n_empty_pages;
+        else
+        {
+            /* all the chunks cut from it are in its list */
+            cls->n_free -= (page->uncut - ((char*)page + FM_SLAB_FIRST_CHUNK)) / chunk_size;
+            --cls->n_pages;
+            _fm_slab_unlink_page(cls, page);
+            free(page);
+        }
+    }
+    g_mutex_unlock(&cls->mutex);
+}
+
+static FmSlabMagazine* _fm_slab_get_magazines(void)
+{
+    FmSlabMagazine* mags = g_private_get(&slab_magazines);
+    if(G_UNLIKELY(!mags))
+    {
+        mags = g_new0(FmSlabMagazine, FM_SLAB_N_CLASSES);
+        g_private_set(&slab_magazines, mags);
+    }
+    return mags;
+}
+
+/* called on thread exit */
+static void _fm_slab_magazines_free(gpointer data)
+{
+    FmSlabMagazine* mags = data;
+    guint i;
+
+    for(i = 0; i < FM_SLAB_N_CLASSES; ++i)
+        _fm_slab_flush(i, &mags[i], 0);
+    g_free(mags);
+}
+
+/*****************************************************************************/
+
+gpointer _fm_slab_alloc(gsize size)
+{
+    FmSlabMagazine* mag;
+    FmSlabChunk* chunk;
+    guint index;
+
+    if(G_UNLIKELY(size > FM_SLAB_MAX_SIZE || size == 0))
+        return g_malloc(size);
+
+    index = (size - 1) / FM_SLAB_ALIGN;
+    mag = &_fm_slab_get_magazines()[index];
+    if(G_UNLIKELY(!mag->chunks))
+        _fm_slab_refill(index, mag);
+    chunk = mag->chunks;
+    mag->chunks = chunk->next;
+    --mag->n_chunks;
+    ++mag->used_delta;
+    mag->requested_delta += size;
+    return chunk;
+}
+
+void _fm_slab_free(gpointer mem, gsize size)
+{
+    FmSlabMagazine* mag;
+    FmSlabChunk* chunk = mem;
+    guint index;
+
+    if(G_UNLIKELY(size > FM_SLAB_MAX_SIZE || size == 0))
+    {
+        g_free(mem);
+        return;
+    }
+    if(G_UNLIKELY(!mem))
+        return;
+
+    index = (size - 1) / FM_SLAB_ALIGN;
+    mag = &_fm_slab_get_magazines()[index];
+    chunk->next = mag->chunks;
+    mag->chunks = chunk;
+    ++mag->n_chunks;
+    --mag->used_delta;
+    mag->requested_delta -= size;
+    if(G_UNLIKELY(mag->n_chunks >= FM_SLAB_MAGAZINE_SIZE))
+        _fm_slab_flush(index, mag, FM_SLAB_MAGAZINE_SIZE / 2);
+}
+
+/*****************************************************************************/
+
+/* Statistics of threads are added on refill and flush so numbers may lag
+ * behind a little, it's good enough to see how the memory is spent. */
+void _fm_slab_log_memory_usage(void)
+{
+    gsize total = 0, used = 0, cached = 0, in_depots = 0;
+    gssize requested = 0;
+    guint i;
+
+    for(i = 0; i < FM_SLAB_N_CLASSES; ++i)
+    {
+        FmSlabClass* cls = &slab_classes[i];
+        gsize chunk_size = (i + 1) * FM_SLAB_ALIGN;
+
+        g_mutex_lock(&cls->mutex);
+        total += (gsize)cls->n_pages * FM_SLAB_PAGE_SIZE;
+        used += (gsize)MAX(cls->n_used, 0) * chunk_size;
+        cached += (gsize)MAX((gint)cls->n_out - cls->n_used, 0) * chunk_size;
+        in_depots += (gsize)cls->n_free * chunk_size;
+        requested += cls->requested;
+        g_mutex_unlock(&cls->mutex);
+    }
+    requested = MAX(requested, 0);
+
+    /* Waste inside of chunks is rounding up to size classes, the rest is
+     * chunks free in depots and thread caches and unused page tails. */
+    g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO,
+        "memory usage: slab: %lu KiB in pages, %lu KiB in use (%lu KiB requested), "
+        "%lu KiB free in depots, %lu KiB cached in threads, fragmentation %d%%",
+        (gulong)(total / 1024), (gulong)(used / 1024), (gulong)(requested / 1024),
+        (gulong)(in_depots / 1024), (gulong)(cached / 1024),
+        total ? (int)(100 - ((gsize)requested * 100) / total) : 0);
+}
@@ -0,0 +1,41 @@
+/*
+ *      fm-slab.h
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+
+#ifndef __FM_SLAB_H__
+#define __FM_SLAB_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Allocator for small objects which are created and destroyed in large
+ * numbers, such as FmPath and FmSymbol. Memory should be freed with the
+ * same size as it was allocated with. */
+
+gpointer     _fm_slab_alloc(gsize size);
+void         _fm_slab_free(gpointer mem, gsize size);
+
+void         _fm_slab_log_memory_usage(void);
+
+G_END_DECLS
+
+#endif /* __FM_SLAB_H__ */
@@ -25,6 +25,7 @@
 #endif
 
 #include "fm-symbol.h"
+#include "fm-slab.h"
 #include "fm-utils.h"
 
 #include <string.h>
@@ -34,23 +35,156 @@
 struct _FmSymbol
 {
     gint n_ref;
-    int value_size;
+    guint value_size : 31;
+    guint interned : 1; /* the symbol is a part of FmInternedSymbol */
     char value[1];
 };
 
+/* Only interned symbols need to be found by value, so the fields for
+ * the interning table are kept in a header preceding the symbol and
+ * plain symbols (the most of them) don't pay for them. */
+typedef struct _FmInternedSymbol FmInternedSymbol;
+struct _FmInternedSymbol
+{
+    FmInternedSymbol * next; /* next symbol in the same bucket of the interning table */
+    guint hash; /* value of fm_symbol_hash(), computed on creation */
+    FmSymbol symbol; /* should be the last one, its value follows */
+};
+
+#define INTERNED_HEADER_SIZE G_STRUCT_OFFSET(FmInternedSymbol, symbol)
+#define INTERNED_SYMBOL(symbol) ((FmInternedSymbol *) ((char *) (symbol) - INTERNED_HEADER_SIZE))
+
+/*****************************************************************************/
+
+/* Interning table.
+ *
+ * Symbols created with fm_symbol_new_interned() are registered in a hash
+ * set, so there is at most one interned symbol for any value at a time.
+ * The same scheme as for FmPath is used: the set is split into shards with
+ * a mutex each, buckets are chained through FmInternedSymbol::next, and the last
+ * reference to an interned symbol is dropped with the lock of its shard
+ * held, so a symbol which is being destroyed can never be found there. */
+
+#define SYMBOL_TABLE_N_SHARDS 16 /* should match the shift in _fm_symbol_get_shard() */
+#define SYMBOL_TABLE_MIN_BUCKETS 64
+
+typedef struct
+{
+    GMutex mutex;
+    FmInternedSymbol ** buckets;
+    guint n_buckets;
+    guint n_items;
+} FmSymbolTableShard;
+
+static FmSymbolTableShard symbol_table[SYMBOL_TABLE_N_SHARDS];
+
+/* the same as g_str_hash() but doesn't need terminated string */
+static inline guint _fm_symbol_compute_hash(const char * value, int value_size)
+{
+    const signed char * p = (const signed char *) value;
+    const signed char * end = p + value_size;
+    guint hash = 5381;
+
+    for (; p < end; ++p)
+        hash = (hash << 5) + hash + *p;
+    return hash;
+}
+
+/* mixes the bits of the hash so both the shard (upper bits)
+ * and the bucket (lower bits) indexes are well distributed */
+static inline guint _fm_symbol_table_key(guint hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static inline FmSymbolTableShard * _fm_symbol_get_shard(guint key)
+{
+    return &symbol_table[key >> 28];
+}
+
+static void _fm_symbol_table_resize(FmSymbolTableShard * shard, guint n_buckets)
+{
+    FmInternedSymbol ** buckets = g_new0(FmInternedSymbol *, n_buckets);
+    FmInternedSymbol * symbol, * next;
+    guint i;
+
+    for (i = 0; i < shard->n_buckets; ++i)
+    {
+        for (symbol = shard->buckets[i]; symbol; symbol = next)
+        {
+            FmInternedSymbol ** bucket = &buckets[_fm_symbol_table_key(symbol->hash) & (n_buckets - 1)];
+            next = symbol->next;
+            symbol->next = *bucket;
+            *bucket = symbol;
+        }
+    }
+    g_free(shard->buckets);
+    shard->buckets = buckets;
+    shard->n_buckets = n_buckets;
+}
+
+/* should be called with shard->mutex locked */
+static void _fm_symbol_table_remove(FmSymbolTableShard * shard, FmInternedSymbol * symbol)
+{
+    FmInternedSymbol ** link = &shard->buckets[_fm_symbol_table_key(symbol->hash) & (shard->n_buckets - 1)];
+
+    while (*link != symbol)
+        link = &(*link)->next;
+    *link = symbol->next;
+    symbol->next = NULL;
+    --shard->n_items;
+    if (shard->n_buckets > SYMBOL_TABLE_MIN_BUCKETS && shard->n_items < shard->n_buckets / 8)
+        _fm_symbol_table_resize(shard, shard->n_buckets / 2);
+}
+
 /*****************************************************************************/
 
 int symbol_total;
 int symbol_bytes_total;
+int symbol_interned_total;
 
 void fm_log_memory_usage_for_symbol(void)
 {
-    g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "memory usage: FmSymbol: %d items, %d KiB",
-        g_atomic_int_get(&symbol_total), g_atomic_int_get(&symbol_bytes_total) / 1024);
+    int i, table_bytes = 0;
+
+    for (i = 0; i < SYMBOL_TABLE_N_SHARDS; ++i)
+        table_bytes += g_atomic_int_get((gint *) &symbol_table[i].n_buckets) * sizeof(FmInternedSymbol *);
+
+    g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "memory usage: FmSymbol: %d items (%d interned), %d KiB, interning table %d KiB",
+        g_atomic_int_get(&symbol_total), g_atomic_int_get(&symbol_interned_total),
+        g_atomic_int_get(&symbol_bytes_total) / 1024, table_bytes / 1024);
 }
 
 /*****************************************************************************/
 
+static inline gsize _fm_symbol_alloc_size(gboolean interned, int value_size)
+{
+    return (interned ? INTERNED_HEADER_SIZE : 0) + sizeof(FmSymbol) + value_size;
+}
+
+static void _fm_symbol_init(FmSymbol * symbol, const char * value, int value_size, gboolean interned)
+{
+    symbol->n_ref = 1;
+    symbol->interned = interned;
+    symbol->value_size = value_size;
+    memcpy(symbol->value, value, value_size);
+    symbol->value[value_size] = '\0';
+}
+
+static void _fm_symbol_free(FmSymbol * symbol)
+{
+    gsize size = _fm_symbol_alloc_size(symbol->interned, symbol->value_size);
+
+    g_atomic_int_add(&symbol_total, -1);
+    g_atomic_int_add(&symbol_bytes_total, -(int) size);
+    _fm_slab_free(symbol->interned ? (gpointer) INTERNED_SYMBOL(symbol) : (gpointer) symbol, size);
+}
+
 FmSymbol * fm_symbol_new(const char * value, ssize_t value_size)
 {
     if (!value)
@@ -59,19 +193,70 @@ FmSymbol * fm_symbol_new(const char * value, ssize_t value_size)
     if (value_size < 0)
         value_size = strlen(value);
 
+    gsize size = _fm_symbol_alloc_size(FALSE, value_size);
     g_atomic_int_inc(&symbol_total);
-    g_atomic_int_add(&symbol_bytes_total, sizeof(FmSymbol) + value_size);
-
-    FmSymbol * symbol;
-    symbol = (FmSymbol *) g_malloc(sizeof(FmSymbol) + value_size);
-    symbol->n_ref = 1;
-    symbol->value_size = value_size;
-    memcpy(symbol->value, value, value_size);
-    symbol->value[value_size] = '\0';
+    g_atomic_int_add(&symbol_bytes_total, size);
 
+    FmSymbol * symbol = (FmSymbol *) _fm_slab_alloc(size);
+    _fm_symbol_init(symbol, value, value_size, FALSE);
     return symbol;
 }
 
+/* Returns the interned symbol for @value, creating it if there is none.
+ * Meant for values which many objects have in common, like formatted
+ * sizes and dates: they share one symbol instead of a copy each, and
+ * interned symbols are equal only if they are the same object. */
+FmSymbol * fm_symbol_new_interned(const char * value, ssize_t value_size)
+{
+    FmSymbolTableShard * shard;
+    FmInternedSymbol * symbol;
+    guint hash, key;
+    gsize size;
+
+    if (!value)
+        return NULL;
+
+    if (value_size < 0)
+        value_size = strlen(value);
+
+    hash = _fm_symbol_compute_hash(value, value_size);
+    key = _fm_symbol_table_key(hash);
+    shard = _fm_symbol_get_shard(key);
+
+    g_mutex_lock(&shard->mutex);
+    if (G_LIKELY(shard->buckets))
+    {
+        for (symbol = shard->buckets[key & (shard->n_buckets - 1)]; symbol; symbol = symbol->next)
+        {
+            if (symbol->hash == hash && symbol->symbol.value_size == value_size &&
+                memcmp(symbol->symbol.value, value, value_size) == 0)
+            {
+                g_atomic_int_inc(&symbol->symbol.n_ref);
+                g_mutex_unlock(&shard->mutex);
+                return &symbol->symbol;
+            }
+        }
+    }
+    else
+        _fm_symbol_table_resize(shard, SYMBOL_TABLE_MIN_BUCKETS);
+
+    size = _fm_symbol_alloc_size(TRUE, value_size);
+    symbol = (FmInternedSymbol *) _fm_slab_alloc(size);
+    symbol->hash = hash;
+    _fm_symbol_init(&symbol->symbol, value, value_size, TRUE);
+    if (shard->n_items >= shard->n_buckets)
+        _fm_symbol_table_resize(shard, shard->n_buckets * 2);
+    symbol->next = shard->buckets[key & (shard->n_buckets - 1)];
+    shard->buckets[key & (shard->n_buckets - 1)] = symbol;
+    ++shard->n_items;
+    g_mutex_unlock(&shard->mutex);
+
+    g_atomic_int_inc(&symbol_total);
+    g_atomic_int_add(&symbol_bytes_total, size);
+    g_atomic_int_inc(&symbol_interned_total);
+    return &symbol->symbol;
+}
+
 FmSymbol * fm_symbol_ref(FmSymbol * symbol)
 {
     fm_return_val_if_fail(symbol, NULL);
@@ -83,12 +268,36 @@ void fm_symbol_unref(FmSymbol * symbol)
 {
     fm_return_if_fail(symbol);
 
-    if (g_atomic_int_dec_and_test(&symbol->n_ref))
+    if (!symbol->interned)
+    {
+        if (g_atomic_int_dec_and_test(&symbol->n_ref))
+            _fm_symbol_free(symbol);
+        return;
+    }
+
+    for (;;)
     {
-        g_atomic_int_add(&symbol_total, -1);
-        g_atomic_int_add(&symbol_bytes_total, -(sizeof(FmSymbol) + symbol->value_size));
-        g_free(symbol);
+        gint n_ref = g_atomic_int_get(&symbol->n_ref);
+        if (n_ref <= 1)
+            break;
+        if (g_atomic_int_compare_and_exchange(&symbol->n_ref, n_ref, n_ref - 1))
+            return;
     }
+
+    /* this may be the last reference, see fm_symbol_new_interned() */
+    FmInternedSymbol * interned = INTERNED_SYMBOL(symbol);
+    FmSymbolTableShard * shard = _fm_symbol_get_shard(_fm_symbol_table_key(interned->hash));
+    g_mutex_lock(&shard->mutex);
+    if (!g_atomic_int_dec_and_test(&symbol->n_ref))
+    {
+        g_mutex_unlock(&shard->mutex);
+        return;
+    }
+    _fm_symbol_table_remove(shard, interned);
+    g_mutex_unlock(&shard->mutex);
+
+    g_atomic_int_add(&symbol_interned_total, -1);
+    _fm_symbol_free(symbol);
 }
 
 /*****************************************************************************/
@@ -99,6 +308,26 @@ const char * fm_symbol_get_cstr(FmSymbol * symbol)
     return symbol->value;
 }
 
+int fm_symbol_get_size(FmSymbol * symbol)
+{
+    fm_return_val_if_fail(symbol, 0);
+    return symbol->value_size;
+}
+
+guint fm_symbol_hash(FmSymbol * symbol)
+{
+    fm_return_val_if_fail(symbol, 0);
+    if (symbol->interned)
+        return INTERNED_SYMBOL(symbol)->hash;
+    return _fm_symbol_compute_hash(symbol->value, symbol->value_size);
+}
+
+gboolean fm_symbol_is_interned(FmSymbol * symbol)
+{
+    fm_return_val_if_fail(symbol, FALSE);
+    return symbol->interned;
+}
+
 int fm_symbol_compare(FmSymbol * s1, FmSymbol * s2)
 {
     if (s1 == s2)
@@ -132,6 +361,19 @@ int fm_symbol_compare_fast(FmSymbol * s1, FmSymbol * s2)
 
 gboolean fm_symbol_is_equal(FmSymbol * s1, FmSymbol * s2)
 {
-    return fm_symbol_compare_fast(s1, s2) == 0;
+    if (s1 == s2)
+        return TRUE;
+
+    if (s1 == NULL || s2 == NULL)
+        return FALSE;
+
+    /* there is only one interned symbol for each value */
+    if (s1->interned && s2->interned)
+        return FALSE;
+
+    if (s1->value_size != s2->value_size)
+        return FALSE;
+
+    return memcmp(s1->value, s2->value, s1->value_size) == 0;
 }
 
@@ -33,11 +33,15 @@ G_BEGIN_DECLS
 typedef struct _FmSymbol FmSymbol;
 
 FmSymbol *   fm_symbol_new(const char * value, ssize_t value_size);
+FmSymbol *   fm_symbol_new_interned(const char * value, ssize_t value_size);
 
 FmSymbol *   fm_symbol_ref(FmSymbol * symbol);
 void         fm_symbol_unref(FmSymbol * symbol);
 
 const char * fm_symbol_get_cstr(FmSymbol * symbol);
+int          fm_symbol_get_size(FmSymbol * symbol);
+guint        fm_symbol_hash(FmSymbol * symbol);
+gboolean     fm_symbol_is_interned(FmSymbol * symbol);
 
 int          fm_symbol_compare(FmSymbol * s1, FmSymbol * s2);
 int          fm_symbol_compare_fast(FmSymbol * s1, FmSymbol * s2);
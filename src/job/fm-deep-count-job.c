@@ -133,10 +133,15 @@ static gboolean fm_deep_count_job_run(FmJob* job)
 static gboolean deep_count_posix(FmDeepCountJob* job, FmPath* fm_path)
 {
     FmJob* fmjob = FM_JOB(job);
-    char* path = fm_path_to_str(fm_path);
+    /* this is called recursively so keep the stack buffer small */
+    char path_buf[256];
+    char* path = path_buf;
     struct stat st;
     int ret;
 
+    if(fm_path_to_str_buf(fm_path, path_buf, sizeof(path_buf)) >= sizeof(path_buf))
+        path = fm_path_to_str(fm_path);
+
 _retry_stat:
     if( G_UNLIKELY(job->flags & FM_DC_JOB_FOLLOW_LINKS) )
         ret = stat(path, &st);
@@ -158,13 +163,13 @@ _retry_stat:
         if( job->flags & FM_DC_JOB_SAME_FS )
         {
             if( st.st_dev != job->dest_dev )
-                return TRUE;
+                goto _done;
         }
         /* only descends into files on the different filesystem */
         else if( job->flags & FM_DC_JOB_PREPARE_MOVE )
         {
             if( st.st_dev == job->dest_dev )
-                return TRUE;
+                goto _done;
         }
     }
     else
@@ -175,10 +180,16 @@ _retry_stat:
         err = NULL;
         if(act == FM_JOB_RETRY)
             goto _retry_stat;
+        if(path != path_buf)
+            g_free(path);
         return FALSE;
     }
     if(fm_job_is_cancelled(fmjob))
+    {
+        if(path != path_buf)
+            g_free(path);
         return FALSE;
+    }
 
     if( S_ISDIR(st.st_mode) ) /* if it's a dir */
     {
@@ -209,7 +220,9 @@ _retry_stat:
             g_dir_close(dir_ent);
         }
     }
-    g_free(path);
+_done:
+    if(path != path_buf)
+        g_free(path);
     return TRUE;
 }
 
@@ -39,12 +39,14 @@
 #include <dirent.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include "fm-dir-list-job.h"
 #include "fm-file-info-job.h"
 #include "fm-mime-type.h"
 #include "fm-file-info.h"
 #include "fm-utils.h"
+#include "fm-folder-snapshot.h"
 #include "glib-compat.h"
 
 #include <glib/gi18n-lib.h>
@@ -209,6 +211,8 @@ static DIR * opendir_with_error(const char * path, GError ** error)
 #define DIRENT_MIGHT_BE_DIR(d)     1
 #endif
 
+#define DIR_LIST_BATCH_SIZE 64
+
 static gboolean fm_dir_list_job_run_posix(FmDirListJob* job)
 {
     FmJob* fmjob = FM_JOB(job);
@@ -251,6 +255,14 @@ static gboolean fm_dir_list_job_run_posix(FmDirListJob* job)
     if (dir)
     {
         struct dirent * entry;
+        int dir_fd = dirfd(dir);
+        struct stat dir_st;
+        FmFolderSnapshotKey snapshot_key;
+        /* the state of the folder before it's read, for its snapshot */
+        gboolean snapshot_valid = job->save_snapshot && !job->dir_only &&
+                                  fstat(dir_fd, &dir_st) == 0;
+        if (snapshot_valid)
+            _fm_folder_snapshot_key_from_stat(&snapshot_key, &dir_st);
         GString* fpath = g_string_sized_new(4096);
         int dir_len = strlen(path_str);
         g_string_append_len(fpath, path_str, dir_len);
@@ -259,65 +271,121 @@ static gboolean fm_dir_list_job_run_posix(FmDirListJob* job)
             g_string_append_c(fpath, '/');
             ++dir_len;
         }
-        while ( !fm_job_is_cancelled(fmjob) && (entry = readdir(dir)) )
+        /* names are collected in batches so paths for them are created at once */
+        GString* names_buf = g_string_sized_new(DIR_LIST_BATCH_SIZE * 32);
+        gsize name_offsets[DIR_LIST_BATCH_SIZE];
+        const char* names[DIR_LIST_BATCH_SIZE];
+        FmPath* paths[DIR_LIST_BATCH_SIZE];
+        guint n_names, i;
+        gboolean eof = FALSE;
+
+        while ( !eof && !fm_job_is_cancelled(fmjob) )
         {
-            const char* name = entry->d_name;
+            g_string_truncate(names_buf, 0);
+            for (n_names = 0; n_names < DIR_LIST_BATCH_SIZE; )
+            {
+                if (!(entry = readdir(dir)))
+                {
+                    eof = TRUE;
+                    break;
+                }
+                const char* name = entry->d_name;
+
+                if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                    continue;
 
-            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
-                continue;
+                /* if we only want directories; links and unknown types
+                 * are checked when the info is filled, it follows links */
+                if (job->dir_only && !DIRENT_MIGHT_BE_DIR(entry))
+                    continue;
 
-            FmPath* new_path;
-            g_string_truncate(fpath, dir_len);
-            g_string_append(fpath, name);
+                /* the dirent is overwritten by the next readdir() so keep a copy */
+                name_offsets[n_names++] = names_buf->len;
+                g_string_append_len(names_buf, name, strlen(name) + 1);
+            }
+            for (i = 0; i < n_names; ++i)
+                names[i] = names_buf->str + name_offsets[i];
+            fm_path_new_children_batch(job->dir_path, names, n_names, paths);
 
-            if (job->dir_only) /* if we only want directories */
+            for (i = 0; i < n_names; ++i)
             {
-                if (!DIRENT_MIGHT_BE_DIR(entry))
+                if (G_UNLIKELY(!paths[i]))
                     continue;
-
-                struct stat st;
-                /* FIXME: this results in an additional stat() call, which is inefficient */
-                if(stat(fpath->str, &st) == -1 || !S_ISDIR(st.st_mode))
+                if (fm_job_is_cancelled(fmjob))
+                {
+                    fm_path_unref(paths[i]);
                     continue;
-            }
+                }
 
-            new_path = fm_path_new_child(job->dir_path, name);
-            fi = fm_file_info_new_from_path_unfilled(new_path);
-            fm_path_unref(new_path);
+                g_string_truncate(fpath, dir_len);
+                g_string_append(fpath, names[i]);
 
-        _retry:
-            if( _fm_file_info_job_get_info_for_native_file(fmjob, fi, fpath->str, &err) )
-                fm_dir_list_job_add_found_file(job, fi);
-            else /* failed! */
-            {
-                FmJobErrorAction act = fm_job_emit_error(fmjob, err, FM_JOB_ERROR_MILD);
-                g_error_free(err);
-                err = NULL;
-                if(act == FM_JOB_RETRY)
-                    goto _retry;
+                fi = fm_file_info_new_from_path_unfilled(paths[i]);
+                fm_path_unref(paths[i]);
+
+            _retry:
+                /* stat relative to the open dir, the path is not walked again */
+                if( _fm_file_info_job_get_info_for_native_file_at(fmjob, fi, dir_fd, names[i], fpath->str, &err) )
+                {
+                    if (!job->dir_only || fm_file_info_is_directory(fi))
+                        fm_dir_list_job_add_found_file(job, fi);
+                }
+                else if (job->dir_only)
+                {
+                    /* when only directories are listed, entries which can't
+                     * be stat()ed, like vanished files and broken links, are
+                     * not errors, they are just not directories */
+                    g_error_free(err);
+                    err = NULL;
+                }
+                else /* failed! */
+                {
+                    FmJobErrorAction act = fm_job_emit_error(fmjob, err, FM_JOB_ERROR_MILD);
+                    snapshot_valid = FALSE; /* the file is missing in the listing */
+                    g_error_free(err);
+                    err = NULL;
+                    if(act == FM_JOB_RETRY)
+                        goto _retry;
+                }
+                fm_file_info_unref(fi);
+
+                item_count++;
+                item_count_step++;
+                long long interval = g_get_monotonic_time() - start_time;
+                if (interval > G_USEC_PER_SEC * 0.25)
+                {
+                    start_time += interval;
+                    const char * format = ngettext(
+                        "reading folder listing... (%ld items read)",
+                        "reading folder listing... (%ld items read)", item_count);
+                    fm_job_report_status(fmjob, format, item_count);
+                    g_debug("FmDirListJob: %s:  items read: %ld + %ld = %ld",
+                        fm_file_info_get_name(job->dir_fi),
+                        item_count - item_count_step,
+                        item_count_step,
+                        item_count);
+                    item_count_step = 0;
+                }
             }
-            fm_file_info_unref(fi);
+        }
+        g_string_free(names_buf, TRUE);
+        g_string_free(fpath, TRUE);
 
-            item_count++;
-            item_count_step++;
-            long long interval = g_get_monotonic_time() - start_time;
-            if (interval > G_USEC_PER_SEC * 0.25)
+        if (snapshot_valid && !fm_job_is_cancelled(fmjob) &&
+            fm_file_info_list_get_length(job->files) >= FM_FOLDER_SNAPSHOT_MIN_FILES)
+        {
+            FmFolderSnapshotKey key;
+            /* The folder must not be changed while it was read. Times in
+             * the last seconds may not differ from those of a change made
+             * right after reading, so such snapshot is not trusted. */
+            if (fstat(dir_fd, &dir_st) == 0)
             {
-                start_time += interval;
-                const char * format = ngettext(
-                    "reading folder listing... (%ld items read)",
-                    "reading folder listing... (%ld items read)", item_count);
-                fm_job_report_status(fmjob, format, item_count);
-                g_debug("FmDirListJob: %s:  items read: %ld + %ld = %ld",
-                    fm_file_info_get_name(job->dir_fi),
-                    item_count - item_count_step,
-                    item_count_step,
-                    item_count);
-                item_count_step = 0;
+                _fm_folder_snapshot_key_from_stat(&key, &dir_st);
+                if (memcmp(&key, &snapshot_key, sizeof(key)) == 0 &&
+                    key.mtime_sec < time(NULL) - 1 && key.ctime_sec < time(NULL) - 1)
+                    _fm_folder_snapshot_save(job->dir_path, &key, job->files);
             }
-
         }
-        g_string_free(fpath, TRUE);
         closedir(dir);
 
         const char * format = ngettext(
@@ -624,6 +692,9 @@ static gpointer queue_add_file(FmJob* fmjob, gpointer user_data)
  */
 void fm_dir_list_job_add_found_file(FmDirListJob* job, FmFileInfo* file)
 {
+    /* the first sort of a big folder shouldn't compute them in the main thread */
+    if(job->precompute_collate_keys)
+        fm_file_info_get_collate_key(file);
     fm_file_info_list_push_tail(job->files, file);
     if(G_UNLIKELY(job->emit_files_found))
         fm_job_call_main_thread(FM_JOB(job), queue_add_file, file);
@@ -680,3 +751,38 @@ void fm_dir_list_job_set_incremental(FmDirListJob* job, gboolean set)
 {
     job->emit_files_found = set;
 }
+
+/**
+ * fm_dir_list_job_set_precompute_collate_keys
+ * @job: the job descriptor
+ * @set: %TRUE if job should compute collate keys of found files
+ *
+ * Sets whether @job should compute the key returned by
+ * fm_file_info_get_collate_key() for each found file while listing, in
+ * the thread of the job, instead of leaving it until the files are sorted.
+ * This should only be called before the @job is launched.
+ *
+ * Since: 1.2.0
+ */
+void fm_dir_list_job_set_precompute_collate_keys(FmDirListJob* job, gboolean set)
+{
+    job->precompute_collate_keys = set;
+}
+
+/**
+ * fm_dir_list_job_set_save_snapshot
+ * @job: the job descriptor
+ * @set: %TRUE if job should save a snapshot of the listing
+ *
+ * Sets whether @job should store the listing of a big native folder in
+ * the user cache directory, so the folder can be shown from it when it's
+ * opened again. Nothing is stored if the folder was changed while it was
+ * read or some files could not be read.
+ * This should only be called before the @job is launched.
+ *
+ * Since: 1.2.0
+ */
+void fm_dir_list_job_set_save_snapshot(FmDirListJob* job, gboolean set)
+{
+    job->save_snapshot = set;
+}
@@ -63,6 +63,8 @@ struct _FmDirListJob
     gboolean emit_files_found;
     guint delay_add_files_handler;
     GSList* files_to_add;
+    gboolean precompute_collate_keys;
+    gboolean save_snapshot;
 };
 
 struct _FmDirListJobClass
@@ -79,6 +81,8 @@ FmDirListJob*   fm_dir_list_job_new(FmPath* path, gboolean dir_only);
 FmDirListJob*   fm_dir_list_job_new_for_gfile(GFile* gf);
 FmFileInfoList* fm_dir_list_job_get_files(FmDirListJob* job);
 void            fm_dir_list_job_set_incremental(FmDirListJob* job, gboolean set);
+void            fm_dir_list_job_set_precompute_collate_keys(FmDirListJob* job, gboolean set);
+void            fm_dir_list_job_set_save_snapshot(FmDirListJob* job, gboolean set);
 
 /*
 FmPath* fm_dir_list_job_get_dir_path(FmDirListJob* job);
@@ -36,6 +36,7 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "fm-file-info.h"
 #include "fm-utils.h"
@@ -139,7 +140,10 @@ static gboolean fm_file_info_job_run(FmJob* fmjob)
 
         if(fm_path_is_native(path))
         {
-            char* path_str = fm_path_to_str(path);
+            char path_buf[PATH_MAX];
+            char* path_str = path_buf;
+            if(fm_path_to_str_buf(path, path_buf, sizeof(path_buf)) >= sizeof(path_buf))
+                path_str = fm_path_to_str(path);
             if(!_fm_file_info_job_get_info_for_native_file(fmjob, fi, path_str, &err))
             {
                 FmJobErrorAction act = fm_job_emit_error(fmjob, err, FM_JOB_ERROR_MILD);
@@ -147,13 +151,15 @@ static gboolean fm_file_info_job_run(FmJob* fmjob)
                 err = NULL;
                 if(act == FM_JOB_RETRY)
                 {
-                    g_free(path_str);
+                    if(path_str != path_buf)
+                        g_free(path_str);
                     continue; /* retry */
                 }
 
                 fm_file_info_list_delete_link(job->file_infos, l); /* also calls unref */
             }
-            g_free(path_str);
+            if(path_str != path_buf)
+                g_free(path_str);
         }
         else
         {
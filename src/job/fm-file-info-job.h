@@ -96,6 +96,15 @@ _fm_file_info_job_get_info_for_native_file(FmJob* job, FmFileInfo* fi, const cha
     return TRUE;
 }
 
+static inline gboolean
+_fm_file_info_job_get_info_for_native_file_at(FmJob* job, FmFileInfo* fi, int dirfd,
+                                              const char* name, const char* path, GError** err)
+{
+    if( ! fm_job_is_cancelled(job) )
+        return _fm_file_info_fill_from_native_file_at(fi, dirfd, name, path, err);
+    return TRUE;
+}
+
 extern const char gfile_info_query_attribs[];
 
 static inline gboolean
@@ -0,0 +1,650 @@
+/*
+ *      test-fm-file-info.c
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <fm.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+#include <locale.h>
+#include <fcntl.h>
+#include <utime.h>
+
+#include "test-util.h"
+
+//ignore for test disabled asserts
+#ifdef G_DISABLE_ASSERT
+    #undef G_DISABLE_ASSERT
+#endif
+
+#define N_FILES 256
+#define N_THREADS 4
+
+static char* test_dir = NULL;
+static FmFileInfo* files[N_FILES];  /* shared by all threads */
+static FmFileInfo* sources[N_FILES]; /* used to reset the deferred fields */
+
+static void create_test_files(void)
+{
+    int i;
+
+    test_dir = g_dir_make_tmp("test-fm-file-info-XXXXXX", NULL);
+    g_assert(test_dir != NULL);
+    for(i = 0; i < N_FILES; ++i)
+    {
+        char* name = g_strdup_printf("%s/File %03d.txt", test_dir, i);
+        FmPath* path = fm_path_new_for_path(name);
+        g_assert(g_file_set_contents(name, "some text\n", -1, NULL));
+        files[i] = fm_file_info_new_from_native_file(path, name, NULL);
+        sources[i] = fm_file_info_new_from_native_file(path, name, NULL);
+        g_assert(files[i] != NULL && sources[i] != NULL);
+        fm_path_unref(path);
+        g_free(name);
+    }
+}
+
+static void remove_test_files(void)
+{
+    int i;
+
+    for(i = 0; i < N_FILES; ++i)
+    {
+        char* name = g_strdup_printf("%s/File %03d.txt", test_dir, i);
+        fm_file_info_unref(sources[i]);
+        fm_file_info_unref(files[i]);
+        g_unlink(name);
+        g_free(name);
+    }
+    g_rmdir(test_dir);
+    g_free(test_dir);
+}
+
+typedef struct
+{
+    int first, last; /* range of files[] */
+    int n_rounds;
+} Work;
+
+/* evaluates deferred fields, then updates the files so the next round
+ * checks them again */
+static gpointer evaluate_files(gpointer data)
+{
+    Work* work = data;
+    int round, i;
+
+    for(round = 0; round < work->n_rounds; ++round)
+    {
+        for(i = work->first; i < work->last; ++i)
+        {
+            FmFileInfo* fi = files[i];
+            guint section = fm_file_info_read_begin();
+            g_assert(fm_file_info_get_collate_key(fi) != NULL);
+            g_assert(fm_file_info_get_collate_key_nocasefold(fi) != NULL);
+            g_assert(fm_file_info_get_disp_size(fi) != NULL);
+            g_assert(fm_file_info_get_disp_mtime(fi) != NULL);
+            fm_file_info_read_end(section);
+            fm_file_info_update(fi, sources[i]);
+        }
+    }
+    return NULL;
+}
+
+static double run_threads(int n_threads, gboolean disjoint, int n_rounds)
+{
+    Work work[N_THREADS];
+    int i;
+
+    for(i = 0; i < n_threads; ++i)
+    {
+        work[i].first = disjoint ? i * N_FILES / n_threads : 0;
+        work[i].last = disjoint ? (i + 1) * N_FILES / n_threads : N_FILES;
+        work[i].n_rounds = n_rounds;
+    }
+    return test_util_run_threads(n_threads, evaluate_files, work, sizeof(Work));
+}
+
+/* all threads work on the same files, values must be consistent */
+static void test_concurrent_getters()
+{
+    int i;
+
+    create_test_files();
+    run_threads(N_THREADS, FALSE, 20);
+    for(i = 0; i < N_FILES; ++i)
+    {
+        char* name = g_strdup_printf("File %03d.txt", i);
+        char* collate = g_utf8_collate_key_for_filename(name, -1);
+        const char* key = fm_file_info_get_collate_key_nocasefold(files[i]);
+        /* the key is not stored if it's the same as the name */
+        g_assert_cmpstr(key, ==, strcmp(collate, name) ? collate : name);
+        g_assert_cmpstr(fm_file_info_get_name(files[i]), ==, name);
+        g_free(collate);
+        g_free(name);
+    }
+    remove_test_files();
+}
+
+/* a value replaced while someone else holds the file info stays valid */
+static void test_retired_values()
+{
+    FmPath* first = fm_path_new_for_str("/tmp/first");
+    FmPath* second = fm_path_new_for_str("/tmp/second");
+    FmFileInfo* fi = fm_file_info_new_from_path_unfilled(first);
+    FmFileInfo* src;
+    FmFileInfo* fresh;
+    FmPath* path;
+    const char* key;
+    guint section;
+    gint64 end;
+
+    /* the file info holds the only reference to its path, the old one
+     * stays valid while the read section is open */
+    fm_path_unref(first);
+    section = fm_file_info_read_begin();
+    path = fm_file_info_get_path(fi);
+    fm_file_info_set_path(fi, second);
+    end = g_get_monotonic_time() + G_USEC_PER_SEC / 2;
+    while(g_get_monotonic_time() < end)
+    {
+        while(g_main_context_iteration(NULL, FALSE))
+            continue;
+        g_usleep(10000);
+    }
+    g_assert_cmpstr(fm_path_get_basename(path), ==, "first");
+    fm_file_info_read_end(section);
+    g_assert(fm_file_info_get_path(fi) == second);
+
+    /* updating with the same name keeps the collate key */
+    key = fm_file_info_get_collate_key(fi);
+    src = fm_file_info_new_from_path_unfilled(second);
+    fm_file_info_update(fi, src);
+    g_assert(fm_file_info_get_collate_key(fi) == key);
+    fm_file_info_unref(src);
+
+    /* and a new name gives a new one */
+    first = fm_path_new_for_str("/tmp/first");
+    src = fm_file_info_new_from_path_unfilled(first);
+    fresh = fm_file_info_new_from_path_unfilled(first);
+    fm_file_info_update(fi, src);
+    g_assert_cmpstr(fm_file_info_get_collate_key(fi), ==, fm_file_info_get_collate_key(fresh));
+    g_assert_cmpstr(fm_file_info_get_collate_key_nocasefold(fi), ==,
+                    fm_file_info_get_collate_key_nocasefold(fresh));
+    fm_file_info_unref(fresh);
+    fm_file_info_unref(src);
+    fm_path_unref(first);
+
+    fm_file_info_unref(fi);
+    fm_path_unref(second);
+}
+
+/* sizes and times come from caches, the text should be the same as
+ * formatting gives, and files with the same text should share it */
+static void test_disp_size_mtime()
+{
+    static const goffset sizes[] = {
+        0, 1, 999, 1000, 1023, 1024, 1025, 4096, 4100, 1048576, 1500000, 123456789
+    };
+    char* dir = g_dir_make_tmp("test-fm-file-info-XXXXXX", NULL);
+    FmFileInfo* files[G_N_ELEMENTS(sizes)][2];
+    gboolean si_unit = fm_config->si_unit;
+    time_t mtime = 1400000000; /* a minute boundary plus 20 s */
+    guint i, j, pass;
+
+    g_assert(dir != NULL);
+    for(i = 0; i < G_N_ELEMENTS(sizes); ++i)
+    {
+        for(j = 0; j < 2; ++j)
+        {
+            char* base = g_strdup_printf("%u-%u", i, j);
+            char* name = g_build_filename(dir, base, NULL);
+            FmPath* path = fm_path_new_for_path(name);
+            struct utimbuf times;
+            int fd = g_open(name, O_WRONLY | O_CREAT, 0644);
+
+            g_assert(fd >= 0 && ftruncate(fd, sizes[i]) == 0);
+            close(fd);
+            /* both files of a pair are within the same minute */
+            times.actime = times.modtime = mtime + i * 60 + j * 30;
+            g_assert(g_utime(name, &times) == 0);
+            files[i][j] = fm_file_info_new_from_native_file(path, name, NULL);
+            g_assert(files[i][j] != NULL);
+            fm_path_unref(path);
+            g_unlink(name);
+            g_free(name);
+            g_free(base);
+        }
+    }
+
+    /* the second pass goes after the caches are flushed */
+    for(pass = 0; pass < 2; ++pass)
+    {
+        if(pass == 1)
+        {
+            fm_config->si_unit = !si_unit;
+            fm_config_emit_changed(fm_config, "si_unit");
+        }
+        for(i = 0; i < G_N_ELEMENTS(sizes); ++i)
+        {
+            char buf[128];
+            time_t t = fm_file_info_get_mtime(files[i][0]);
+            struct tm tm;
+
+            fm_file_size_to_str(buf, sizeof(buf), sizes[i], fm_config->si_unit);
+            g_assert_cmpstr(fm_file_info_get_disp_size(files[i][0]), ==, buf);
+            g_assert(fm_file_info_get_disp_size(files[i][1]) == fm_file_info_get_disp_size(files[i][0]));
+
+            g_assert(localtime_r(&t, &tm) != NULL);
+            g_assert(strftime(buf, sizeof(buf), "%x %R", &tm) > 0);
+            g_assert_cmpstr(fm_file_info_get_disp_mtime(files[i][0]), ==, buf);
+            g_assert(fm_file_info_get_disp_mtime(files[i][1]) == fm_file_info_get_disp_mtime(files[i][0]));
+        }
+    }
+    fm_config->si_unit = si_unit;
+    fm_config_emit_changed(fm_config, "si_unit");
+
+    for(i = 0; i < G_N_ELEMENTS(sizes); ++i)
+        for(j = 0; j < 2; ++j)
+            fm_file_info_unref(files[i][j]);
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+/* keys of ASCII names are built without GLib, they should be the same */
+static void test_ascii_collate_keys()
+{
+    static const char* const names[] = {
+        "README", "Makefile.am", "file10.txt", "file9.txt", "File 007.txt",
+        "000", "a00", "x0y", "v1.2.10", ".hidden", "trailing.", "a..b",
+        "12345678901234567890", "mixed-Case_name (2)", "caf\xc3\xa9"
+    };
+    char* dir = g_dir_make_tmp("test-fm-file-info-XXXXXX", NULL);
+    guint i, pass;
+
+    g_assert(dir != NULL);
+    /* the locale may be set after fm_init(), the keys should follow it */
+    for(pass = 0; pass < 2; ++pass)
+    {
+        if(pass == 1)
+            setlocale(LC_ALL, "");
+        for(i = 0; i < G_N_ELEMENTS(names); ++i)
+        {
+            char* name = g_build_filename(dir, names[i], NULL);
+            FmPath* path = fm_path_new_for_path(name);
+            FmFileInfo* fi;
+            char *casefold, *expected;
+
+            g_assert(g_file_set_contents(name, "", -1, NULL));
+            fi = fm_file_info_new_from_native_file(path, name, NULL);
+            g_assert(fi != NULL);
+
+            expected = g_utf8_collate_key_for_filename(fm_file_info_get_disp_name(fi), -1);
+            g_assert_cmpstr(fm_file_info_get_collate_key_nocasefold(fi), ==, expected);
+            g_free(expected);
+
+            casefold = g_utf8_casefold(fm_file_info_get_disp_name(fi), -1);
+            expected = g_utf8_collate_key_for_filename(casefold, -1);
+            g_assert_cmpstr(fm_file_info_get_collate_key(fi), ==, expected);
+            g_free(expected);
+            g_free(casefold);
+
+            fm_file_info_unref(fi);
+            fm_path_unref(path);
+            g_unlink(name);
+            g_free(name);
+        }
+    }
+    setlocale(LC_ALL, "C");
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+/* a folder listing fills infos relative to the dir fd and computes
+ * accessibility from the mode, it should agree with the path-based calls */
+static void check_listing(const char* dir, gboolean dir_only, guint n_expected)
+{
+    FmPath* dir_path = fm_path_new_for_path(dir);
+    FmDirListJob* job = fm_dir_list_job_new(dir_path, dir_only);
+    FmFileInfoList* files;
+    GList* l;
+
+    g_assert(fm_job_run_sync(FM_JOB(job)));
+    files = fm_dir_list_job_get_files(job);
+    g_assert_cmpuint(fm_file_info_list_get_length(files), ==, n_expected);
+    for(l = fm_file_info_list_peek_head_link(files); l; l = l->next)
+    {
+        FmFileInfo* fi = l->data;
+        char* name = g_build_filename(dir, fm_file_info_get_name(fi), NULL);
+        char* target = g_file_read_link(name, NULL);
+        struct stat st;
+
+        g_assert(g_lstat(name, &st) == 0);
+        g_assert_cmpint(fm_file_info_get_mode(fi), ==, st.st_mode);
+        g_assert_cmpint(fm_file_info_get_size(fi), ==, st.st_size);
+        g_assert_cmpint(fm_file_info_get_mtime(fi), ==, st.st_mtime);
+        g_assert_cmpint(fm_file_info_is_symlink(fi), ==, S_ISLNK(st.st_mode));
+        g_assert_cmpstr(fm_file_info_get_target(fi), ==, target);
+        g_assert_cmpint(fm_file_info_is_accessible(fi), ==, g_access(name, R_OK) == 0);
+        g_assert_cmpint(fm_file_info_is_directory(fi), ==, g_file_test(name, G_FILE_TEST_IS_DIR));
+        if(dir_only)
+            g_assert(fm_file_info_is_directory(fi));
+        g_free(target);
+        g_free(name);
+    }
+    g_object_unref(job);
+    fm_path_unref(dir_path);
+}
+
+static void test_native_fill_at()
+{
+    static const char* const names[] = {
+        "file", "unreadable", "subdir", "link-to-file", "link-to-dir", "broken-link"
+    };
+    char* dir = g_dir_make_tmp("test-fm-file-info-XXXXXX", NULL);
+    char* name;
+    guint i;
+
+    g_assert(dir != NULL);
+    name = g_build_filename(dir, "file", NULL);
+    g_assert(g_file_set_contents(name, "some text\n", -1, NULL));
+    g_free(name);
+    name = g_build_filename(dir, "unreadable", NULL);
+    g_assert(g_file_set_contents(name, "", -1, NULL));
+    g_assert(g_chmod(name, 0200) == 0);
+    g_free(name);
+    name = g_build_filename(dir, "subdir", NULL);
+    g_assert(g_mkdir(name, 0755) == 0);
+    g_free(name);
+    name = g_build_filename(dir, "link-to-file", NULL);
+    g_assert(symlink("file", name) == 0);
+    g_free(name);
+    name = g_build_filename(dir, "link-to-dir", NULL);
+    g_assert(symlink("subdir", name) == 0);
+    g_free(name);
+    name = g_build_filename(dir, "broken-link", NULL);
+    g_assert(symlink("nonexistent", name) == 0);
+    g_free(name);
+
+    check_listing(dir, FALSE, G_N_ELEMENTS(names));
+    check_listing(dir, TRUE, 2); /* subdir and link-to-dir */
+
+    for(i = 0; i < G_N_ELEMENTS(names); ++i)
+    {
+        name = g_build_filename(dir, names[i], NULL);
+        g_remove(name);
+        g_free(name);
+    }
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+/* Files raised in priority are loaded before those queued earlier. */
+#define N_QUEUED 2000
+
+typedef struct
+{
+    GMutex lock;
+    GCond changed;
+    gboolean released; /* the workers may go on */
+    guint n_held;      /* workers waiting for that */
+    GPtrArray* order;  /* files in the order they were handled */
+} PriorityData;
+
+static gpointer record_order(FmFileInfo* fi, gpointer user_data)
+{
+    PriorityData* data = user_data;
+
+    g_mutex_lock(&data->lock);
+    data->n_held++;
+    g_cond_broadcast(&data->changed);
+    while(!data->released)
+        g_cond_wait(&data->changed, &data->lock);
+    g_ptr_array_add(data->order, fi);
+    g_cond_broadcast(&data->changed);
+    g_mutex_unlock(&data->lock);
+    return NULL;
+}
+
+static void test_deferred_priority()
+{
+    FmPath* path = fm_path_new_for_str("/tmp/queued");
+    FmFileInfo** files = g_new(FmFileInfo*, N_QUEUED + 1);
+    FmFileInfo* raised;
+    PriorityData data;
+    guint attribute, i;
+
+    g_mutex_init(&data.lock);
+    g_cond_init(&data.changed);
+    data.released = FALSE;
+    data.n_held = 0;
+    data.order = g_ptr_array_new();
+    attribute = fm_file_info_register_attribute("test-priority", FM_FILE_INFO_ATTRIBUTE_COST_CPU,
+                                                record_order, &data, NULL);
+    g_assert_cmpuint(attribute, !=, 0);
+    for(i = 0; i < N_QUEUED + 1; ++i)
+        files[i] = fm_file_info_new_from_path_unfilled(path);
+    raised = files[N_QUEUED];
+
+    /* the workers are held in the first files they take... */
+    for(i = 0; i < N_QUEUED; ++i)
+        fm_file_info_deferred_load_attribute(files[i], attribute, FALSE);
+    g_mutex_lock(&data.lock);
+    while(data.n_held == 0)
+        g_cond_wait(&data.changed, &data.lock);
+    g_mutex_unlock(&data.lock);
+
+    /* ...until the last file is queued with priority */
+    fm_file_info_deferred_load_attribute(raised, attribute, TRUE);
+    g_mutex_lock(&data.lock);
+    data.released = TRUE;
+    g_cond_broadcast(&data.changed);
+    while(data.order->len < N_QUEUED + 1)
+        g_cond_wait(&data.changed, &data.lock);
+    g_mutex_unlock(&data.lock);
+
+    /* Only the batches the workers took before it was queued, at most
+     * a few dozens of files per worker, are handled before it; in the
+     * order of queuing it would be the last one. */
+    for(i = 0; i < data.order->len; ++i)
+        if(g_ptr_array_index(data.order, i) == raised)
+            break;
+    g_assert_cmpuint(i, <, N_QUEUED / 4);
+
+    for(i = 0; i < N_QUEUED + 1; ++i)
+        fm_file_info_unref(files[i]);
+    g_free(files);
+    fm_path_unref(path);
+    g_ptr_array_free(data.order, TRUE);
+    g_cond_clear(&data.changed);
+    g_mutex_clear(&data.lock);
+}
+
+/* MIME types loaded for many files at once are the same as loaded one by one */
+static void test_load_mime_types()
+{
+    static const char* const names[] = {
+        "notes", "script", "empty", "page.html", "link", "subdir"
+    };
+    FmFileInfo* files[G_N_ELEMENTS(names)];
+    char* dir = g_dir_make_tmp("test-fm-file-info-XXXXXX", NULL);
+    gboolean deferred = fm_config->deferred_mime_type_loading;
+    gint64 deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+    char* name;
+    guint i, section;
+
+    g_assert(dir != NULL);
+    name = g_build_filename(dir, "notes", NULL);
+    g_assert(g_file_set_contents(name, "some text without a known extension\n", -1, NULL));
+    g_free(name);
+    name = g_build_filename(dir, "script", NULL);
+    g_assert(g_file_set_contents(name, "#!/bin/sh\necho a script without an extension\n", -1, NULL));
+    g_assert(g_chmod(name, 0755) == 0);
+    g_free(name);
+    name = g_build_filename(dir, "empty", NULL);
+    g_assert(g_file_set_contents(name, "", -1, NULL));
+    g_free(name);
+    name = g_build_filename(dir, "page.html", NULL);
+    g_assert(g_file_set_contents(name, "<html></html>\n", -1, NULL));
+    g_free(name);
+    name = g_build_filename(dir, "link", NULL);
+    g_assert(symlink("script", name) == 0);
+    g_free(name);
+    name = g_build_filename(dir, "subdir", NULL);
+    g_assert(g_mkdir(name, 0755) == 0);
+    g_free(name);
+
+    /* the files are queued to the deferred loader, which loads them at once */
+    fm_config->deferred_mime_type_loading = TRUE;
+    for(i = 0; i < G_N_ELEMENTS(names); ++i)
+    {
+        FmPath* path;
+        name = g_build_filename(dir, names[i], NULL);
+        path = fm_path_new_for_path(name);
+        files[i] = fm_file_info_new_from_native_file(path, name, NULL);
+        g_assert(files[i] != NULL);
+        fm_path_unref(path);
+        g_free(name);
+    }
+    for(i = 0; i < G_N_ELEMENTS(names); ++i)
+    {
+        while(!fm_file_info_icon_loaded(files[i]) && g_get_monotonic_time() < deadline)
+            g_main_context_iteration(NULL, FALSE);
+        g_assert(fm_file_info_icon_loaded(files[i]));
+    }
+
+    section = fm_file_info_read_begin();
+    for(i = 0; i < G_N_ELEMENTS(names); ++i)
+    {
+        FmMimeType* expected;
+        name = g_build_filename(dir, names[i], NULL);
+        expected = fm_mime_type_from_native_file(name, names[i], NULL);
+        g_assert_cmpstr(fm_mime_type_get_type(fm_file_info_get_mime_type(files[i])), ==,
+                        fm_mime_type_get_type(expected));
+        fm_mime_type_unref(expected);
+        g_free(name);
+    }
+    fm_file_info_read_end(section);
+
+    for(i = 0; i < G_N_ELEMENTS(names); ++i)
+        fm_file_info_unref(files[i]);
+    fm_config->deferred_mime_type_loading = deferred;
+
+    for(i = 0; i < G_N_ELEMENTS(names); ++i)
+    {
+        name = g_build_filename(dir, names[i], NULL);
+        g_remove(name);
+        g_free(name);
+    }
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+static gpointer compute_name_length(FmFileInfo* fi, gpointer user_data)
+{
+    g_atomic_int_inc((gint*)user_data);
+    return g_strdup_printf("%d", (int)strlen(fm_file_info_get_name(fi)));
+}
+
+/* attributes registered by the application are computed by the deferred
+ * loader and dropped when the file changes */
+static void test_attributes()
+{
+    static gint n_computed = 0;
+    guint attribute = fm_file_info_register_attribute("test::name-length", FM_FILE_INFO_ATTRIBUTE_COST_CPU,
+                                                      compute_name_length, &n_computed, g_free);
+    FmPath* path = fm_path_new_for_str("/usr/share/dummy.txt");
+    FmFileInfo* fi = fm_file_info_new_from_path_unfilled(path);
+    gint64 deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+    guint section;
+
+    g_assert_cmpuint(attribute, !=, 0);
+    g_assert_cmpuint(fm_file_info_register_attribute("test::name-length", FM_FILE_INFO_ATTRIBUTE_COST_CPU,
+                                                     compute_name_length, &n_computed, g_free), ==, attribute);
+    g_assert_cmpuint(fm_file_info_find_attribute("test::name-length"), ==, attribute);
+    g_assert_cmpuint(fm_file_info_find_attribute("test::unknown"), ==, 0);
+    g_assert(!fm_file_info_attribute_loaded(fi, attribute));
+
+    fm_file_info_deferred_load_attribute(fi, attribute, TRUE);
+    while(!fm_file_info_attribute_loaded(fi, attribute) && g_get_monotonic_time() < deadline)
+        g_main_context_iteration(NULL, FALSE);
+    g_assert(fm_file_info_attribute_loaded(fi, attribute));
+    section = fm_file_info_read_begin();
+    g_assert_cmpstr(fm_file_info_get_attribute(fi, attribute), ==, "9");
+    fm_file_info_read_end(section);
+
+    /* loaded already, nothing to do */
+    fm_file_info_deferred_load_attribute(fi, attribute, FALSE);
+    g_assert_cmpint(g_atomic_int_get(&n_computed), ==, 1);
+
+    {
+        FmFileInfo* changed = fm_file_info_new_from_path_unfilled(path);
+        fm_file_info_update(fi, changed);
+        fm_file_info_unref(changed);
+    }
+    g_assert(!fm_file_info_attribute_loaded(fi, attribute));
+    g_assert(fm_file_info_get_attribute(fi, attribute) == NULL);
+
+    fm_file_info_unref(fi);
+    fm_path_unref(path);
+}
+
+/* Each thread evaluates its own files. With process-wide locks the threads
+ * wait for each other; with striped locks they should not. */
+static void test_perf_contention()
+{
+    const int n_rounds = 200;
+    double single_time, multi_time;
+    char* what = g_strdup_printf("deferred evaluation of %d files, %d rounds", N_FILES, n_rounds);
+
+    create_test_files();
+    single_time = run_threads(1, TRUE, n_rounds);
+    multi_time = run_threads(N_THREADS, TRUE, n_rounds);
+    test_util_report_scaling(what, N_THREADS, single_time, multi_time);
+    g_free(what);
+    remove_test_files();
+}
+
+int main (int   argc, char *argv[])
+{
+    char* cache_dir;
+    int ret;
+
+    /* the content type cache is written there */
+    cache_dir = test_util_make_cache_dir("test-fm-file-info");
+
+    g_type_init();
+    fm_init(NULL);
+
+    g_test_init (&argc, &argv, NULL); // initialize test program
+    g_test_add_func("/FmFileInfo/concurrent_getters", test_concurrent_getters);
+    g_test_add_func("/FmFileInfo/retired_values", test_retired_values);
+    g_test_add_func("/FmFileInfo/disp_size_mtime", test_disp_size_mtime);
+    g_test_add_func("/FmFileInfo/ascii_collate_keys", test_ascii_collate_keys);
+    g_test_add_func("/FmFileInfo/native_fill_at", test_native_fill_at);
+    g_test_add_func("/FmFileInfo/deferred_priority", test_deferred_priority);
+    g_test_add_func("/FmFileInfo/load_mime_types", test_load_mime_types);
+    g_test_add_func("/FmFileInfo/attributes", test_attributes);
+    if(g_test_perf())
+        g_test_add_func("/FmFileInfo/perf/contention", test_perf_contention);
+
+    ret = g_test_run();
+    test_util_remove_dir(cache_dir);
+    g_free(cache_dir);
+    return ret;
+}
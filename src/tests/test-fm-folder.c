@@ -0,0 +1,283 @@
+/*
+ *      test-fm-folder.c
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <fm.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+#include <glib/gstdio.h>
+
+#include "test-util.h"
+
+//ignore for test disabled asserts
+#ifdef G_DISABLE_ASSERT
+    #undef G_DISABLE_ASSERT
+#endif
+
+#define N_FILES 300 /* more than snapshots are made for */
+
+static char* cache_dir = NULL;
+
+static void on_finish_loading(FmFolder* folder, GMainLoop* loop)
+{
+    g_main_loop_quit(loop);
+}
+
+static void wait_until_loaded(FmFolder* folder)
+{
+    GMainLoop* loop = g_main_loop_new(NULL, FALSE);
+    gulong handler = g_signal_connect(folder, "finish-loading", G_CALLBACK(on_finish_loading), loop);
+    if(!fm_folder_is_loaded(folder))
+        g_main_loop_run(loop);
+    g_signal_handler_disconnect(folder, handler);
+    g_main_loop_unref(loop);
+}
+
+static guint count_file(FmFolder* folder, const char* name)
+{
+    GList* l;
+    guint n = 0;
+
+    for(l = fm_file_info_list_peek_head_link(fm_folder_get_files(folder)); l; l = l->next)
+        if(strcmp(fm_file_info_get_name(l->data), name) == 0)
+            n++;
+    return n;
+}
+
+static guint count_snapshots(void)
+{
+    char* path = g_build_filename(cache_dir, "libsmfm", "folders", NULL);
+    GDir* dir = g_dir_open(path, 0, NULL);
+    const char* name;
+    guint n = 0;
+
+    if(dir)
+    {
+        while((name = g_dir_read_name(dir)))
+            if(g_str_has_suffix(name, ".snapshot"))
+                n++;
+        g_dir_close(dir);
+    }
+    g_free(path);
+    return n;
+}
+
+/* the second time the folder is opened, its files are shown before it's
+ * listed, and the listing fixes what was changed meanwhile */
+static void test_snapshot()
+{
+    char* dir = test_util_make_dir_with_files("test-fm-folder", "file%03d", N_FILES);
+    FmPath* dir_path;
+    FmFolder* folder;
+    char* name;
+
+    /* a snapshot isn't made of a folder changed in the last seconds,
+     * setting the time changes ctime, so wait for it to become old */
+    {
+        struct utimbuf times = { time(NULL) - 60, time(NULL) - 60 };
+        g_assert(g_utime(dir, &times) == 0);
+        g_usleep(2500000);
+    }
+    dir_path = fm_path_new_for_path(dir);
+
+    fm_config->folder_snapshots = TRUE;
+    folder = fm_folder_from_path(dir_path);
+    wait_until_loaded(folder);
+    g_assert_cmpuint(fm_file_info_list_get_length(fm_folder_get_files(folder)), ==, N_FILES);
+    g_object_unref(folder);
+
+    /* the content of a file changes, the folder doesn't; not with
+     * g_file_set_contents() which creates a new file */
+    {
+        FILE* f;
+        name = g_strdup_printf("%s/file000", dir);
+        f = g_fopen(name, "w");
+        g_assert(f != NULL);
+        fputs("some text\n", f);
+        fclose(f);
+        g_free(name);
+    }
+
+    folder = fm_folder_from_path(dir_path);
+    g_assert(!fm_folder_is_loaded(folder));
+    g_assert_cmpuint(fm_file_info_list_get_length(fm_folder_get_files(folder)), ==, N_FILES);
+    wait_until_loaded(folder);
+    g_assert_cmpuint(fm_file_info_list_get_length(fm_folder_get_files(folder)), ==, N_FILES);
+    g_assert_cmpuint(count_file(folder, "file000"), ==, 1);
+    g_assert_cmpint(fm_file_info_get_size(fm_folder_get_file_by_name(folder, "file000")), ==, 10);
+    g_object_unref(folder);
+
+    /* a removed file changes the folder, the snapshot is not used and
+     * is deleted */
+    name = g_strdup_printf("%s/file001", dir);
+    g_unlink(name);
+    g_free(name);
+    g_assert_cmpuint(count_snapshots(), ==, 1);
+    folder = fm_folder_from_path(dir_path);
+    g_assert_cmpuint(fm_file_info_list_get_length(fm_folder_get_files(folder)), ==, 0);
+    g_assert_cmpuint(count_snapshots(), ==, 0);
+    wait_until_loaded(folder);
+    g_assert_cmpuint(fm_file_info_list_get_length(fm_folder_get_files(folder)), ==, N_FILES - 1);
+    g_assert_cmpuint(count_file(folder, "file001"), ==, 0);
+    g_object_unref(folder);
+    fm_config->folder_snapshots = FALSE;
+
+    test_util_remove_dir(dir);
+    g_free(dir);
+    fm_path_unref(dir_path);
+}
+
+/* files created and deleted while the folder is shown are found by name */
+static void on_files_changed(FmFolder* folder, GSList* files, GMainLoop* loop)
+{
+    g_main_loop_quit(loop);
+}
+
+static gboolean on_timeout(gpointer loop)
+{
+    g_main_loop_quit(loop);
+    return FALSE;
+}
+
+static void wait_for_signal(FmFolder* folder, const char* signal)
+{
+    GMainLoop* loop = g_main_loop_new(NULL, FALSE);
+    gulong handler = g_signal_connect(folder, signal, G_CALLBACK(on_files_changed), loop);
+    guint timeout = g_timeout_add_seconds(10, on_timeout, loop);
+    g_main_loop_run(loop);
+    g_source_remove(timeout);
+    g_signal_handler_disconnect(folder, handler);
+    g_main_loop_unref(loop);
+}
+
+static void test_file_by_name()
+{
+    char* dir = test_util_make_dir_with_files("test-fm-folder", "file%03d", 10);
+    FmPath* dir_path;
+    FmFolder* folder;
+    char* name;
+    int i;
+
+    dir_path = fm_path_new_for_path(dir);
+    folder = fm_folder_from_path(dir_path);
+    wait_until_loaded(folder);
+    for(i = 0; i < 10; ++i)
+    {
+        name = g_strdup_printf("file%03d", i);
+        g_assert(fm_folder_get_file_by_name(folder, name) != NULL);
+        g_assert_cmpstr(fm_file_info_get_name(fm_folder_get_file_by_name(folder, name)), ==, name);
+        g_free(name);
+    }
+    g_assert(fm_folder_get_file_by_name(folder, "new") == NULL);
+
+    name = g_build_filename(dir, "new", NULL);
+    g_assert(g_file_set_contents(name, "", -1, NULL));
+    wait_for_signal(folder, "files-added");
+    g_assert(fm_folder_get_file_by_name(folder, "new") != NULL);
+
+    g_unlink(name);
+    wait_for_signal(folder, "files-removed");
+    g_assert(fm_folder_get_file_by_name(folder, "new") == NULL);
+    g_assert(fm_folder_get_file_by_name(folder, "file000") != NULL);
+    g_free(name);
+
+    g_object_unref(folder);
+    fm_path_unref(dir_path);
+    test_util_remove_dir(dir);
+    g_free(dir);
+}
+
+/* a storm of events is handled in batches of bounded size */
+#define N_STORM_FILES 2000
+#define STORM_BATCH 100
+
+typedef struct
+{
+    GMainLoop* loop;
+    guint n_added;
+    guint max_added;
+} StormData;
+
+static void on_storm_files_added(FmFolder* folder, GSList* files, StormData* data)
+{
+    guint n = g_slist_length(files);
+    data->n_added += n;
+    data->max_added = MAX(data->max_added, n);
+    if(data->n_added >= N_STORM_FILES)
+        g_main_loop_quit(data->loop);
+}
+
+static void test_event_storm()
+{
+    char* dir = test_util_make_dir("test-fm-folder");
+    gint old_batch = fm_config->monitor_max_batch;
+    StormData data = { NULL, 0, 0 };
+    FmPath* dir_path;
+    FmFolder* folder;
+    gulong handler;
+    guint timeout;
+
+    fm_config->monitor_max_batch = STORM_BATCH;
+    dir_path = fm_path_new_for_path(dir);
+    folder = fm_folder_from_path(dir_path);
+    wait_until_loaded(folder);
+
+    test_util_create_files(dir, "storm%04d", 0, N_STORM_FILES);
+
+    data.loop = g_main_loop_new(NULL, FALSE);
+    handler = g_signal_connect(folder, "files-added", G_CALLBACK(on_storm_files_added), &data);
+    timeout = g_timeout_add_seconds(60, on_timeout, data.loop);
+    g_main_loop_run(data.loop);
+    g_source_remove(timeout);
+    g_signal_handler_disconnect(folder, handler);
+    g_main_loop_unref(data.loop);
+
+    g_assert_cmpuint(data.n_added, ==, N_STORM_FILES);
+    g_assert_cmpuint(data.max_added, <=, STORM_BATCH);
+    g_assert_cmpuint(fm_file_info_list_get_length(fm_folder_get_files(folder)), ==, N_STORM_FILES);
+    g_assert_cmpuint(count_file(folder, "storm0000"), ==, 1);
+
+    fm_config->monitor_max_batch = old_batch;
+    g_object_unref(folder);
+    fm_path_unref(dir_path);
+    test_util_remove_dir(dir);
+    g_free(dir);
+}
+
+int main (int   argc, char *argv[])
+{
+    int ret;
+
+    cache_dir = test_util_make_cache_dir("test-fm-folder");
+
+    g_type_init();
+    fm_init(NULL);
+
+    g_test_init (&argc, &argv, NULL); // initialize test program
+    g_test_add_func("/FmFolder/snapshot", test_snapshot);
+    g_test_add_func("/FmFolder/file_by_name", test_file_by_name);
+    g_test_add_func("/FmFolder/event_storm", test_event_storm);
+
+    ret = g_test_run();
+    test_util_remove_dir(cache_dir);
+    g_free(cache_dir);
+    return ret;
+}
@@ -0,0 +1,375 @@
+/*
+ *      test-fm-mime-type.c
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <fm.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+#include <glib/gstdio.h>
+
+#include "test-util.h"
+
+//ignore for test disabled asserts
+#ifdef G_DISABLE_ASSERT
+    #undef G_DISABLE_ASSERT
+#endif
+
+#define TEXT   "some text to tell the type by\n"
+#define SCRIPT "#!/bin/sh\necho the same size \n"
+
+static char* cache_dir = NULL;
+
+/* writes the file in place, its inode is the same */
+static void rewrite(const char* file, const char* content, time_t mtime)
+{
+    struct utimbuf times = { mtime, mtime };
+    FILE* f = g_fopen(file, "r+");
+    g_assert(f != NULL);
+    fputs(content, f);
+    fclose(f);
+    g_assert(g_utime(file, &times) == 0);
+}
+
+static char* type_of(const char* file)
+{
+    FmMimeType* mime_type = fm_mime_type_from_native_file(file, "notes", NULL);
+    char* type = g_strdup(fm_mime_type_get_type(mime_type));
+    fm_mime_type_unref(mime_type);
+    return type;
+}
+
+/* a file not changed since its content was read is not read again */
+static void test_content_type_cache()
+{
+    char* dir = g_dir_make_tmp("test-fm-mime-type-XXXXXX", NULL);
+    char* file = g_build_filename(dir, "notes", NULL);
+    char* text_type = g_content_type_guess("notes", (const guchar*)TEXT, strlen(TEXT), NULL);
+    char* script_type = g_content_type_guess("notes", (const guchar*)SCRIPT, strlen(SCRIPT), NULL);
+    time_t old = time(NULL) - 3600;
+    FmFileInfo* fi;
+    char* type;
+
+    g_assert_cmpuint(strlen(TEXT), ==, strlen(SCRIPT));
+    g_assert(g_file_set_contents(file, TEXT, -1, NULL));
+    rewrite(file, TEXT, old);
+    type = type_of(file);
+    g_assert_cmpstr(type, ==, text_type);
+    g_free(type);
+
+    /* the same size and time, the type is taken from the cache */
+    rewrite(file, SCRIPT, old);
+    type = type_of(file);
+    g_assert_cmpstr(type, ==, text_type);
+    g_free(type);
+    /* file infos stat() files another way, they should find it too */
+    fi = fm_file_info_new_from_native_file(NULL, file, NULL);
+    g_assert(fi != NULL);
+    g_assert_cmpstr(fm_mime_type_get_type(fm_file_info_get_mime_type(fi)), ==, text_type);
+    fm_file_info_unref(fi);
+
+    /* another time, the file is read */
+    rewrite(file, SCRIPT, old + 60);
+    type = type_of(file);
+    g_assert_cmpstr(type, ==, script_type);
+    g_free(type);
+
+    /* a file just modified may be modified again in the same second, so
+     * it's not stored */
+    rewrite(file, TEXT, time(NULL));
+    type = type_of(file);
+    g_assert_cmpstr(type, ==, text_type);
+    g_free(type);
+    rewrite(file, SCRIPT, time(NULL));
+    type = type_of(file);
+    g_assert_cmpstr(type, ==, script_type);
+    g_free(type);
+
+    g_free(text_type);
+    g_free(script_type);
+    g_unlink(file);
+    g_free(file);
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+/* types guessed by name are the same as GIO guesses, also when cached */
+static void test_name_guess_cache()
+{
+    static const char* const names[] = {
+        "photo.jpg", "other.jpg", "PHOTO.JPG", "archive.tar.gz", "file.gz", "a.b.tar.gz",
+        "Makefile", "Makefile.am", "makefile", "README", "README.txt", "notes~", "notes.txt~",
+        "core", "noext", "other", "page.html", "page.HTML", ".hidden", "trailing.", "dir/file.c"
+    };
+    int round;
+    guint i;
+
+    for(round = 0; round < 2; ++round)
+    {
+        for(i = 0; i < G_N_ELEMENTS(names); ++i)
+        {
+            FmMimeType* mime_type = fm_mime_type_from_file_name(names[i]);
+            char* expected = g_content_type_guess(names[i], NULL, 0, NULL);
+            g_assert_cmpstr(fm_mime_type_get_type(mime_type), ==, expected);
+            g_free(expected);
+            fm_mime_type_unref(mime_type);
+        }
+    }
+}
+
+/* headers of common formats, and of some that only look like them */
+static const struct
+{
+    const char* head;
+    gsize len;
+} magic_samples[] = {
+#define SAMPLE(s) { s, sizeof(s) - 1 }
+    SAMPLE("\x89PNG\r\n\x1a\n\0\0\0\rIHDR"),
+    SAMPLE("\xff\xd8\xff\xe0\0\x10JFIF\0"),
+    SAMPLE("GIF89a"),
+    SAMPLE("II*\0\x08\0\0\0"),
+    SAMPLE("RIFF\0\0\0\0WEBPVP8 "),
+    SAMPLE("RIFF\0\0\0\0WAVEfmt "),
+    SAMPLE("RIFF\0\0\0\0AVI LIST"),
+    SAMPLE("RIFF\0\0\0\0XXXX"),
+    SAMPLE("%PDF-1.4\n"),
+    SAMPLE("PK\x03\x04\x14\0\0\0\x08\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\x05\0\0\0a.txt"),
+    SAMPLE("PK\x03\x04\x14\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\x08\0\0\0mimetypeapplication/vnd.oasis.opendocument.text"),
+    SAMPLE("\x1f\x8b\x08\0\0\0\0\0"),
+    SAMPLE("BZh91AY&SY"),
+    SAMPLE("\xfd" "7zXZ\0\0"),
+    SAMPLE("7z\xbc\xaf\x27\x1c\0\x04"),
+    SAMPLE("Rar!\x1a\x07\0"),
+    SAMPLE("!<arch>\ndebian-binary   "),
+    SAMPLE("!<arch>\nfoo.o/          "),
+    SAMPLE("fLaC\0\0\0\x22"),
+    SAMPLE("ID3\x03\0\0\0\0\0\0"),
+    SAMPLE("OggS\0\x02\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\x01\x1e\x01vorbis"),
+    SAMPLE("OggS\0\x02\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\x01\x13OpusHead"),
+    SAMPLE("\0\0\0\x20" "ftypisom\0\0\x02\0isomiso2"),
+    SAMPLE("\0\0\0\x20" "ftypM4A \0\0\0\0M4A mp42"),
+    SAMPLE("\x1a\x45\xdf\xa3\xa3\x42\x86\x81\x01\x42\x82\x88matroska"),
+    SAMPLE("\x1a\x45\xdf\xa3\x9f\x42\x86\x81\x01\x42\x82\x84webm"),
+    SAMPLE("SQLite format 3\0"),
+    SAMPLE("wOFF\0\x01\0\0"),
+    SAMPLE("\0asm\x01\0\0\0"),
+    SAMPLE("MThd\0\0\0\x06"),
+    SAMPLE("not a known format at all"),
+#undef SAMPLE
+};
+
+/* files of common formats without extensions are recognized by their
+ * magic numbers, the same as GIO does */
+static void test_magic_sniffer()
+{
+    char* dir = g_dir_make_tmp("test-fm-mime-type-XXXXXX", NULL);
+    GRand* rand = g_rand_new_with_seed(22);
+    guchar data[1024];
+    guint i, j;
+
+    for(i = 0; i < G_N_ELEMENTS(magic_samples); ++i)
+    {
+        char* name = g_strdup_printf("sample%02u", i);
+        char* file = g_build_filename(dir, name, NULL);
+        FmMimeType* mime_type;
+        char* expected;
+
+        for(j = 0; j < sizeof(data); ++j)
+            data[j] = g_rand_int_range(rand, 0, 256);
+        memcpy(data, magic_samples[i].head, magic_samples[i].len);
+        g_assert(g_file_set_contents(file, (const char*)data, sizeof(data), NULL));
+
+        mime_type = fm_mime_type_from_native_file(file, name, NULL);
+        expected = g_content_type_guess(name, data, sizeof(data), NULL);
+        g_assert_cmpstr(fm_mime_type_get_type(mime_type), ==, expected);
+        g_free(expected);
+        fm_mime_type_unref(mime_type);
+        g_unlink(file);
+        g_free(file);
+        g_free(name);
+    }
+    g_rand_free(rand);
+    g_rmdir(dir);
+    g_free(dir);
+}
+
+/* the classes are the same as GIO tells */
+static void test_type_classes()
+{
+    static const char* const types[] = {
+        "text/plain", "text/x-csrc", "text/x-shellscript", "text/html", "application/xml",
+        "image/png", "image/svg+xml", "audio/mpeg", "video/mp4", "application/zip",
+        "application/x-compressed-tar", "application/x-executable", "application/x-sharedlib",
+        "application/x-desktop", "application/octet-stream", "inode/directory", "x-nonexistent/type"
+    };
+    guint i;
+
+    for(i = 0; i < G_N_ELEMENTS(types); ++i)
+    {
+        FmMimeType* mime_type = fm_mime_type_from_name(types[i]);
+        FmMimeTypeClasses classes = fm_mime_type_get_classes(mime_type);
+
+        g_assert_cmpint(!!(classes & FM_MIME_TYPE_CLASS_TEXT), ==, !!g_content_type_is_a(types[i], "text/plain"));
+        g_assert_cmpint(!!(classes & FM_MIME_TYPE_CLASS_UNKNOWN), ==, !!g_content_type_is_unknown(types[i]));
+        g_assert_cmpint(!!(classes & FM_MIME_TYPE_CLASS_IMAGE), ==, g_str_has_prefix(types[i], "image/"));
+        g_assert_cmpint(!!(classes & FM_MIME_TYPE_CLASS_AUDIO), ==, g_str_has_prefix(types[i], "audio/"));
+        g_assert_cmpint(!!(classes & FM_MIME_TYPE_CLASS_VIDEO), ==, g_str_has_prefix(types[i], "video/"));
+        g_assert_cmpint(!!(classes & FM_MIME_TYPE_CLASS_SCRIPT), ==, g_str_has_prefix(types[i], "text/"));
+        if(!g_str_has_prefix(types[i], "text/"))
+            g_assert_cmpint(!!(classes & FM_MIME_TYPE_CLASS_EXECUTABLE), ==,
+                            !!g_content_type_can_be_executable(types[i]));
+        g_assert_cmpint(!!(classes & FM_MIME_TYPE_CLASS_DESKTOP_ENTRY), ==,
+                        strcmp(types[i], "application/x-desktop") == 0);
+        fm_mime_type_unref(mime_type);
+    }
+
+    {
+        FmMimeType* zip = fm_mime_type_from_name("application/zip");
+        FmMimeType* tgz = fm_mime_type_from_name("application/x-compressed-tar");
+        FmMimeType* text = fm_mime_type_from_name("text/plain");
+        g_assert(fm_mime_type_get_classes(zip) & FM_MIME_TYPE_CLASS_ARCHIVE);
+        g_assert(fm_mime_type_get_classes(tgz) & FM_MIME_TYPE_CLASS_ARCHIVE);
+        g_assert(!(fm_mime_type_get_classes(text) & FM_MIME_TYPE_CLASS_ARCHIVE));
+        fm_mime_type_unref(zip);
+        fm_mime_type_unref(tgz);
+        fm_mime_type_unref(text);
+    }
+    g_assert_cmpint(fm_mime_type_get_classes(NULL), ==, 0);
+}
+
+#define N_THREADS 4
+#define N_NEW_TYPES 2000 /* enough to make the registry grow */
+
+typedef struct
+{
+    int first;
+    FmMimeType** types;
+    guint n_rounds;
+} RegistryThread;
+
+/* threads add the same new types in different order */
+static gpointer add_types_thread(gpointer data)
+{
+    RegistryThread* thread = data;
+    int i;
+
+    for(i = 0; i < N_NEW_TYPES; ++i)
+    {
+        int n = (thread->first + i) % N_NEW_TYPES;
+        char* name = g_strdup_printf("application/x-test-%d", n);
+        thread->types[n] = fm_mime_type_from_name(name);
+        g_free(name);
+    }
+    return NULL;
+}
+
+/* each type name has one object, also when added by threads at once */
+static void test_concurrent_registry()
+{
+    RegistryThread threads[N_THREADS];
+    int t, i;
+
+    for(t = 0; t < N_THREADS; ++t)
+    {
+        threads[t].first = t * N_NEW_TYPES / N_THREADS;
+        threads[t].types = g_new0(FmMimeType*, N_NEW_TYPES);
+    }
+    test_util_run_threads(N_THREADS, add_types_thread, threads, sizeof(RegistryThread));
+
+    for(i = 0; i < N_NEW_TYPES; ++i)
+    {
+        char* name = g_strdup_printf("application/x-test-%d", i);
+        FmMimeType* mime_type = fm_mime_type_from_name(name);
+        g_assert_cmpstr(fm_mime_type_get_type(mime_type), ==, name);
+        for(t = 0; t < N_THREADS; ++t)
+            g_assert(threads[t].types[i] == mime_type);
+        fm_mime_type_unref(mime_type);
+        g_free(name);
+    }
+    for(t = 0; t < N_THREADS; ++t)
+    {
+        for(i = 0; i < N_NEW_TYPES; ++i)
+            fm_mime_type_unref(threads[t].types[i]);
+        g_free(threads[t].types);
+    }
+}
+
+static const char* const common_types[] = {
+    "text/plain", "image/jpeg", "image/png", "application/pdf", "inode/directory",
+    "application/x-executable", "text/x-csrc", "audio/mpeg", "video/mp4", "application/zip"
+};
+
+static gpointer lookup_thread(gpointer data)
+{
+    RegistryThread* thread = data;
+    guint i;
+
+    for(i = 0; i < thread->n_rounds; ++i)
+        fm_mime_type_unref(fm_mime_type_from_name(common_types[i % G_N_ELEMENTS(common_types)]));
+    return NULL;
+}
+
+static double run_lookups(int n_threads, guint n_rounds)
+{
+    RegistryThread threads[N_THREADS];
+    int t;
+
+    for(t = 0; t < n_threads; ++t)
+        threads[t].n_rounds = n_rounds;
+    return test_util_run_threads(n_threads, lookup_thread, threads, sizeof(RegistryThread));
+}
+
+/* Each thread does the same number of lookups. Without a lock on the
+ * lookups, more threads do more of them in the same time. */
+static void test_perf_registry_lookup()
+{
+    const guint n_rounds = 2000000;
+    double single_time, multi_time;
+    char* what = g_strdup_printf("%u lookups per thread", n_rounds);
+
+    single_time = run_lookups(1, n_rounds);
+    multi_time = run_lookups(N_THREADS, n_rounds);
+    test_util_report_scaling(what, N_THREADS, single_time, multi_time);
+    g_free(what);
+}
+
+int main (int   argc, char *argv[])
+{
+    int ret;
+
+    cache_dir = test_util_make_cache_dir("test-fm-mime-type");
+
+    g_type_init();
+    fm_init(NULL);
+
+    g_test_init (&argc, &argv, NULL); // initialize test program
+    g_test_add_func("/FmMimeType/content_type_cache", test_content_type_cache);
+    g_test_add_func("/FmMimeType/name_guess_cache", test_name_guess_cache);
+    g_test_add_func("/FmMimeType/magic_sniffer", test_magic_sniffer);
+    g_test_add_func("/FmMimeType/type_classes", test_type_classes);
+    g_test_add_func("/FmMimeType/concurrent_registry", test_concurrent_registry);
+    if(g_test_perf())
+        g_test_add_func("/FmMimeType/perf/registry_lookup", test_perf_registry_lookup);
+
+    ret = g_test_run();
+    test_util_remove_dir(cache_dir);
+    g_free(cache_dir);
+    return ret;
+}
@@ -20,6 +20,7 @@
  */
 
 #include <fm.h>
+#include <string.h>
 
 //ignore for test disabled asserts
 #ifdef G_DISABLE_ASSERT
@@ -384,6 +385,28 @@ static void test_path_child()
 */
 }
 
+static void test_remote_child_escaping()
+{
+    static const char* const names[] = {
+        "plain-name_1.txt", "with space", "100%", "a+b=c&d", "caf\xc3\xa9",
+        "bad\xe9utf8", "cut\xe2\x82", "~tilde", "[x]{y}#?"
+    };
+    FmPath* parent = fm_path_new_for_uri("sftp://host/dir");
+    guint i;
+
+    for(i = 0; i < G_N_ELEMENTS(names); ++i)
+    {
+        char* escaped = g_uri_escape_string(names[i], "/", TRUE);
+        FmPath* path = fm_path_new_child(parent, names[i]);
+
+        /* should be the same as g_uri_escape_string() gives */
+        g_assert_cmpstr(fm_path_get_basename(path), ==, escaped);
+        fm_path_unref(path);
+        g_free(escaped);
+    }
+    fm_path_unref(parent);
+}
+
 static void test_predefined_paths()
 {
     FmPath* path;
@@ -432,6 +455,285 @@ static void test_predefined_paths()
 */
 }
 
+static void test_path_interning()
+{
+    FmPath *path, *path2;
+
+    path = fm_path_new_for_path("/test/interning/file");
+    path2 = fm_path_new_for_str("/test//interning/./file/");
+    g_assert(path == path2);
+    fm_path_unref(path2);
+
+    path2 = fm_path_new_child(fm_path_get_parent(path), "file");
+    g_assert(path == path2);
+    g_assert(fm_path_equal(path, path2));
+    fm_path_unref(path2);
+
+    path2 = fm_path_new_for_uri("file:///test/interning/file");
+    g_assert(path == path2);
+    fm_path_unref(path2);
+
+    path2 = fm_path_new_child(fm_path_get_parent(path), "other");
+    g_assert(path != path2);
+    g_assert(!fm_path_equal(path, path2));
+    g_assert(fm_path_get_parent(path) == fm_path_get_parent(path2));
+    fm_path_unref(path2);
+    fm_path_unref(path);
+
+    path = fm_path_new_for_uri("sftp://user@host/test/file");
+    path2 = fm_path_new_for_uri("sftp://user@host/test//file/");
+    g_assert(path == path2);
+    fm_path_unref(path2);
+    path2 = fm_path_new_for_uri("sftp://user@otherhost/test/file");
+    g_assert(path != path2);
+    g_assert(fm_path_get_scheme_path(path) != fm_path_get_scheme_path(path2));
+    fm_path_unref(path2);
+    fm_path_unref(path);
+
+    path = fm_path_new_for_uri("computer:///");
+    g_assert(path == fm_path_get_computer());
+    fm_path_unref(path);
+
+    path = fm_path_new_for_path(fm_get_home_dir());
+    g_assert(path == fm_path_get_home());
+    fm_path_unref(path);
+}
+
+static void test_root_registry()
+{
+    FmPath* paths[100];
+    char uri[64];
+    int i;
+
+    /* enough hosts to make the registry grow a few times */
+    for(i = 0; i < (int)G_N_ELEMENTS(paths); ++i)
+    {
+        g_snprintf(uri, sizeof(uri), "sftp://user@host%d/dir", i);
+        paths[i] = fm_path_new_for_uri(uri);
+    }
+    for(i = 0; i < (int)G_N_ELEMENTS(paths); ++i)
+    {
+        FmPath* path;
+        g_snprintf(uri, sizeof(uri), "sftp://user@host%d/", i);
+        g_assert_cmpstr(fm_path_get_basename(fm_path_get_parent(paths[i])), ==, uri);
+        path = fm_path_new_for_uri(uri);
+        g_assert(path == fm_path_get_parent(paths[i]));
+        fm_path_unref(path);
+        g_snprintf(uri, sizeof(uri), "smb://user@host%d/", i);
+        path = fm_path_new_for_uri(uri);
+        g_assert(path != fm_path_get_parent(paths[i]));
+        fm_path_unref(path);
+    }
+    for(i = 0; i < (int)G_N_ELEMENTS(paths); ++i)
+        fm_path_unref(paths[i]);
+
+    /* mailto: roots are not kept by the registry, but are still unique */
+    for(i = 0; i < (int)G_N_ELEMENTS(paths); ++i)
+    {
+        FmPath* path;
+        g_snprintf(uri, sizeof(uri), "mailto:user%d@host", i);
+        paths[i] = fm_path_new_for_uri(uri);
+        path = fm_path_new_for_uri(uri);
+        g_assert(path == paths[i]);
+        g_assert_cmpint(fm_path_get_flags(path), ==, 0);
+        fm_path_unref(path);
+    }
+    for(i = 0; i < (int)G_N_ELEMENTS(paths); ++i)
+        fm_path_unref(paths[i]);
+}
+
+static void test_path_to_str()
+{
+    static const char* native[] = {
+        "/", "/usr", "/usr/share/doc",
+        "/tmp/a b/#%?[]{}<>\"\\^`|;/!$&'()*+,-.:=@_~",
+        "/tmp/\xd0\x9f\xd1\x80\xd0\xb8/\xff\xfe"
+    };
+    static const char* remote[] = {
+        "sftp://user@host/", "sftp://user@host/dir/file%20name", "trash:///file"
+    };
+    char buf[256];
+    int i;
+
+    for(i = 0; i < (int)G_N_ELEMENTS(native); ++i)
+    {
+        FmPath* path = fm_path_new_for_path(native[i]);
+        char* uri = g_filename_to_uri(native[i], NULL, NULL);
+        char* str;
+        int pass;
+
+        /* conversion must not depend on what was converted before */
+        for(pass = 0; pass < 2; ++pass)
+        {
+            str = fm_path_to_str(path);
+            g_assert_cmpstr(str, ==, native[i]);
+            g_free(str);
+            str = fm_path_to_uri(path);
+            g_assert_cmpstr(str, ==, uri);
+            g_free(str);
+
+            g_assert_cmpuint(fm_path_to_str_buf(path, buf, sizeof(buf)), ==, strlen(native[i]));
+            g_assert_cmpstr(buf, ==, native[i]);
+            g_assert_cmpuint(fm_path_to_uri_buf(path, buf, sizeof(buf)), ==, strlen(uri));
+            g_assert_cmpstr(buf, ==, uri);
+        }
+
+        /* too small buffer is not touched */
+        strcpy(buf, "untouched");
+        g_assert_cmpuint(fm_path_to_uri_buf(path, buf, strlen(uri)), ==, strlen(uri));
+        g_assert_cmpstr(buf, ==, "untouched");
+        g_assert_cmpuint(fm_path_to_str_buf(path, NULL, 0), ==, strlen(native[i]));
+
+        g_free(uri);
+        fm_path_unref(path);
+    }
+
+    for(i = 0; i < (int)G_N_ELEMENTS(remote); ++i)
+    {
+        FmPath* path = fm_path_new_for_uri(remote[i]);
+        char* str = fm_path_to_uri(path);
+        g_assert_cmpstr(str, ==, remote[i]);
+        g_free(str);
+        g_assert_cmpuint(fm_path_to_str_buf(path, buf, sizeof(buf)), ==, strlen(remote[i]));
+        g_assert_cmpstr(buf, ==, remote[i]);
+        fm_path_unref(path);
+    }
+}
+
+/* reference implementations which walk the whole path every time,
+   they are used to compare with the precomputed values */
+static guint walk_path_hash(FmPath* path)
+{
+    guint hash = g_str_hash(fm_path_get_basename(path));
+    if(fm_path_get_parent(path))
+    {
+        hash = (hash << 5) - hash + '/';
+        hash ^= walk_path_hash(fm_path_get_parent(path));
+    }
+    return hash;
+}
+
+static gboolean walk_path_equal(FmPath* p1, FmPath* p2)
+{
+    if(p1 == p2)
+        return TRUE;
+    if(!p1 || !p2)
+        return FALSE;
+    if(strcmp(fm_path_get_basename(p1), fm_path_get_basename(p2)) != 0)
+        return FALSE;
+    return walk_path_equal(fm_path_get_parent(p1), fm_path_get_parent(p2));
+}
+
+static int walk_path_depth(FmPath* path)
+{
+    int depth = 1;
+    while((path = fm_path_get_parent(path)))
+        ++depth;
+    return depth;
+}
+
+static FmPath* new_deep_path(FmPath* parent, const char* leaf, int depth)
+{
+    FmPath* path = fm_path_ref(parent);
+    int i;
+    for(i = 0; i < depth; ++i)
+    {
+        char name[32];
+        FmPath* child;
+        g_snprintf(name, sizeof(name), "%s%02d", (i == depth - 1) ? leaf : "component", i);
+        child = fm_path_new_child(path, name);
+        fm_path_unref(path);
+        path = child;
+    }
+    return path;
+}
+
+static void test_path_hash_depth()
+{
+    FmPath* p1 = new_deep_path(fm_path_get_root(), "leaf", 24);
+    FmPath* p2 = new_deep_path(fm_path_get_root(), "other", 24);
+    FmPath* remote = fm_path_new_for_uri("sftp://host/a/b/c");
+
+    g_assert_cmpuint(fm_path_hash(p1), ==, walk_path_hash(p1));
+    g_assert_cmpuint(fm_path_hash(remote), ==, walk_path_hash(remote));
+    g_assert_cmpint(fm_path_depth(p1), ==, 25);
+    g_assert_cmpint(fm_path_depth(p1), ==, walk_path_depth(p1));
+    g_assert_cmpint(fm_path_depth(remote), ==, walk_path_depth(remote));
+
+    g_assert(!fm_path_equal(p1, p2));
+    g_assert(fm_path_has_prefix(p1, fm_path_get_parent(p2)));
+    g_assert(!fm_path_has_prefix(fm_path_get_parent(p2), p1));
+    g_assert(!fm_path_has_prefix(remote, p1));
+
+    /* same depth: ordered by the topmost different element */
+    g_assert_cmpint(fm_path_compare(p1, p2), <, 0);
+    g_assert_cmpint(fm_path_compare(p2, p1), >, 0);
+    g_assert_cmpint(fm_path_compare(p1, p1), ==, 0);
+    /* different depth: shorter goes first */
+    g_assert_cmpint(fm_path_compare(fm_path_get_parent(p1), p2), <, 0);
+    g_assert_cmpint(fm_path_compare(p2, fm_path_get_root()), >, 0);
+
+    fm_path_unref(remote);
+    fm_path_unref(p2);
+    fm_path_unref(p1);
+}
+
+static void test_path_children_batch()
+{
+    static const char* const names[] = {"a", ".", "..", "b/c", "", "a", "d"};
+    FmPath* parent = fm_path_new_for_path("/tmp");
+    FmPath* out[G_N_ELEMENTS(names)];
+    FmPath* a = fm_path_new_child(parent, "a");
+    guint n;
+
+    n = fm_path_new_children_batch(parent, names, G_N_ELEMENTS(names), out);
+    g_assert_cmpuint(n, ==, 3);
+    g_assert(out[0] == a);
+    g_assert(out[1] == NULL);
+    g_assert(out[2] == NULL);
+    g_assert(out[3] == NULL);
+    g_assert(out[4] == NULL);
+    g_assert(out[5] == a);
+    g_assert_cmpstr(fm_path_get_basename(out[6]), ==, "d");
+    g_assert(fm_path_get_parent(out[6]) == parent);
+
+    fm_path_unref(out[0]);
+    fm_path_unref(out[5]);
+    fm_path_unref(out[6]);
+    fm_path_unref(a);
+    fm_path_unref(parent);
+}
+
+static void test_path_perf_deep()
+{
+    /* two equal paths made of different objects is not possible anymore,
+       so the reference implementation is compared on siblings instead */
+    FmPath* p1 = new_deep_path(fm_path_get_root(), "leaf", 24);
+    FmPath* p2 = new_deep_path(fm_path_get_root(), "other", 24);
+    const int n_iter = 1000000;
+    guint sum = 0;
+    double walk_time, cached_time;
+    int i;
+
+    g_test_timer_start();
+    for(i = 0; i < n_iter; ++i)
+        sum += walk_path_hash(p1) + walk_path_equal(p1, p2) + walk_path_depth(p1);
+    walk_time = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    for(i = 0; i < n_iter; ++i)
+        sum += fm_path_hash(p1) + fm_path_equal(p1, p2) + fm_path_depth(p1);
+    cached_time = g_test_timer_elapsed();
+
+    g_test_message("hash+equal+depth on depth 25 paths, %d iterations (%u): "
+                   "walking %.3f s, precomputed %.3f s", n_iter, sum, walk_time, cached_time);
+    g_test_minimized_result(cached_time, "precomputed: %.3f s", cached_time);
+    g_assert_cmpfloat(cached_time, <, walk_time);
+
+    fm_path_unref(p2);
+    fm_path_unref(p1);
+}
+
 int main (int   argc, char *argv[])
 {
     g_type_init();
@@ -439,9 +741,17 @@ int main (int   argc, char *argv[])
 
     g_test_init (&argc, &argv, NULL); // initialize test program
     g_test_add_func("/FmPath/new_child_len", test_path_child);
+    g_test_add_func("/FmPath/remote_child_escaping", test_remote_child_escaping);
     g_test_add_func("/FmPath/path_parsing", test_path_parsing);
     g_test_add_func("/FmPath/uri_parsing", test_uri_parsing);
     g_test_add_func("/FmPath/predefined_paths", test_predefined_paths);
+    g_test_add_func("/FmPath/interning", test_path_interning);
+    g_test_add_func("/FmPath/root_registry", test_root_registry);
+    g_test_add_func("/FmPath/to_str", test_path_to_str);
+    g_test_add_func("/FmPath/hash_depth", test_path_hash_depth);
+    g_test_add_func("/FmPath/children_batch", test_path_children_batch);
+    if(g_test_perf())
+        g_test_add_func("/FmPath/perf/deep_paths", test_path_perf_deep);
 
     return g_test_run();
 }
@@ -0,0 +1,128 @@
+/*
+ *      test-util.c
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <glib/gstdio.h>
+
+#include "test-util.h"
+
+//ignore for test disabled asserts
+#ifdef G_DISABLE_ASSERT
+    #undef G_DISABLE_ASSERT
+#endif
+
+/* Creates an empty directory and points XDG_CACHE_HOME to it, so the
+ * caches of the library are not shared with the user or other tests.
+ * Should be called before fm_init(). */
+char* test_util_make_cache_dir(const char* name)
+{
+    char* tmpl = g_strconcat(name, "-cache-XXXXXX", NULL);
+    char* dir = g_dir_make_tmp(tmpl, NULL);
+
+    g_assert(dir != NULL);
+    g_setenv("XDG_CACHE_HOME", dir, TRUE);
+    g_free(tmpl);
+    return dir;
+}
+
+void test_util_remove_dir(const char* path)
+{
+    GDir* dir = g_dir_open(path, 0, NULL);
+    const char* name;
+
+    if(dir)
+    {
+        while((name = g_dir_read_name(dir)))
+        {
+            char* child = g_build_filename(path, name, NULL);
+            if(g_file_test(child, G_FILE_TEST_IS_DIR))
+                test_util_remove_dir(child);
+            else
+                g_unlink(child);
+            g_free(child);
+        }
+        g_dir_close(dir);
+    }
+    g_rmdir(path);
+}
+
+/* creates empty files in @dir named by @format with numbers from @first */
+void test_util_create_files(const char* dir, const char* format, int first, int n_files)
+{
+    int i;
+
+    for(i = first; i < first + n_files; ++i)
+    {
+        char* base = g_strdup_printf(format, i);
+        char* name = g_build_filename(dir, base, NULL);
+        g_assert(g_file_set_contents(name, "", -1, NULL));
+        g_free(name);
+        g_free(base);
+    }
+}
+
+/* a new empty temporary directory */
+char* test_util_make_dir(const char* name)
+{
+    char* tmpl = g_strconcat(name, "-XXXXXX", NULL);
+    char* dir = g_dir_make_tmp(tmpl, NULL);
+
+    g_assert(dir != NULL);
+    g_free(tmpl);
+    return dir;
+}
+
+/* the same with @n_files empty files in it */
+char* test_util_make_dir_with_files(const char* name, const char* format, int n_files)
+{
+    char* dir = test_util_make_dir(name);
+
+    test_util_create_files(dir, format, 0, n_files);
+    return dir;
+}
+
+/* Runs @func in @n_threads threads at once, each one gets its own element
+ * of the array @data, and returns how many seconds they all took. */
+double test_util_run_threads(int n_threads, GThreadFunc func, gpointer data, gsize data_size)
+{
+    GThread** threads = g_new(GThread*, n_threads);
+    GTimer* timer = g_timer_new();
+    double elapsed;
+    int i;
+
+    for(i = 0; i < n_threads; ++i)
+        threads[i] = g_thread_new("test", func, (char*)data + i * data_size);
+    for(i = 0; i < n_threads; ++i)
+        g_thread_join(threads[i]);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    g_free(threads);
+    return elapsed;
+}
+
+/* Reports the times of the same work per thread done by one thread and by
+ * @n_threads threads; without contention the times are about the same. */
+void test_util_report_scaling(const char* what, int n_threads, double single_time, double multi_time)
+{
+    g_test_message("%s: 1 thread %.3f s, %d threads %.3f s (%.2fx throughput)",
+                   what, single_time, n_threads, multi_time,
+                   multi_time > 0 ? n_threads * single_time / multi_time : 0.0);
+    g_test_minimized_result(multi_time, "%d threads: %.3f s", n_threads, multi_time);
+}
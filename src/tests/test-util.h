@@ -0,0 +1,42 @@
+/*
+ *      test-util.h
+ *
+ *      Copyright 2014 Vadim Ushakov <igeekless@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef _TEST_UTIL_H_
+#define _TEST_UTIL_H_
+
+/* helpers shared by the tests */
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+char*  test_util_make_cache_dir(const char* name);
+void   test_util_remove_dir(const char* path);
+char*  test_util_make_dir(const char* name);
+char*  test_util_make_dir_with_files(const char* name, const char* format, int n_files);
+void   test_util_create_files(const char* dir, const char* format, int first, int n_files);
+
+double test_util_run_threads(int n_threads, GThreadFunc func, gpointer data, gsize data_size);
+void   test_util_report_scaling(const char* what, int n_threads, double single_time, double multi_time);
+
+G_END_DECLS
+
+#endif